@@ -1,6 +1,17 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <zlib.h>
 
 #include "archive.h"
 #include "engine.h"
@@ -96,6 +107,944 @@ void format_zip_error(const char *prefix, zip_t *zip, char **error_msg) {
     }
 }
 
+static void set_error_msg(char **error_msg, const char *fmt, ...) {
+    if (error_msg && !*error_msg) {
+        *error_msg = malloc(1024);
+        if (*error_msg) {
+            va_list args;
+            va_start(args, fmt);
+            vsnprintf(*error_msg, 1024, fmt, args);
+            va_end(args);
+        }
+    }
+}
+
+static int default_parallelism(int parallelism, size_t num_entries) {
+    if (parallelism <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        parallelism = cpus > 0 ? (int) cpus : 1;
+    }
+    if (num_entries < (size_t) parallelism) {
+        parallelism = num_entries > 0 ? (int) num_entries : 1;
+    }
+    return parallelism;
+}
+
+int list_archive(const char *path, archive_entry_t **entries, size_t *num_entries, char **error_msg) {
+    *entries = NULL;
+    *num_entries = 0;
+
+    zip_t *archive = open_archive(path, error_msg);
+    if (!archive) {
+        return -1;
+    }
+
+    zip_int64_t count = zip_get_num_entries(archive, 0);
+    if (count < 0) {
+        format_zip_error("zip_get_num_entries", archive, error_msg);
+        zip_close(archive);
+        return -1;
+    }
+
+    archive_entry_t *result = calloc(count > 0 ? (size_t) count : 1, sizeof(archive_entry_t));
+    if (!result) {
+        set_error_msg(error_msg, "%s", strerror(errno));
+        zip_close(archive);
+        return -1;
+    }
+
+    zip_uint64_t i;
+    for (i = 0; i < (zip_uint64_t) count; i++) {
+        zip_stat_t stat;
+        if (zip_stat_index(archive, i, 0, &stat) < 0) {
+            format_zip_error("zip_stat_index", archive, error_msg);
+            free_archive_entries(result, (size_t) i);
+            zip_close(archive);
+            return -1;
+        }
+
+        archive_entry_t *entry = &result[i];
+        entry->name = strdup(stat.name);
+        entry->size = stat.size;
+        entry->compressed_size = stat.comp_size;
+        entry->modified = stat.mtime;
+        entry->crc = stat.crc;
+        entry->method = stat.comp_method;
+
+        zip_uint8_t opsys;
+        zip_uint32_t attributes;
+        if (zip_file_get_external_attributes(archive, i, 0, &opsys, &attributes) == 0
+            && opsys == ZIP_OPSYS_UNIX) {
+            entry->mode = attributes >> 16;
+        }
+    }
+
+    zip_close(archive);
+
+    *entries = result;
+    *num_entries = (size_t) count;
+    return 0;
+}
+
+void free_archive_entries(archive_entry_t *entries, size_t num_entries) {
+    size_t i;
+    for (i = 0; i < num_entries; i++) {
+        free(entries[i].name);
+    }
+    free(entries);
+}
+
+// Extraction
+
+#define ARCHIVE_BUF_SIZE (64 * 1024)
+
+typedef struct extract_job {
+    const char *path;
+    const char *dir;
+    zip_uint64_t *indices;
+    size_t num_indices;
+    pthread_mutex_t lock;
+    size_t next;
+    char *error_msg;
+} extract_job_t;
+
+// Rejects entry names that would land outside of the target directory.
+static bool is_safe_entry_name(const char *name) {
+    if (name[0] == '\0' || name[0] == '/') {
+        return false;
+    }
+    const char *component = name;
+    while (*component) {
+        const char *slash = strchr(component, '/');
+        size_t len = slash ? slash - component : strlen(component);
+        if (len == 2 && strncmp(component, "..", 2) == 0) {
+            return false;
+        }
+        if (!slash) {
+            break;
+        }
+        component = slash + 1;
+    }
+    return true;
+}
+
+// Creates path and any missing parents, leaving permissions to the umask.
+static int make_dirs(char *path) {
+    if (*path == '\0') {
+        return 0;
+    }
+    char *p;
+    for (p = path + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            int rv = mkdir(path, 0777);
+            *p = '/';
+            if (rv != 0 && errno != EEXIST) {
+                return -1;
+            }
+        }
+    }
+    if (mkdir(path, 0777) != 0 && errno != EEXIST) {
+        return -1;
+    }
+    return 0;
+}
+
+static int write_fully(int fd, const uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int extract_entry(zip_t *archive, zip_uint64_t index, const char *dir, uint8_t *buf, char **error_msg) {
+    zip_stat_t stat;
+    if (zip_stat_index(archive, index, 0, &stat) < 0) {
+        format_zip_error("zip_stat_index", archive, error_msg);
+        return -1;
+    }
+
+    if (!is_safe_entry_name(stat.name)) {
+        set_error_msg(error_msg, "Refusing to extract %s outside of %s", stat.name, dir);
+        return -1;
+    }
+
+    size_t dir_len = strlen(dir);
+    bool needs_slash = dir_len > 0 && dir[dir_len - 1] != '/';
+    char *full_path = malloc(dir_len + strlen(stat.name) + 2);
+    sprintf(full_path, "%s%s%s", dir, needs_slash ? "/" : "", stat.name);
+
+    int rv = -1;
+
+    size_t full_len = strlen(full_path);
+    if (full_path[full_len - 1] == '/') {
+        full_path[full_len - 1] = '\0';
+        if (make_dirs(full_path) != 0) {
+            set_error_msg(error_msg, "%s: %s", full_path, strerror(errno));
+            goto free_path;
+        }
+        rv = 0;
+        goto free_path;
+    }
+
+    char *last_slash = strrchr(full_path, '/');
+    if (last_slash && last_slash != full_path) {
+        *last_slash = '\0';
+        int made = make_dirs(full_path);
+        *last_slash = '/';
+        if (made != 0) {
+            set_error_msg(error_msg, "%s: %s", full_path, strerror(errno));
+            goto free_path;
+        }
+    }
+
+    mode_t mode = 0644;
+    zip_uint8_t opsys;
+    zip_uint32_t attributes;
+    if (zip_file_get_external_attributes(archive, index, 0, &opsys, &attributes) == 0
+        && opsys == ZIP_OPSYS_UNIX && ((attributes >> 16) & 0777)) {
+        mode = (attributes >> 16) & 0777;
+    }
+
+    zip_file_t *f = zip_fopen_index(archive, index, 0);
+    if (!f) {
+        format_zip_error("zip_fopen_index", archive, error_msg);
+        goto free_path;
+    }
+
+    int fd = open(full_path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (fd < 0) {
+        set_error_msg(error_msg, "%s: %s", full_path, strerror(errno));
+        goto close_f;
+    }
+
+    zip_int64_t n;
+    while ((n = zip_fread(f, buf, ARCHIVE_BUF_SIZE)) > 0) {
+        if (write_fully(fd, buf, (size_t) n) != 0) {
+            set_error_msg(error_msg, "%s: %s", full_path, strerror(errno));
+            break;
+        }
+    }
+    if (n < 0) {
+        format_zip_error("zip_fread", archive, error_msg);
+    }
+
+    if (close(fd) != 0 && n == 0) {
+        set_error_msg(error_msg, "%s: %s", full_path, strerror(errno));
+        n = -1;
+    }
+
+    if (n == 0) {
+        struct timeval times[2];
+        times[0].tv_sec = stat.mtime;
+        times[0].tv_usec = 0;
+        times[1] = times[0];
+        utimes(full_path, times);
+        rv = 0;
+    }
+
+    close_f:
+    zip_fclose(f);
+
+    free_path:
+    free(full_path);
+
+    return rv;
+}
+
+static void *extract_worker(void *data) {
+    extract_job_t *job = data;
+
+    char *error_msg = NULL;
+    zip_t *archive = open_archive(job->path, &error_msg);
+    uint8_t *buf = malloc(ARCHIVE_BUF_SIZE);
+
+    while (archive && buf) {
+        pthread_mutex_lock(&job->lock);
+        if (job->error_msg || job->next == job->num_indices) {
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+        zip_uint64_t index = job->indices[job->next++];
+        pthread_mutex_unlock(&job->lock);
+
+        if (extract_entry(archive, index, job->dir, buf, &error_msg) != 0) {
+            break;
+        }
+    }
+
+    if (!buf) {
+        set_error_msg(&error_msg, "%s", strerror(errno));
+    }
+
+    if (error_msg) {
+        pthread_mutex_lock(&job->lock);
+        if (!job->error_msg) {
+            job->error_msg = error_msg;
+        } else {
+            free(error_msg);
+        }
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    free(buf);
+    if (archive) {
+        zip_close(archive);
+    }
+
+    return NULL;
+}
+
+int extract_archive(const char *path, const char *dir, char **names, size_t num_names, int parallelism,
+                    char **error_msg) {
+    zip_t *archive = open_archive(path, error_msg);
+    if (!archive) {
+        return -1;
+    }
+
+    extract_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.path = path;
+    job.dir = dir;
+
+    if (names) {
+        job.indices = malloc((num_names ? num_names : 1) * sizeof(zip_uint64_t));
+        size_t i;
+        for (i = 0; i < num_names; i++) {
+            zip_int64_t index = zip_name_locate(archive, names[i], 0);
+            if (index < 0) {
+                set_error_msg(error_msg, "No entry %s in %s", names[i], path);
+                free(job.indices);
+                zip_close(archive);
+                return -1;
+            }
+            job.indices[job.num_indices++] = (zip_uint64_t) index;
+        }
+    } else {
+        zip_int64_t count = zip_get_num_entries(archive, 0);
+        job.indices = malloc((count > 0 ? (size_t) count : 1) * sizeof(zip_uint64_t));
+        zip_int64_t i;
+        for (i = 0; i < count; i++) {
+            job.indices[job.num_indices++] = (zip_uint64_t) i;
+        }
+    }
+
+    zip_close(archive);
+
+    char *dir_copy = strdup(dir);
+    int made = make_dirs(dir_copy);
+    free(dir_copy);
+    if (made != 0) {
+        set_error_msg(error_msg, "%s: %s", dir, strerror(errno));
+        free(job.indices);
+        return -1;
+    }
+
+    pthread_mutex_init(&job.lock, NULL);
+
+    int num_threads = default_parallelism(parallelism, job.num_indices);
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    int started = 0;
+    for (; started < num_threads; started++) {
+        if (pthread_create(&threads[started], NULL, extract_worker, &job) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        extract_worker(&job);
+    }
+
+    int i;
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    pthread_mutex_destroy(&job.lock);
+    free(job.indices);
+
+    if (job.error_msg) {
+        if (error_msg && !*error_msg) {
+            *error_msg = job.error_msg;
+        } else {
+            free(job.error_msg);
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+// Creation
+//
+// libzip compresses entries one at a time when the archive is closed, so archives are instead
+// written directly: worker threads read and deflate entries with zlib while the calling thread
+// writes the finished entries out in order, followed by the central directory. Workers stay at
+// most a few entries ahead of the writer, and spool compressed data that outgrows memory to a
+// temporary file, so memory use doesn't depend on the size of the inputs. Archives that outgrow
+// the classic format's 32-bit sizes and offsets or 16-bit entry count use ZIP64 records.
+
+#define ZIP_LOCAL_HEADER_SIG 0x04034b50
+#define ZIP_CENTRAL_HEADER_SIG 0x02014b50
+#define ZIP64_END_OF_CENTRAL_DIR_SIG 0x06064b50
+#define ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIG 0x07064b50
+#define ZIP_END_OF_CENTRAL_DIR_SIG 0x06054b50
+#define ZIP64_EXTRA_ID 0x0001
+#define ZIP_FLAG_UTF_8 0x0800
+#define ZIP_VERSION_NEEDED 20
+#define ZIP64_VERSION_NEEDED 45
+#define ZIP_VERSION_MADE_BY ((3 << 8) | ZIP64_VERSION_NEEDED)
+#define ZIP_MAX_16 0xffffU
+#define ZIP_MAX_32 0xffffffffULL
+#define ZIP_SPOOL_MEMORY (1024 * 1024)
+
+// Entry data, held in memory until it outgrows ZIP_SPOOL_MEMORY and in a temporary file after.
+typedef struct spool {
+    uint8_t *buf;
+    size_t len;
+    size_t capacity;
+    FILE *file;
+    uint64_t total;
+} spool_t;
+
+static int spool_write(spool_t *spool, const uint8_t *data, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+
+    if (!spool->file && spool->len + len > ZIP_SPOOL_MEMORY) {
+        spool->file = tmpfile();
+        if (!spool->file || (spool->len > 0 && fwrite(spool->buf, spool->len, 1, spool->file) != 1)) {
+            return -1;
+        }
+        free(spool->buf);
+        spool->buf = NULL;
+        spool->len = 0;
+        spool->capacity = 0;
+    }
+
+    if (spool->file) {
+        if (fwrite(data, len, 1, spool->file) != 1) {
+            return -1;
+        }
+    } else {
+        if (spool->len + len > spool->capacity) {
+            size_t capacity = spool->capacity ? spool->capacity : ARCHIVE_BUF_SIZE;
+            while (capacity < spool->len + len) {
+                capacity *= 2;
+            }
+            uint8_t *buf = realloc(spool->buf, capacity);
+            if (!buf) {
+                return -1;
+            }
+            spool->buf = buf;
+            spool->capacity = capacity;
+        }
+        memcpy(spool->buf + spool->len, data, len);
+        spool->len += len;
+    }
+
+    spool->total += len;
+    return 0;
+}
+
+static int spool_copy(spool_t *spool, FILE *out, uint8_t *buf) {
+    if (spool->len > 0 && fwrite(spool->buf, spool->len, 1, out) != 1) {
+        return -1;
+    }
+    if (spool->file) {
+        if (fflush(spool->file) != 0 || fseeko(spool->file, 0, SEEK_SET) != 0) {
+            return -1;
+        }
+        size_t n;
+        while ((n = fread(buf, 1, ARCHIVE_BUF_SIZE, spool->file)) > 0) {
+            if (fwrite(buf, n, 1, out) != 1) {
+                return -1;
+            }
+        }
+        if (ferror(spool->file)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void spool_free(spool_t *spool) {
+    free(spool->buf);
+    if (spool->file) {
+        fclose(spool->file);
+    }
+    memset(spool, 0, sizeof(spool_t));
+}
+
+typedef struct compressed_entry {
+    bool done;
+    char *error_msg;
+    char *name;
+    spool_t data;
+    uint64_t size;
+    uint32_t crc;
+    uint16_t method;
+    time_t modified;
+    mode_t mode;
+    bool directory;
+    uint64_t offset;
+} compressed_entry_t;
+
+typedef struct create_job {
+    char **names;
+    char **sources;
+    size_t num_entries;
+    int level;
+    compressed_entry_t *entries;
+    pthread_mutex_t lock;
+    pthread_cond_t done_cond;
+    pthread_cond_t room_cond;
+    size_t next;
+    // Entries before this have been written, and workers don't start entries more than window
+    // entries beyond it
+    size_t written;
+    size_t window;
+    bool cancelled;
+} create_job_t;
+
+// Reads source into the entry's spool, deflating it if level is positive. bufs holds two
+// buffers of ARCHIVE_BUF_SIZE bytes.
+static int spool_file(compressed_entry_t *entry, const char *source, int level, uint8_t *bufs) {
+    uint8_t *in = bufs;
+    uint8_t *out = bufs + ARCHIVE_BUF_SIZE;
+
+    int fd = open(source, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    bool deflating = level > 0;
+    if (deflating && deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    uint64_t size = 0;
+    int rv = 0;
+    for (;;) {
+        ssize_t n = read(fd, in, ARCHIVE_BUF_SIZE);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            rv = -1;
+            break;
+        }
+        crc = crc32(crc, in, (uInt) n);
+        size += n;
+
+        if (deflating) {
+            stream.next_in = in;
+            stream.avail_in = (uInt) n;
+            do {
+                stream.next_out = out;
+                stream.avail_out = ARCHIVE_BUF_SIZE;
+                if (deflate(&stream, n == 0 ? Z_FINISH : Z_NO_FLUSH) == Z_STREAM_ERROR
+                    || spool_write(&entry->data, out, ARCHIVE_BUF_SIZE - stream.avail_out) != 0) {
+                    rv = -1;
+                    break;
+                }
+            } while (stream.avail_out == 0);
+        } else if (spool_write(&entry->data, in, (size_t) n) != 0) {
+            rv = -1;
+        }
+
+        if (rv != 0 || n == 0) {
+            break;
+        }
+    }
+
+    int saved_errno = errno;
+    if (deflating) {
+        deflateEnd(&stream);
+    }
+    close(fd);
+    errno = saved_errno;
+
+    entry->crc = (uint32_t) crc;
+    entry->size = size;
+    entry->method = deflating ? ZIP_CM_DEFLATE : ZIP_CM_STORE;
+    return rv;
+}
+
+static void compress_entry(create_job_t *job, size_t i, uint8_t *bufs) {
+    compressed_entry_t *entry = &job->entries[i];
+    const char *source = job->sources[i];
+
+    const char *name = job->names[i];
+    while (*name == '/') {
+        name++;
+    }
+
+    struct stat file_stat;
+    if (source) {
+        if (stat(source, &file_stat) != 0) {
+            set_error_msg(&entry->error_msg, "%s: %s", source, strerror(errno));
+            return;
+        }
+        entry->modified = file_stat.st_mtime;
+        entry->mode = file_stat.st_mode & 0777;
+        entry->directory = S_ISDIR(file_stat.st_mode);
+    } else {
+        entry->modified = time(NULL);
+        entry->mode = 0755;
+        entry->directory = true;
+    }
+
+    if (entry->directory) {
+        size_t len = strlen(name);
+        entry->name = malloc(len + 2);
+        strcpy(entry->name, name);
+        if (len == 0 || name[len - 1] != '/') {
+            strcat(entry->name, "/");
+        }
+        entry->mode |= S_IFDIR;
+        return;
+    }
+
+    entry->name = strdup(name);
+    entry->mode |= S_IFREG;
+
+    int rv = spool_file(entry, source, file_stat.st_size > 0 ? job->level : 0, bufs);
+
+    // Store entries that don't get any smaller
+    if (rv == 0 && entry->method == ZIP_CM_DEFLATE && entry->data.total >= entry->size) {
+        spool_free(&entry->data);
+        rv = spool_file(entry, source, 0, bufs);
+    }
+
+    if (rv != 0) {
+        set_error_msg(&entry->error_msg, "%s: %s", source, strerror(errno));
+    }
+}
+
+static void *create_worker(void *data) {
+    create_job_t *job = data;
+
+    uint8_t *bufs = malloc(2 * ARCHIVE_BUF_SIZE);
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        while (!job->cancelled && job->next < job->num_entries && job->next >= job->written + job->window) {
+            pthread_cond_wait(&job->room_cond, &job->lock);
+        }
+        if (!bufs || job->cancelled || job->next == job->num_entries) {
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+        size_t i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        compress_entry(job, i, bufs);
+
+        pthread_mutex_lock(&job->lock);
+        job->entries[i].done = true;
+        pthread_cond_broadcast(&job->done_cond);
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    free(bufs);
+    return NULL;
+}
+
+static void put_16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+}
+
+static void put_32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+    p[2] = (uint8_t) (v >> 16);
+    p[3] = (uint8_t) (v >> 24);
+}
+
+static void put_64(uint8_t *p, uint64_t v) {
+    put_32(p, (uint32_t) v);
+    put_32(p + 4, (uint32_t) (v >> 32));
+}
+
+static void dos_date_time(time_t t, uint16_t *dos_date, uint16_t *dos_time) {
+    struct tm tm;
+    localtime_r(&t, &tm);
+    if (tm.tm_year < 80) {
+        *dos_date = (1 << 5) | 1;
+        *dos_time = 0;
+        return;
+    }
+    *dos_date = (uint16_t) (((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+    *dos_time = (uint16_t) ((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+}
+
+static bool needs_zip64_sizes(compressed_entry_t *entry) {
+    // Compressed data is never larger than the entry, since entries that don't shrink are stored
+    return entry->size >= ZIP_MAX_32;
+}
+
+static bool needs_zip64(compressed_entry_t *entry) {
+    return needs_zip64_sizes(entry) || entry->offset >= ZIP_MAX_32;
+}
+
+// Fills in the fields shared by local and central headers, starting at the version needed. Sizes
+// that don't fit are left to the ZIP64 extra field.
+static void put_common_header(uint8_t *p, compressed_entry_t *entry, uint16_t extra_len) {
+    uint16_t dos_date, dos_time;
+    dos_date_time(entry->modified, &dos_date, &dos_time);
+    bool zip64_sizes = needs_zip64_sizes(entry);
+    put_16(p, needs_zip64(entry) ? ZIP64_VERSION_NEEDED : ZIP_VERSION_NEEDED);
+    put_16(p + 2, ZIP_FLAG_UTF_8);
+    put_16(p + 4, entry->method);
+    put_16(p + 6, dos_time);
+    put_16(p + 8, dos_date);
+    put_32(p + 10, entry->crc);
+    put_32(p + 14, zip64_sizes ? (uint32_t) ZIP_MAX_32 : (uint32_t) entry->data.total);
+    put_32(p + 18, zip64_sizes ? (uint32_t) ZIP_MAX_32 : (uint32_t) entry->size);
+    put_16(p + 22, (uint16_t) strlen(entry->name));
+    put_16(p + 24, extra_len);
+}
+
+// Fills in a ZIP64 extra field holding the sizes, and the offset if central is set, for those
+// that don't fit in the header. Returns its length, or 0 if none is needed.
+static uint16_t put_zip64_extra(uint8_t *p, compressed_entry_t *entry, bool central) {
+    uint16_t len = 4;
+    if (needs_zip64_sizes(entry)) {
+        put_64(p + len, entry->size);
+        put_64(p + len + 8, entry->data.total);
+        len += 16;
+    }
+    if (central && entry->offset >= ZIP_MAX_32) {
+        put_64(p + len, entry->offset);
+        len += 8;
+    }
+    if (len == 4) {
+        return 0;
+    }
+    put_16(p, ZIP64_EXTRA_ID);
+    put_16(p + 2, len - 4);
+    return len;
+}
+
+static int write_end_of_central_dir(FILE *out, size_t num_entries, uint64_t central_dir_offset,
+                                    uint64_t end_offset) {
+    uint64_t central_dir_size = end_offset - central_dir_offset;
+
+    if (num_entries >= ZIP_MAX_16 || central_dir_size >= ZIP_MAX_32 || central_dir_offset >= ZIP_MAX_32) {
+        uint8_t end64[56];
+        put_32(end64, ZIP64_END_OF_CENTRAL_DIR_SIG);
+        put_64(end64 + 4, sizeof(end64) - 12);
+        put_16(end64 + 12, ZIP_VERSION_MADE_BY);
+        put_16(end64 + 14, ZIP64_VERSION_NEEDED);
+        put_32(end64 + 16, 0);
+        put_32(end64 + 20, 0);
+        put_64(end64 + 24, num_entries);
+        put_64(end64 + 32, num_entries);
+        put_64(end64 + 40, central_dir_size);
+        put_64(end64 + 48, central_dir_offset);
+
+        uint8_t locator[20];
+        put_32(locator, ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIG);
+        put_32(locator + 4, 0);
+        put_64(locator + 8, end_offset);
+        put_32(locator + 16, 1);
+
+        if (fwrite(end64, sizeof(end64), 1, out) != 1 || fwrite(locator, sizeof(locator), 1, out) != 1) {
+            return -1;
+        }
+    }
+
+    uint8_t end[22];
+    put_32(end, ZIP_END_OF_CENTRAL_DIR_SIG);
+    put_16(end + 4, 0);
+    put_16(end + 6, 0);
+    put_16(end + 8, (uint16_t) (num_entries < ZIP_MAX_16 ? num_entries : ZIP_MAX_16));
+    put_16(end + 10, (uint16_t) (num_entries < ZIP_MAX_16 ? num_entries : ZIP_MAX_16));
+    put_32(end + 12, (uint32_t) (central_dir_size < ZIP_MAX_32 ? central_dir_size : ZIP_MAX_32));
+    put_32(end + 16, (uint32_t) (central_dir_offset < ZIP_MAX_32 ? central_dir_offset : ZIP_MAX_32));
+    put_16(end + 20, 0);
+
+    return fwrite(end, sizeof(end), 1, out) == 1 ? 0 : -1;
+}
+
+static int write_entries(FILE *out, create_job_t *job, uint8_t *bufs, char **error_msg) {
+    uint64_t offset = 0;
+    size_t i;
+    for (i = 0; i < job->num_entries; i++) {
+        compressed_entry_t *entry = &job->entries[i];
+
+        // Compress the entry here if no worker has started on it
+        pthread_mutex_lock(&job->lock);
+        bool claimed = job->next == i;
+        if (claimed) {
+            job->next++;
+        }
+        while (!claimed && !entry->done) {
+            pthread_cond_wait(&job->done_cond, &job->lock);
+        }
+        pthread_mutex_unlock(&job->lock);
+
+        if (claimed) {
+            compress_entry(job, i, bufs);
+        }
+
+        if (entry->error_msg) {
+            set_error_msg(error_msg, "%s", entry->error_msg);
+            return -1;
+        }
+
+        size_t name_len = strlen(entry->name);
+        if (name_len > ZIP_MAX_16) {
+            set_error_msg(error_msg, "Entry name too long: %s", entry->name);
+            return -1;
+        }
+
+        entry->offset = offset;
+
+        uint8_t header[30];
+        uint8_t extra[20];
+        uint16_t extra_len = put_zip64_extra(extra, entry, false);
+        put_32(header, ZIP_LOCAL_HEADER_SIG);
+        put_common_header(header + 4, entry, extra_len);
+
+        if (fwrite(header, sizeof(header), 1, out) != 1
+            || fwrite(entry->name, 1, name_len, out) != name_len
+            || (extra_len > 0 && fwrite(extra, extra_len, 1, out) != 1)
+            || spool_copy(&entry->data, out, bufs) != 0) {
+            set_error_msg(error_msg, "%s", strerror(errno));
+            return -1;
+        }
+
+        offset += sizeof(header) + name_len + extra_len + entry->data.total;
+
+        uint64_t data_len = entry->data.total;
+        spool_free(&entry->data);
+        entry->data.total = data_len;
+
+        pthread_mutex_lock(&job->lock);
+        job->written = i + 1;
+        pthread_cond_broadcast(&job->room_cond);
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    uint64_t central_dir_offset = offset;
+    for (i = 0; i < job->num_entries; i++) {
+        compressed_entry_t *entry = &job->entries[i];
+        size_t name_len = strlen(entry->name);
+
+        uint8_t header[46];
+        uint8_t extra[28];
+        uint16_t extra_len = put_zip64_extra(extra, entry, true);
+        put_32(header, ZIP_CENTRAL_HEADER_SIG);
+        put_16(header + 4, ZIP_VERSION_MADE_BY);
+        put_common_header(header + 6, entry, extra_len);
+        put_16(header + 32, 0);
+        put_16(header + 34, 0);
+        put_16(header + 36, 0);
+        put_32(header + 38, ((uint32_t) entry->mode << 16) | (entry->directory ? 0x10 : 0));
+        put_32(header + 42, (uint32_t) (entry->offset < ZIP_MAX_32 ? entry->offset : ZIP_MAX_32));
+
+        if (fwrite(header, sizeof(header), 1, out) != 1
+            || fwrite(entry->name, 1, name_len, out) != name_len
+            || (extra_len > 0 && fwrite(extra, extra_len, 1, out) != 1)) {
+            set_error_msg(error_msg, "%s", strerror(errno));
+            return -1;
+        }
+
+        offset += sizeof(header) + name_len + extra_len;
+    }
+
+    if (write_end_of_central_dir(out, job->num_entries, central_dir_offset, offset) != 0) {
+        set_error_msg(error_msg, "%s", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int create_archive(const char *path, char **names, char **sources, size_t num_entries, int level,
+                   int parallelism, char **error_msg) {
+    uint8_t *bufs = malloc(2 * ARCHIVE_BUF_SIZE);
+    FILE *out = bufs ? fopen(path, "wb") : NULL;
+    if (!out) {
+        set_error_msg(error_msg, "%s: %s", path, strerror(errno));
+        free(bufs);
+        return -1;
+    }
+
+    create_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.names = names;
+    job.sources = sources;
+    job.num_entries = num_entries;
+    job.level = level < 0 ? Z_DEFAULT_COMPRESSION : level > 9 ? 9 : level;
+    job.entries = calloc(num_entries ? num_entries : 1, sizeof(compressed_entry_t));
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.done_cond, NULL);
+    pthread_cond_init(&job.room_cond, NULL);
+
+    int num_threads = default_parallelism(parallelism, num_entries);
+    job.window = 2 * (size_t) num_threads;
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    int started = 0;
+    for (; started < num_threads; started++) {
+        if (pthread_create(&threads[started], NULL, create_worker, &job) != 0) {
+            break;
+        }
+    }
+
+    int rv = write_entries(out, &job, bufs, error_msg);
+
+    pthread_mutex_lock(&job.lock);
+    job.cancelled = true;
+    pthread_cond_broadcast(&job.room_cond);
+    pthread_mutex_unlock(&job.lock);
+
+    int i;
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    free(bufs);
+
+    if (fclose(out) != 0 && rv == 0) {
+        set_error_msg(error_msg, "%s: %s", path, strerror(errno));
+        rv = -1;
+    }
+    if (rv != 0) {
+        unlink(path);
+    }
+
+    size_t j;
+    for (j = 0; j < num_entries; j++) {
+        free(job.entries[j].error_msg);
+        free(job.entries[j].name);
+        spool_free(&job.entries[j].data);
+    }
+    free(job.entries);
+    pthread_cond_destroy(&job.room_cond);
+    pthread_cond_destroy(&job.done_cond);
+    pthread_mutex_destroy(&job.lock);
+
+    return rv;
+}
+
 #ifdef ZIP_TEST
 int main(int argc, char **argv) {
     if (argc != 3) {
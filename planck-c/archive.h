@@ -8,3 +8,31 @@ typedef struct contents_zip {
 void* open_archive(const char *path, char **error_msg);
 void close_archive(void* archive);
 contents_zip_t get_contents_zip(void* archive, const char *name, time_t *last_modified, char **error_msg);
+
+typedef struct archive_entry {
+    char *name;
+    uint64_t size;
+    uint64_t compressed_size;
+    time_t modified;
+    uint32_t crc;
+    uint16_t method;
+    // Unix mode bits, or 0 if the archive doesn't record them
+    uint32_t mode;
+} archive_entry_t;
+
+// Lists the entries in the archive at path. Returns 0 on success; on failure returns -1 and
+// sets *error_msg.
+int list_archive(const char *path, archive_entry_t **entries, size_t *num_entries, char **error_msg);
+void free_archive_entries(archive_entry_t *entries, size_t num_entries);
+
+// Extracts the named entries (or all entries if names is NULL) into dir, using up to
+// parallelism threads (0 for one per CPU).
+int extract_archive(const char *path, const char *dir, char **names, size_t num_names, int parallelism,
+                    char **error_msg);
+
+// Creates an archive at path holding num_entries entries. The contents of each entry are read
+// from the corresponding file in sources; a NULL source or a directory source produces a
+// directory entry. Entries are deflated at the given level (0 to store) on up to parallelism
+// threads (0 for one per CPU).
+int create_archive(const char *path, char **names, char **sources, size_t num_entries, int level,
+                   int parallelism, char **error_msg);
@@ -0,0 +1,210 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "async_io.h"
+#include "dir_cache.h"
+#include "engine.h"
+#include "file.h"
+#include "io.h"
+#include "jsc_utils.h"
+#include "tasks.h"
+
+#define ASYNC_IO_MIN_THREADS 4
+#define ASYNC_IO_MAX_THREADS 16
+
+typedef enum {
+    ASYNC_IO_READ,
+    ASYNC_IO_WRITE_TEXT,
+    ASYNC_IO_WRITE_BYTES,
+    ASYNC_IO_COPY
+} async_io_kind_t;
+
+typedef struct job {
+    async_io_kind_t kind;
+    int cb_idx;
+    char *path;
+    char *to;
+    char *encoding;
+    bool append;
+    JSStringRef text;
+    uint8_t *bytes;
+    size_t length;
+    int error;
+    struct job *next;
+} job_t;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_available_cond = PTHREAD_COND_INITIALIZER;
+
+static bool pool_started = false;
+static job_t *queue_head = NULL;
+static job_t *queue_tail = NULL;
+
+static void run_job(job_t *job) {
+    switch (job->kind) {
+        case ASYNC_IO_READ:
+            if (job->encoding) {
+                job->text = file_read_text(job->path, job->encoding);
+                job->error = job->text ? 0 : errno;
+            } else {
+                job->bytes = read_file(job->path, &job->length);
+                job->error = job->bytes ? 0 : errno;
+            }
+            break;
+        case ASYNC_IO_WRITE_TEXT:
+            job->error = file_write_text(job->path, job->append, job->encoding, job->text) == 0 ? 0 : errno;
+            JSStringRelease(job->text);
+            job->text = NULL;
+            dir_cache_invalidate();
+            break;
+        case ASYNC_IO_WRITE_BYTES:
+            job->error = write_file(job->path, job->bytes, job->length, job->append) == 0 ? 0 : errno;
+            free(job->bytes);
+            job->bytes = NULL;
+            dir_cache_invalidate();
+            break;
+        case ASYNC_IO_COPY:
+            job->error = copy_file(job->path, job->to) == 0 ? 0 : errno;
+            dir_cache_invalidate();
+            break;
+    }
+}
+
+static void deliver_result(job_t *job) {
+    acquire_eval_lock();
+
+    JSValueRef args[3];
+    args[0] = JSValueMakeNumber(ctx, job->cb_idx);
+    if (job->text) {
+        args[1] = JSValueMakeString(ctx, job->text);
+        JSStringRelease(job->text);
+    } else if (job->bytes) {
+        args[1] = make_uint8_array(ctx, job->bytes, job->length);
+    } else {
+        args[1] = JSValueMakeNull(ctx);
+    }
+    args[2] = job->error ? c_string_to_value(ctx, strerror(job->error)) : JSValueMakeNull(ctx);
+
+    static JSObjectRef do_async_io_callback_fn = NULL;
+    if (!do_async_io_callback_fn) {
+        do_async_io_callback_fn = get_function("global", "do_async_io_callback");
+        JSValueProtect(ctx, do_async_io_callback_fn);
+    }
+    JSObjectCallAsFunction(ctx, do_async_io_callback_fn, NULL, 3, args, NULL);
+
+    release_eval_lock();
+
+    free(job->path);
+    free(job->to);
+    free(job->encoding);
+    free(job);
+
+    int err = signal_task_complete();
+    if (err) {
+        engine_print_err_message("async I/O signal_task_complete", err);
+    }
+}
+
+static void *async_io_worker(void *data) {
+    for (;;) {
+        pthread_mutex_lock(&queue_lock);
+        while (!queue_head) {
+            pthread_cond_wait(&job_available_cond, &queue_lock);
+        }
+        job_t *job = queue_head;
+        queue_head = job->next;
+        if (!queue_head) {
+            queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&queue_lock);
+
+        run_job(job);
+        deliver_result(job);
+    }
+    return NULL;
+}
+
+static void start_pool() {
+    pool_started = true;
+
+    // The work is I/O bound, so allow for more threads than cores
+    long num_threads = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads < ASYNC_IO_MIN_THREADS) {
+        num_threads = ASYNC_IO_MIN_THREADS;
+    } else if (num_threads > ASYNC_IO_MAX_THREADS) {
+        num_threads = ASYNC_IO_MAX_THREADS;
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    long i;
+    for (i = 0; i < num_threads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, async_io_worker, NULL) != 0) {
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
+}
+
+static void enqueue_job(job_t *job) {
+    int err = signal_task_started();
+    if (err) {
+        engine_print_err_message("async I/O signal_task_started", err);
+    }
+
+    pthread_mutex_lock(&queue_lock);
+    if (!pool_started) {
+        start_pool();
+    }
+    if (queue_tail) {
+        queue_tail->next = job;
+    } else {
+        queue_head = job;
+    }
+    queue_tail = job;
+    pthread_cond_signal(&job_available_cond);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+static job_t *make_job(async_io_kind_t kind, char *path, int cb_idx) {
+    job_t *job = calloc(1, sizeof(job_t));
+    job->kind = kind;
+    job->path = path;
+    job->cb_idx = cb_idx;
+    return job;
+}
+
+void async_io_read(char *path, char *encoding, int cb_idx) {
+    job_t *job = make_job(ASYNC_IO_READ, path, cb_idx);
+    job->encoding = encoding;
+    enqueue_job(job);
+}
+
+void async_io_write_text(char *path, bool append, char *encoding, JSStringRef text, int cb_idx) {
+    job_t *job = make_job(ASYNC_IO_WRITE_TEXT, path, cb_idx);
+    job->append = append;
+    job->encoding = encoding;
+    job->text = text;
+    enqueue_job(job);
+}
+
+void async_io_write_bytes(char *path, bool append, uint8_t *bytes, size_t length, int cb_idx) {
+    job_t *job = make_job(ASYNC_IO_WRITE_BYTES, path, cb_idx);
+    job->append = append;
+    job->bytes = bytes;
+    job->length = length;
+    enqueue_job(job);
+}
+
+void async_io_copy(char *from, char *to, int cb_idx) {
+    job_t *job = make_job(ASYNC_IO_COPY, from, cb_idx);
+    job->to = to;
+    enqueue_job(job);
+}
@@ -0,0 +1,20 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <JavaScriptCore/JavaScript.h>
+
+// Asynchronous file I/O runs on a pool of worker threads. Each operation counts as an
+// outstanding task, and its result is delivered on completion by calling the global
+// do_async_io_callback function with cb_idx, the result (or null), and an error message
+// (or null).
+//
+// These functions take ownership of their pointer arguments.
+
+// Reads the file at path as text in encoding, or as a Uint8Array if encoding is NULL.
+void async_io_read(char *path, char *encoding, int cb_idx);
+
+void async_io_write_text(char *path, bool append, char *encoding, JSStringRef text, int cb_idx);
+
+void async_io_write_bytes(char *path, bool append, uint8_t *bytes, size_t length, int cb_idx);
+
+void async_io_copy(char *from, char *to, int cb_idx);
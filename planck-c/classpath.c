@@ -0,0 +1,139 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "archive.h"
+#include "bundle.h"
+#include "classpath.h"
+#include "dir_cache.h"
+#include "engine.h"
+#include "globals.h"
+#include "io.h"
+#include "str.h"
+
+// Guards lazily opening JARs and reading from them, as libzip archives may not be shared across threads.
+static pthread_mutex_t archive_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+bool is_developing() {
+    return config.num_src_paths == 1 &&
+           strcmp(config.src_paths[0].type, "src") == 0 &&
+           str_has_suffix(config.src_paths[0].path, "/planck-cljs/src/") == 0;
+}
+
+static void print_error_msg(char *error_msg, bool quiet) {
+    if (error_msg) {
+        if (!quiet) {
+            engine_print(error_msg);
+            engine_print("\n");
+        }
+        free(error_msg);
+    }
+}
+
+contents_zip_t classpath_get_contents_zip(size_t src_path_ndx, const char *name, time_t *last_modified,
+                                          bool quiet) {
+    contents_zip_t rv;
+    rv.payload = NULL;
+    rv.length = 0;
+
+    struct src_path *src_path = &config.src_paths[src_path_ndx];
+
+    pthread_mutex_lock(&archive_mutex);
+
+    char *error_msg = NULL;
+    if (!src_path->archive) {
+        src_path->archive = open_archive(src_path->path, &error_msg);
+        print_error_msg(error_msg, quiet);
+        error_msg = NULL;
+    }
+    if (src_path->archive) {
+        rv = get_contents_zip(src_path->archive, name, last_modified, &error_msg);
+        print_error_msg(error_msg, quiet);
+    }
+
+    pthread_mutex_unlock(&archive_mutex);
+
+    return rv;
+}
+
+bool classpath_load(const char *path, struct loaded_source *result, bool quiet) {
+    result->contents = NULL;
+    result->last_modified = 0;
+    result->path = NULL;
+    result->type = NULL;
+    result->location = NULL;
+
+    bool developing = is_developing();
+
+    if (!developing) {
+        result->contents = bundle_get_contents((char *) path);
+        result->type = "bundled";
+    }
+
+    int i;
+    for (i = 0; result->contents == NULL && i < config.num_src_paths; i++) {
+        if (config.src_paths[i].blacklisted) {
+            continue;
+        }
+
+        char *type = config.src_paths[i].type;
+        char *location = config.src_paths[i].path;
+
+        if (strcmp(type, "src") == 0) {
+            if (!dir_cache_may_exist(location, path)) {
+                continue;
+            }
+            char *full_path = str_concat(location, path);
+            result->contents = get_contents(full_path, &result->last_modified);
+            if (result->contents != NULL) {
+                result->path = full_path;
+                result->type = type;
+                result->location = location;
+            } else {
+                free(full_path);
+            }
+        } else if (strcmp(type, "jar") == 0) {
+            struct stat file_stat;
+            if (stat(location, &file_stat) == 0) {
+                contents_zip_t contents_zip = classpath_get_contents_zip(i, path, &result->last_modified, quiet);
+                result->contents = (char *) contents_zip.payload;
+                result->type = type;
+                result->location = location;
+            } else if (!quiet) {
+                engine_perror(location);
+                config.src_paths[i].blacklisted = true;
+            }
+        }
+    }
+
+    // load from out/
+    if (result->contents == NULL && config.out_path != NULL && dir_cache_may_exist(config.out_path, path)) {
+        char *full_path = str_concat(config.out_path, path);
+        result->contents = get_contents(full_path, &result->last_modified);
+        free(full_path);
+        if (result->contents != NULL) {
+            // compiled output stands in for the bundled namespaces
+            result->type = "bundled";
+            result->location = NULL;
+        }
+    }
+
+    if (developing && result->contents == NULL) {
+        result->contents = bundle_get_contents((char *) path);
+        result->last_modified = 0;
+        result->type = "bundled";
+        result->location = NULL;
+    }
+
+    if (result->contents == NULL) {
+        return false;
+    }
+
+    if (result->path == NULL) {
+        result->path = strdup(path);
+    }
+
+    return true;
+}
@@ -0,0 +1,19 @@
+#include <stdbool.h>
+#include <time.h>
+
+struct loaded_source {
+    char *contents;
+    time_t last_modified;
+    char *path;
+    char *type;
+    char *location;
+};
+
+bool is_developing();
+
+contents_zip_t classpath_get_contents_zip(size_t src_path_ndx, const char *name, time_t *last_modified,
+                                          bool quiet);
+
+// Loads path from the bundle, the classpath, or the out directory, as PLANCK_LOAD does. When quiet,
+// errors are not reported and missing JARs are not blacklisted, so that it is safe to call off the main thread.
+bool classpath_load(const char *path, struct loaded_source *result, bool quiet);
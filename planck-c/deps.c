@@ -0,0 +1,1082 @@
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "deps.h"
+#include "globals.h"
+#include "io.h"
+#include "str.h"
+
+// Resolves the transitive closure of Maven dependencies using only the POMs in a local repository.
+// Conflicts are resolved the way Maven does: the version nearest to the root wins.
+
+#define DEPS_MAX_PARENT_DEPTH 16
+#define DEPS_MAX_INTERPOLATIONS 64
+
+// XML
+
+typedef struct xml_node {
+    char *name;
+    char *text;
+    size_t num_children;
+    struct xml_node **children;
+} xml_node_t;
+
+static void xml_free(xml_node_t *node) {
+    if (node) {
+        size_t i;
+        for (i = 0; i < node->num_children; i++) {
+            xml_free(node->children[i]);
+        }
+        free(node->children);
+        free(node->name);
+        free(node->text);
+        free(node);
+    }
+}
+
+static void xml_append_text(xml_node_t *node, const char *text, size_t len) {
+    size_t old_len = node->text ? strlen(node->text) : 0;
+    node->text = realloc(node->text, old_len + len + 1);
+    memcpy(node->text + old_len, text, len);
+    node->text[old_len + len] = '\0';
+}
+
+static void xml_append_decoded_text(xml_node_t *node, const char *text, size_t len) {
+    char *decoded = malloc(len + 1);
+    size_t i, j = 0;
+    for (i = 0; i < len; i++) {
+        if (text[i] == '&') {
+            const char *entity = text + i + 1;
+            size_t remaining = len - i - 1;
+            if (remaining >= 3 && strncmp(entity, "lt;", 3) == 0) {
+                decoded[j++] = '<';
+                i += 3;
+            } else if (remaining >= 3 && strncmp(entity, "gt;", 3) == 0) {
+                decoded[j++] = '>';
+                i += 3;
+            } else if (remaining >= 4 && strncmp(entity, "amp;", 4) == 0) {
+                decoded[j++] = '&';
+                i += 4;
+            } else if (remaining >= 5 && strncmp(entity, "quot;", 5) == 0) {
+                decoded[j++] = '"';
+                i += 5;
+            } else if (remaining >= 5 && strncmp(entity, "apos;", 5) == 0) {
+                decoded[j++] = '\'';
+                i += 5;
+            } else {
+                decoded[j++] = text[i];
+            }
+        } else {
+            decoded[j++] = text[i];
+        }
+    }
+    xml_append_text(node, decoded, j);
+    free(decoded);
+}
+
+static const char *xml_skip_past(const char *p, const char *terminator) {
+    const char *end = strstr(p, terminator);
+    return end ? end + strlen(terminator) : NULL;
+}
+
+// Parses the element starting at the '<' at p, returning a pointer just past it, or NULL on error.
+static const char *xml_parse_element(const char *p, xml_node_t **result, int depth) {
+    if (depth > 256) {
+        return NULL;
+    }
+
+    p++;
+    const char *name_start = p;
+    while (*p && !isspace((unsigned char) *p) && *p != '>' && *p != '/') {
+        p++;
+    }
+    if (!*p) {
+        return NULL;
+    }
+
+    xml_node_t *node = calloc(1, sizeof(xml_node_t));
+    node->name = strndup(name_start, p - name_start);
+    *result = node;
+
+    // Skip attributes
+    while (*p && *p != '>') {
+        if (*p == '"' || *p == '\'') {
+            const char *close = strchr(p + 1, *p);
+            if (!close) {
+                return NULL;
+            }
+            p = close;
+        }
+        p++;
+    }
+    if (!*p) {
+        return NULL;
+    }
+    if (*(p - 1) == '/') {
+        return p + 1;
+    }
+    p++;
+
+    for (;;) {
+        const char *text_start = p;
+        while (*p && *p != '<') {
+            p++;
+        }
+        if (!*p) {
+            return NULL;
+        }
+        xml_append_decoded_text(node, text_start, p - text_start);
+
+        if (strncmp(p, "<!--", 4) == 0) {
+            p = xml_skip_past(p, "-->");
+        } else if (strncmp(p, "<![CDATA[", 9) == 0) {
+            const char *end = strstr(p + 9, "]]>");
+            if (!end) {
+                return NULL;
+            }
+            xml_append_text(node, p + 9, end - (p + 9));
+            p = end + 3;
+        } else if (strncmp(p, "<?", 2) == 0) {
+            p = xml_skip_past(p, "?>");
+        } else if (strncmp(p, "<!", 2) == 0) {
+            p = xml_skip_past(p, ">");
+        } else if (strncmp(p, "</", 2) == 0) {
+            return xml_skip_past(p, ">");
+        } else {
+            xml_node_t *child = NULL;
+            p = xml_parse_element(p, &child, depth + 1);
+            if (child) {
+                node->children = realloc(node->children, (node->num_children + 1) * sizeof(xml_node_t *));
+                node->children[node->num_children++] = child;
+            }
+        }
+
+        if (!p) {
+            return NULL;
+        }
+    }
+}
+
+static xml_node_t *xml_parse(const char *doc) {
+    const char *p = doc;
+    for (;;) {
+        p = strchr(p, '<');
+        if (!p) {
+            return NULL;
+        }
+        if (strncmp(p, "<!--", 4) == 0) {
+            p = xml_skip_past(p, "-->");
+        } else if (strncmp(p, "<?", 2) == 0) {
+            p = xml_skip_past(p, "?>");
+        } else if (strncmp(p, "<!", 2) == 0) {
+            p = xml_skip_past(p, ">");
+        } else {
+            break;
+        }
+        if (!p) {
+            return NULL;
+        }
+    }
+
+    xml_node_t *root = NULL;
+    if (!xml_parse_element(p, &root, 0)) {
+        xml_free(root);
+        return NULL;
+    }
+    return root;
+}
+
+static xml_node_t *xml_child(xml_node_t *node, const char *name) {
+    if (node) {
+        size_t i;
+        for (i = 0; i < node->num_children; i++) {
+            if (strcmp(node->children[i]->name, name) == 0) {
+                return node->children[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+// Returns the trimmed text of the named child, or NULL if absent or empty. The caller owns the result.
+static char *xml_child_text(xml_node_t *node, const char *name) {
+    xml_node_t *child = xml_child(node, name);
+    if (!child || !child->text) {
+        return NULL;
+    }
+    const char *start = child->text;
+    while (isspace((unsigned char) *start)) {
+        start++;
+    }
+    size_t len = strlen(start);
+    while (len > 0 && isspace((unsigned char) start[len - 1])) {
+        len--;
+    }
+    return len ? strndup(start, len) : NULL;
+}
+
+// POMs
+
+typedef struct dependency {
+    char *group;
+    char *artifact;
+    char *version;
+    char *classifier;
+    char *type;
+    char *scope;
+    bool optional;
+    size_t num_exclusions;
+    char **exclusions;
+} dependency_t;
+
+typedef struct pom {
+    char *group;
+    char *artifact;
+    char *version;
+    size_t num_properties;
+    char **property_names;
+    char **property_values;
+    size_t num_managed;
+    dependency_t *managed;
+    size_t num_dependencies;
+    dependency_t *dependencies;
+} pom_t;
+
+// The POMs and version directories consulted during resolution, along with stamps of their
+// state, so that a cached classpath can be checked for staleness.
+typedef struct consulted {
+    size_t count;
+    char **paths;
+    long long *stamps;
+} consulted_t;
+
+static void free_dependency(dependency_t *dep) {
+    free(dep->group);
+    free(dep->artifact);
+    free(dep->version);
+    free(dep->classifier);
+    free(dep->type);
+    free(dep->scope);
+    size_t i;
+    for (i = 0; i < dep->num_exclusions; i++) {
+        free(dep->exclusions[i]);
+    }
+    free(dep->exclusions);
+}
+
+static void free_pom(pom_t *pom) {
+    if (pom) {
+        size_t i;
+        for (i = 0; i < pom->num_properties; i++) {
+            free(pom->property_names[i]);
+            free(pom->property_values[i]);
+        }
+        free(pom->property_names);
+        free(pom->property_values);
+        for (i = 0; i < pom->num_managed; i++) {
+            free_dependency(&pom->managed[i]);
+        }
+        free(pom->managed);
+        for (i = 0; i < pom->num_dependencies; i++) {
+            free_dependency(&pom->dependencies[i]);
+        }
+        free(pom->dependencies);
+        free(pom->group);
+        free(pom->artifact);
+        free(pom->version);
+        free(pom);
+    }
+}
+
+static char *safe_strdup(const char *s) {
+    return s ? strdup(s) : NULL;
+}
+
+static void copy_dependency(dependency_t *to, const dependency_t *from) {
+    to->group = safe_strdup(from->group);
+    to->artifact = safe_strdup(from->artifact);
+    to->version = safe_strdup(from->version);
+    to->classifier = safe_strdup(from->classifier);
+    to->type = safe_strdup(from->type);
+    to->scope = safe_strdup(from->scope);
+    to->optional = from->optional;
+    to->num_exclusions = from->num_exclusions;
+    to->exclusions = from->num_exclusions ? malloc(from->num_exclusions * sizeof(char *)) : NULL;
+    size_t i;
+    for (i = 0; i < from->num_exclusions; i++) {
+        to->exclusions[i] = strdup(from->exclusions[i]);
+    }
+}
+
+static void set_property(pom_t *pom, const char *name, const char *value) {
+    if (!name || !value) {
+        return;
+    }
+    size_t i;
+    for (i = 0; i < pom->num_properties; i++) {
+        if (strcmp(pom->property_names[i], name) == 0) {
+            free(pom->property_values[i]);
+            pom->property_values[i] = strdup(value);
+            return;
+        }
+    }
+    pom->property_names = realloc(pom->property_names, (pom->num_properties + 1) * sizeof(char *));
+    pom->property_values = realloc(pom->property_values, (pom->num_properties + 1) * sizeof(char *));
+    pom->property_names[pom->num_properties] = strdup(name);
+    pom->property_values[pom->num_properties] = strdup(value);
+    pom->num_properties++;
+}
+
+static const char *get_property(pom_t *pom, const char *name, size_t len) {
+    size_t i;
+    for (i = 0; i < pom->num_properties; i++) {
+        if (strlen(pom->property_names[i]) == len && strncmp(pom->property_names[i], name, len) == 0) {
+            return pom->property_values[i];
+        }
+    }
+    return NULL;
+}
+
+// Replaces ${...} references with property values, leaving unknown properties in place. Takes
+// ownership of s.
+static char *interpolate(pom_t *pom, char *s) {
+    if (!s) {
+        return s;
+    }
+
+    size_t offset = 0;
+    int interpolations = 0;
+    char *start;
+    while ((start = strstr(s + offset, "${")) != NULL) {
+        char *end = strchr(start, '}');
+        if (!end) {
+            break;
+        }
+
+        const char *value = get_property(pom, start + 2, end - (start + 2));
+        if (!value || interpolations == DEPS_MAX_INTERPOLATIONS) {
+            offset = end + 1 - s;
+            continue;
+        }
+
+        size_t prefix_len = start - s;
+        size_t value_len = strlen(value);
+        char *result = malloc(prefix_len + value_len + strlen(end + 1) + 1);
+        memcpy(result, s, prefix_len);
+        memcpy(result + prefix_len, value, value_len);
+        strcpy(result + prefix_len + value_len, end + 1);
+        free(s);
+        s = result;
+
+        // The value may itself refer to properties
+        offset = prefix_len;
+        interpolations++;
+    }
+
+    return s;
+}
+
+static void parse_dependency(pom_t *pom, xml_node_t *node, dependency_t *dep) {
+    memset(dep, 0, sizeof(dependency_t));
+    dep->group = interpolate(pom, xml_child_text(node, "groupId"));
+    dep->artifact = interpolate(pom, xml_child_text(node, "artifactId"));
+    dep->version = interpolate(pom, xml_child_text(node, "version"));
+    dep->classifier = interpolate(pom, xml_child_text(node, "classifier"));
+    dep->type = interpolate(pom, xml_child_text(node, "type"));
+    dep->scope = interpolate(pom, xml_child_text(node, "scope"));
+    char *optional = interpolate(pom, xml_child_text(node, "optional"));
+    dep->optional = optional && strcmp(optional, "true") == 0;
+    free(optional);
+
+    xml_node_t *exclusions = xml_child(node, "exclusions");
+    if (exclusions) {
+        size_t i;
+        for (i = 0; i < exclusions->num_children; i++) {
+            xml_node_t *exclusion = exclusions->children[i];
+            if (strcmp(exclusion->name, "exclusion") != 0) {
+                continue;
+            }
+            char *group = interpolate(pom, xml_child_text(exclusion, "groupId"));
+            char *artifact = interpolate(pom, xml_child_text(exclusion, "artifactId"));
+            char key[PATH_MAX];
+            snprintf(key, PATH_MAX, "%s:%s", group ? group : "*", artifact ? artifact : "*");
+            free(group);
+            free(artifact);
+            dep->exclusions = realloc(dep->exclusions, (dep->num_exclusions + 1) * sizeof(char *));
+            dep->exclusions[dep->num_exclusions++] = strdup(key);
+        }
+    }
+}
+
+static char *artifact_dir(const char *local_repo, const char *group, const char *artifact) {
+    char *group_path = strdup(group);
+    char *p;
+    for (p = group_path; *p; p++) {
+        if (*p == '.') {
+            *p = '/';
+        }
+    }
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/%s/%s", local_repo, group_path, artifact);
+    free(group_path);
+    return strdup(path);
+}
+
+static char *artifact_path(const char *local_repo, const char *group, const char *artifact, const char *version,
+                           const char *classifier, const char *extension) {
+    char *dir = artifact_dir(local_repo, group, artifact);
+    char path[PATH_MAX];
+    if (classifier) {
+        snprintf(path, PATH_MAX, "%s/%s/%s-%s-%s.%s", dir, version, artifact, version, classifier, extension);
+    } else {
+        snprintf(path, PATH_MAX, "%s/%s/%s-%s.%s", dir, version, artifact, version, extension);
+    }
+    free(dir);
+    return strdup(path);
+}
+
+// FNV-1a
+#define HASH_INIT 14695981039346656037ULL
+
+static uint64_t hash_string(uint64_t hash, const char *s) {
+    const unsigned char *c;
+    for (c = (const unsigned char *) s; *c; c++) {
+        hash ^= *c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Returns the modification time of a file, or for a directory a hash of the names it contains,
+// since adding a version within a second of an earlier listing needn't change its mtime. Returns
+// -1 if path doesn't exist.
+static long long path_stamp(const char *path) {
+    struct stat file_stat;
+    if (stat(path, &file_stat) != 0) {
+        return -1;
+    }
+    if (!S_ISDIR(file_stat.st_mode)) {
+        return (long long) file_stat.st_mtime;
+    }
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return -1;
+    }
+    // Summed so that the order of the listing doesn't matter
+    uint64_t stamp = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        stamp += hash_string(HASH_INIT, entry->d_name);
+    }
+    closedir(dir);
+    return (long long) (stamp >> 1);
+}
+
+static void record_consulted(consulted_t *consulted, const char *path) {
+    size_t i;
+    for (i = 0; i < consulted->count; i++) {
+        if (strcmp(consulted->paths[i], path) == 0) {
+            return;
+        }
+    }
+
+    consulted->paths = realloc(consulted->paths, (consulted->count + 1) * sizeof(char *));
+    consulted->stamps = realloc(consulted->stamps, (consulted->count + 1) * sizeof(long long));
+    consulted->paths[consulted->count] = strdup(path);
+    consulted->stamps[consulted->count] = path_stamp(path);
+    consulted->count++;
+}
+
+static pom_t *load_pom(const char *local_repo, const char *group, const char *artifact, const char *version,
+                       consulted_t *consulted, int depth);
+
+static void add_managed(pom_t *pom, const dependency_t *dep) {
+    pom->managed = realloc(pom->managed, (pom->num_managed + 1) * sizeof(dependency_t));
+    copy_dependency(&pom->managed[pom->num_managed++], dep);
+}
+
+static void add_dependency(pom_t *pom, const dependency_t *dep) {
+    size_t i;
+    for (i = 0; i < pom->num_dependencies; i++) {
+        dependency_t *existing = &pom->dependencies[i];
+        if (strcmp(existing->group, dep->group) == 0 && strcmp(existing->artifact, dep->artifact) == 0) {
+            // A child POM overrides a dependency declared by its parent
+            free_dependency(existing);
+            copy_dependency(existing, dep);
+            return;
+        }
+    }
+    pom->dependencies = realloc(pom->dependencies, (pom->num_dependencies + 1) * sizeof(dependency_t));
+    copy_dependency(&pom->dependencies[pom->num_dependencies++], dep);
+}
+
+static pom_t *load_pom(const char *local_repo, const char *group, const char *artifact, const char *version,
+                       consulted_t *consulted, int depth) {
+    if (depth > DEPS_MAX_PARENT_DEPTH || !group || !artifact || !version) {
+        return NULL;
+    }
+
+    char *path = artifact_path(local_repo, group, artifact, version, NULL, "pom");
+    record_consulted(consulted, path);
+    char *contents = get_contents(path, NULL);
+    free(path);
+    if (!contents) {
+        return NULL;
+    }
+
+    xml_node_t *project = xml_parse(contents);
+    free(contents);
+    if (!project) {
+        return NULL;
+    }
+
+    pom_t *pom = calloc(1, sizeof(pom_t));
+    size_t i;
+
+    xml_node_t *parent_node = xml_child(project, "parent");
+    char *parent_group = xml_child_text(parent_node, "groupId");
+    char *parent_artifact = xml_child_text(parent_node, "artifactId");
+    char *parent_version = xml_child_text(parent_node, "version");
+    pom_t *parent = load_pom(local_repo, parent_group, parent_artifact, parent_version, consulted, depth + 1);
+
+    if (parent) {
+        for (i = 0; i < parent->num_properties; i++) {
+            set_property(pom, parent->property_names[i], parent->property_values[i]);
+        }
+    }
+
+    pom->group = xml_child_text(project, "groupId");
+    if (!pom->group) {
+        pom->group = safe_strdup(parent_group);
+    }
+    pom->artifact = xml_child_text(project, "artifactId");
+    pom->version = xml_child_text(project, "version");
+    if (!pom->version) {
+        pom->version = safe_strdup(parent_version);
+    }
+
+    set_property(pom, "project.groupId", pom->group);
+    set_property(pom, "pom.groupId", pom->group);
+    set_property(pom, "groupId", pom->group);
+    set_property(pom, "project.artifactId", pom->artifact);
+    set_property(pom, "pom.artifactId", pom->artifact);
+    set_property(pom, "artifactId", pom->artifact);
+    set_property(pom, "project.version", pom->version);
+    set_property(pom, "pom.version", pom->version);
+    set_property(pom, "version", pom->version);
+    set_property(pom, "project.parent.groupId", parent_group);
+    set_property(pom, "project.parent.version", parent_version);
+
+    xml_node_t *properties = xml_child(project, "properties");
+    if (properties) {
+        for (i = 0; i < properties->num_children; i++) {
+            xml_node_t *property = properties->children[i];
+            if (property->text) {
+                char *value = xml_child_text(properties, property->name);
+                set_property(pom, property->name, value ? value : "");
+                free(value);
+            }
+        }
+    }
+
+    // Entries in the child's dependencyManagement take precedence over those inherited
+    xml_node_t *managed = xml_child(xml_child(project, "dependencyManagement"), "dependencies");
+    if (managed) {
+        for (i = 0; i < managed->num_children; i++) {
+            if (strcmp(managed->children[i]->name, "dependency") != 0) {
+                continue;
+            }
+            dependency_t dep;
+            parse_dependency(pom, managed->children[i], &dep);
+            if (dep.scope && strcmp(dep.scope, "import") == 0) {
+                pom_t *bom = load_pom(local_repo, dep.group, dep.artifact, dep.version, consulted, depth + 1);
+                if (bom) {
+                    size_t j;
+                    for (j = 0; j < bom->num_managed; j++) {
+                        add_managed(pom, &bom->managed[j]);
+                    }
+                    free_pom(bom);
+                }
+            } else if (dep.group && dep.artifact) {
+                add_managed(pom, &dep);
+            }
+            free_dependency(&dep);
+        }
+    }
+
+    if (parent) {
+        for (i = 0; i < parent->num_managed; i++) {
+            add_managed(pom, &parent->managed[i]);
+        }
+        for (i = 0; i < parent->num_dependencies; i++) {
+            add_dependency(pom, &parent->dependencies[i]);
+        }
+        free_pom(parent);
+    }
+
+    xml_node_t *dependencies = xml_child(project, "dependencies");
+    if (dependencies) {
+        for (i = 0; i < dependencies->num_children; i++) {
+            if (strcmp(dependencies->children[i]->name, "dependency") != 0) {
+                continue;
+            }
+            dependency_t dep;
+            parse_dependency(pom, dependencies->children[i], &dep);
+            if (dep.group && dep.artifact) {
+                add_dependency(pom, &dep);
+            }
+            free_dependency(&dep);
+        }
+    }
+
+    free(parent_group);
+    free(parent_artifact);
+    free(parent_version);
+    xml_free(project);
+
+    return pom;
+}
+
+static const dependency_t *find_managed(pom_t *pom, const char *group, const char *artifact) {
+    size_t i;
+    for (i = 0; i < pom->num_managed; i++) {
+        if (strcmp(pom->managed[i].group, group) == 0 && strcmp(pom->managed[i].artifact, artifact) == 0) {
+            return &pom->managed[i];
+        }
+    }
+    return NULL;
+}
+
+// Versions
+
+static int compare_versions(const char *v1, const char *v2) {
+    while (*v1 || *v2) {
+        size_t len1 = strcspn(v1, ".-");
+        size_t len2 = strcspn(v2, ".-");
+        bool numeric1 = len1 > 0 && strspn(v1, "0123456789") == len1;
+        bool numeric2 = len2 > 0 && strspn(v2, "0123456789") == len2;
+
+        if (len1 == 0 || len2 == 0) {
+            // A release (1.0) is newer than a qualified version (1.0-SNAPSHOT) but older than 1.0.1
+            if (len1 == 0 && len2 == 0) {
+                return 0;
+            }
+            return len1 == 0 ? (numeric2 ? -1 : 1) : (numeric1 ? 1 : -1);
+        }
+
+        int cmp;
+        if (numeric1 && numeric2) {
+            unsigned long long n1 = strtoull(v1, NULL, 10);
+            unsigned long long n2 = strtoull(v2, NULL, 10);
+            cmp = n1 < n2 ? -1 : (n1 > n2 ? 1 : 0);
+        } else if (numeric1 != numeric2) {
+            cmp = numeric1 ? 1 : -1;
+        } else {
+            size_t len = len1 < len2 ? len1 : len2;
+            cmp = strncasecmp(v1, v2, len);
+            if (cmp == 0 && len1 != len2) {
+                cmp = len1 < len2 ? -1 : 1;
+            }
+        }
+        if (cmp != 0) {
+            return cmp;
+        }
+
+        v1 += len1;
+        v2 += len2;
+        if (*v1) {
+            v1++;
+        }
+        if (*v2) {
+            v2++;
+        }
+    }
+    return 0;
+}
+
+static bool version_in_range(const char *version, const char *range) {
+    size_t len = strlen(range);
+    if (len < 2) {
+        return false;
+    }
+    bool lower_inclusive = range[0] == '[';
+    bool upper_inclusive = range[len - 1] == ']';
+
+    char *bounds = strndup(range + 1, len - 2);
+    char *comma = strchr(bounds, ',');
+    bool result;
+    if (!comma) {
+        result = compare_versions(version, bounds) == 0;
+    } else {
+        *comma = '\0';
+        char *lower = bounds;
+        char *upper = comma + 1;
+        result = true;
+        if (*lower) {
+            int cmp = compare_versions(version, lower);
+            result = lower_inclusive ? cmp >= 0 : cmp > 0;
+        }
+        if (result && *upper) {
+            int cmp = compare_versions(version, upper);
+            result = upper_inclusive ? cmp <= 0 : cmp < 0;
+        }
+    }
+    free(bounds);
+    return result;
+}
+
+// Resolves a version range to the newest matching version installed in the local repository.
+static char *resolve_version(const char *local_repo, const char *group, const char *artifact, const char *version,
+                             consulted_t *consulted) {
+    if (version[0] != '[' && version[0] != '(') {
+        return strdup(version);
+    }
+
+    // Only the first of multiple ranges (e.g., "[1.0,2.0),[3.0,)") is considered
+    const char *range_end = strpbrk(version, ")]");
+    if (!range_end) {
+        return NULL;
+    }
+    char *range = strndup(version, range_end - version + 1);
+
+    char *best = NULL;
+    char *dir_path = artifact_dir(local_repo, group, artifact);
+    record_consulted(consulted, dir_path);
+    DIR *dir = opendir(dir_path);
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+            if (version_in_range(entry->d_name, range) && (!best || compare_versions(entry->d_name, best) > 0)) {
+                free(best);
+                best = strdup(entry->d_name);
+            }
+        }
+        closedir(dir);
+    }
+    free(dir_path);
+    free(range);
+
+    return best;
+}
+
+// Resolution
+
+typedef struct pending {
+    dependency_t dep;
+    size_t num_exclusions;
+    char **exclusions;
+} pending_t;
+
+static bool is_excluded(pending_t *pending, const char *group, const char *artifact) {
+    size_t i;
+    for (i = 0; i < pending->num_exclusions; i++) {
+        char *exclusion = pending->exclusions[i];
+        char *colon = strchr(exclusion, ':');
+        size_t group_len = colon - exclusion;
+        bool group_matches = (group_len == 1 && exclusion[0] == '*') ||
+                             (strlen(group) == group_len && strncmp(group, exclusion, group_len) == 0);
+        bool artifact_matches = strcmp(colon + 1, "*") == 0 || strcmp(colon + 1, artifact) == 0;
+        if (group_matches && artifact_matches) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool is_transitive_scope(const char *scope) {
+    return !scope || strcmp(scope, "compile") == 0 || strcmp(scope, "runtime") == 0;
+}
+
+// Sets *complete to false if any dependency couldn't be resolved.
+static char *resolve_classpath(const char *dependencies, const char *local_repo, consulted_t *consulted,
+                               bool *complete) {
+    *complete = true;
+    size_t num_pending = 0;
+    size_t pending_ndx = 0;
+    pending_t *pending = NULL;
+
+    char *deps = strdup(dependencies);
+    char *saveptr = NULL;
+    char *dependency = strtok_r(deps, ",", &saveptr);
+    while (dependency != NULL) {
+        char *saveptr2 = NULL;
+        char *sym = strtok_r(dependency, ":", &saveptr2);
+        char *version = strtok_r(NULL, ":", &saveptr2);
+
+        char *slash = strchr(sym, '/');
+        pending = realloc(pending, (num_pending + 1) * sizeof(pending_t));
+        memset(&pending[num_pending], 0, sizeof(pending_t));
+        if (slash) {
+            pending[num_pending].dep.group = strndup(sym, slash - sym);
+            pending[num_pending].dep.artifact = strdup(slash + 1);
+        } else {
+            pending[num_pending].dep.group = strdup(sym);
+            pending[num_pending].dep.artifact = strdup(sym);
+        }
+        pending[num_pending].dep.version = safe_strdup(version);
+        num_pending++;
+
+        dependency = strtok_r(NULL, ",", &saveptr);
+    }
+    free(deps);
+
+    size_t num_resolved = 0;
+    char **resolved = NULL;
+    char *classpath = strdup("");
+
+    for (pending_ndx = 0; pending_ndx < num_pending; pending_ndx++) {
+        // Note that pending may be realloc'd below, so current must not be held across that
+        pending_t current = pending[pending_ndx];
+        dependency_t *dep = &current.dep;
+
+        char key[PATH_MAX];
+        snprintf(key, PATH_MAX, "%s:%s:%s", dep->group, dep->artifact, dep->classifier ? dep->classifier : "");
+        size_t i;
+        bool seen = false;
+        for (i = 0; i < num_resolved; i++) {
+            if (strcmp(resolved[i], key) == 0) {
+                seen = true;
+                break;
+            }
+        }
+        if (seen) {
+            continue;
+        }
+        if (!dep->version) {
+            fprintf(stderr, "Warning: No version specified for %s/%s\n", dep->group, dep->artifact);
+            *complete = false;
+            continue;
+        }
+        resolved = realloc(resolved, (num_resolved + 1) * sizeof(char *));
+        resolved[num_resolved++] = strdup(key);
+
+        char *version = resolve_version(local_repo, dep->group, dep->artifact, dep->version, consulted);
+        if (!version) {
+            fprintf(stderr, "Warning: No installed version of %s/%s matches %s\n", dep->group, dep->artifact,
+                    dep->version);
+            *complete = false;
+            continue;
+        }
+
+        if (!dep->type || strcmp(dep->type, "jar") == 0) {
+            char *jar = artifact_path(local_repo, dep->group, dep->artifact, version, dep->classifier, "jar");
+            char *with_separator = str_concat(classpath, *classpath ? ":" : "");
+            free(classpath);
+            classpath = str_concat(with_separator, jar);
+            free(with_separator);
+            free(jar);
+        }
+
+        pom_t *pom = load_pom(local_repo, dep->group, dep->artifact, version, consulted, 0);
+        if (!pom && config.verbose) {
+            fprintf(stderr, "No POM for %s/%s %s; its dependencies will not be resolved\n", dep->group,
+                    dep->artifact, version);
+        }
+        free(version);
+        if (!pom) {
+            continue;
+        }
+
+        for (i = 0; i < pom->num_dependencies; i++) {
+            dependency_t *transitive = &pom->dependencies[i];
+            const dependency_t *managed = find_managed(pom, transitive->group, transitive->artifact);
+
+            const char *scope = transitive->scope ? transitive->scope : (managed ? managed->scope : NULL);
+            if (!is_transitive_scope(scope) || transitive->optional ||
+                is_excluded(&current, transitive->group, transitive->artifact)) {
+                continue;
+            }
+
+            pending = realloc(pending, (num_pending + 1) * sizeof(pending_t));
+            pending_t *next = &pending[num_pending++];
+            copy_dependency(&next->dep, transitive);
+            if (!next->dep.version && managed && managed->version) {
+                next->dep.version = strdup(managed->version);
+            }
+
+            next->num_exclusions = current.num_exclusions + transitive->num_exclusions;
+            next->exclusions = next->num_exclusions ? malloc(next->num_exclusions * sizeof(char *)) : NULL;
+            size_t j;
+            for (j = 0; j < current.num_exclusions; j++) {
+                next->exclusions[j] = strdup(current.exclusions[j]);
+            }
+            for (j = 0; j < transitive->num_exclusions; j++) {
+                next->exclusions[current.num_exclusions + j] = strdup(transitive->exclusions[j]);
+            }
+        }
+
+        free_pom(pom);
+    }
+
+    for (pending_ndx = 0; pending_ndx < num_pending; pending_ndx++) {
+        free_dependency(&pending[pending_ndx].dep);
+        size_t j;
+        for (j = 0; j < pending[pending_ndx].num_exclusions; j++) {
+            free(pending[pending_ndx].exclusions[j]);
+        }
+        free(pending[pending_ndx].exclusions);
+    }
+    free(pending);
+    size_t i;
+    for (i = 0; i < num_resolved; i++) {
+        free(resolved[i]);
+    }
+    free(resolved);
+
+    return classpath;
+}
+
+// Caching
+
+static char *cache_file_path(const char *dependencies, const char *local_repo) {
+    char dir[PATH_MAX];
+    char *xdg_cache_home = getenv("XDG_CACHE_HOME");
+    char *home = getenv("HOME");
+    if (xdg_cache_home && *xdg_cache_home) {
+        snprintf(dir, PATH_MAX, "%s/planck/deps", xdg_cache_home);
+    } else if (home) {
+        snprintf(dir, PATH_MAX, "%s/.cache/planck/deps", home);
+    } else {
+        return NULL;
+    }
+
+    uint64_t hash = hash_string(hash_string(hash_string(HASH_INIT, local_repo), "\n"), dependencies);
+
+    size_t len = strlen(dir) + 22;
+    char *path = malloc(len);
+    snprintf(path, len, "%s/%016llx.cp", dir, (unsigned long long) hash);
+    return path;
+}
+
+static char *next_line(char **p) {
+    if (!*p || !**p) {
+        return NULL;
+    }
+    char *line = *p;
+    char *newline = strchr(line, '\n');
+    if (newline) {
+        *newline = '\0';
+        *p = newline + 1;
+    } else {
+        *p = line + strlen(line);
+    }
+    return line;
+}
+
+// The cache file holds the local repo and deps spec (to guard against hash collisions), the
+// POMs and directories consulted along with their stamps, and finally the classpath.
+static char *read_cached_classpath(const char *path, const char *dependencies, const char *local_repo) {
+    char *contents = get_contents((char *) path, NULL);
+    if (!contents) {
+        return NULL;
+    }
+
+    char *result = NULL;
+    char *p = contents;
+    char *repo_line = next_line(&p);
+    char *deps_line = next_line(&p);
+    char *count_line = next_line(&p);
+    if (!repo_line || !deps_line || !count_line ||
+        strcmp(repo_line, local_repo) != 0 || strcmp(deps_line, dependencies) != 0) {
+        goto done;
+    }
+
+    long count = strtol(count_line, NULL, 10);
+    long i;
+    for (i = 0; i < count; i++) {
+        char *line = next_line(&p);
+        char *tab = line ? strrchr(line, '\t') : NULL;
+        if (!tab) {
+            goto done;
+        }
+        *tab = '\0';
+        if (path_stamp(line) != strtoll(tab + 1, NULL, 10)) {
+            goto done;
+        }
+    }
+
+    char *classpath = next_line(&p);
+    if (classpath) {
+        result = strdup(classpath);
+    }
+
+done:
+    free(contents);
+    return result;
+}
+
+static void write_cached_classpath(const char *path, const char *dependencies, const char *local_repo,
+                                   consulted_t *consulted, const char *classpath) {
+    char *dir = strdup(path);
+    char *slash = strrchr(dir, '/');
+    *slash = '\0';
+    int err = mkdir_parents(dir);
+    free(dir);
+    if (err < 0) {
+        return;
+    }
+
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, PATH_MAX, "%s.%d", path, getpid());
+    FILE *f = fopen(tmp_path, "w");
+    if (!f) {
+        return;
+    }
+
+    fprintf(f, "%s\n%s\n%zu\n", local_repo, dependencies, consulted->count);
+    size_t i;
+    for (i = 0; i < consulted->count; i++) {
+        fprintf(f, "%s\t%lld\n", consulted->paths[i], consulted->stamps[i]);
+    }
+    fprintf(f, "%s\n", classpath);
+
+    if (fclose(f) == 0) {
+        rename(tmp_path, path);
+    } else {
+        unlink(tmp_path);
+    }
+}
+
+char *resolve_dependencies_classpath(const char *dependencies, const char *local_repo) {
+    char *cache_path = cache_file_path(dependencies, local_repo);
+
+    if (cache_path) {
+        char *classpath = read_cached_classpath(cache_path, dependencies, local_repo);
+        if (classpath) {
+            free(cache_path);
+            return classpath;
+        }
+    }
+
+    consulted_t consulted = {0, NULL, NULL};
+    bool complete;
+    char *classpath = resolve_classpath(dependencies, local_repo, &consulted, &complete);
+
+    // Incomplete resolutions aren't cached, so that their warnings are repeated
+    if (cache_path && complete) {
+        write_cached_classpath(cache_path, dependencies, local_repo, &consulted, classpath);
+    }
+    free(cache_path);
+
+    size_t i;
+    for (i = 0; i < consulted.count; i++) {
+        free(consulted.paths[i]);
+    }
+    free(consulted.paths);
+    free(consulted.stamps);
+
+    return classpath;
+}
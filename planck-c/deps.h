@@ -0,0 +1,3 @@
+// Returns a colon-delimited classpath for the comma-separated SYM:VERSION dependencies, along with
+// their transitive dependencies, as described by the POMs in the local Maven repository.
+char *resolve_dependencies_classpath(const char *dependencies, const char *local_repo);
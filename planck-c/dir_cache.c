@@ -0,0 +1,398 @@
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "clock.h"
+#include "dir_cache.h"
+#include "globals.h"
+#include "str.h"
+
+// Caches the listings of directories on the classpath so that lookups of files that don't
+// exist (the common case, as several extensions and locations are tried for each namespace)
+// can be answered without touching the file system.
+//
+// Listings are only cached for directories that exist, and a path is resolved component by
+// component, so a newly-created subdirectory shows up as a change to its parent's listing.
+// Listings are dropped whenever Planck itself writes to the file system. In REPL sessions,
+// changes made by other processes are picked up via inotify; where that isn't available the
+// cache is disabled for REPL sessions. Otherwise a listing that misses is checked against its
+// directory's modification time, at most every DIR_CACHE_REVALIDATE_NS.
+//
+// Only a miss is ever trusted, and names are matched case-insensitively on file systems that
+// do so. Names that aren't ASCII may be stored under a different Unicode normalization (as on
+// HFS+), so they are always left to the file system.
+
+#define DIR_CACHE_BUCKETS 256
+#define DIR_CACHE_REVALIDATE_NS (100 * 1000000ULL)
+
+typedef struct listing {
+    char *dir;
+    size_t count;
+    char **names;
+    bool folded;
+    int wd;
+    long long mtime;
+    time_t read_at;
+    uint64_t validated;
+    struct listing *next;
+} listing_t;
+
+static pthread_mutex_t dir_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool initialized = false;
+static bool enabled = false;
+static int inotify_fd = -1;
+static listing_t *listings[DIR_CACHE_BUCKETS];
+
+static unsigned long dir_hash(const char *s) {
+    unsigned long hash = 5381;
+    int c;
+    while ((c = (unsigned char) *s++)) {
+        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+    }
+    return hash;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+static int compare_folded_names(const void *a, const void *b) {
+    return strcasecmp(*(char *const *) a, *(char *const *) b);
+}
+
+static long long mtime_ns(struct stat *file_stat) {
+#ifdef __APPLE__
+    return (long long) file_stat->st_mtimespec.tv_sec * 1000000000LL + file_stat->st_mtimespec.tv_nsec;
+#else
+    return (long long) file_stat->st_mtim.tv_sec * 1000000000LL + file_stat->st_mtim.tv_nsec;
+#endif
+}
+
+static void free_listing(listing_t *listing) {
+    size_t i;
+    for (i = 0; i < listing->count; i++) {
+        free(listing->names[i]);
+    }
+    free(listing->names);
+    free(listing->dir);
+    free(listing);
+}
+
+static void clear_listings() {
+    int i;
+    for (i = 0; i < DIR_CACHE_BUCKETS; i++) {
+        listing_t *listing = listings[i];
+        while (listing) {
+            listing_t *next = listing->next;
+            free_listing(listing);
+            listing = next;
+        }
+        listings[i] = NULL;
+    }
+}
+
+static void init() {
+    initialized = true;
+
+    if (!config.repl) {
+        enabled = true;
+        return;
+    }
+
+#ifdef __linux__
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    enabled = inotify_fd >= 0;
+#endif
+}
+
+static void drop_listing(listing_t *listing) {
+    listing_t **p = &listings[dir_hash(listing->dir) % DIR_CACHE_BUCKETS];
+    while (*p != listing) {
+        p = &(*p)->next;
+    }
+    *p = listing->next;
+    free_listing(listing);
+}
+
+static void drop_listing_for_wd(int wd) {
+    int i;
+    for (i = 0; i < DIR_CACHE_BUCKETS; i++) {
+        listing_t *listing;
+        for (listing = listings[i]; listing; listing = listing->next) {
+            if (listing->wd == wd) {
+                drop_listing(listing);
+                return;
+            }
+        }
+    }
+}
+
+static void process_inotify_events() {
+#ifdef __linux__
+    if (inotify_fd < 0) {
+        return;
+    }
+
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t len = read(inotify_fd, buf, sizeof(buf));
+        if (len <= 0) {
+            return;
+        }
+
+        char *p;
+        for (p = buf; p < buf + len;) {
+            struct inotify_event *event = (struct inotify_event *) p;
+            if (event->mask & IN_Q_OVERFLOW) {
+                clear_listings();
+            } else {
+                drop_listing_for_wd(event->wd);
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+#endif
+}
+
+// Determines whether the file system holding dir matches names case-insensitively, by looking up
+// one of the names in its listing, which must be sorted, with the case of its letters swapped.
+static bool is_case_insensitive(const char *dir, listing_t *listing) {
+#ifdef _PC_CASE_SENSITIVE
+    long case_sensitive = pathconf(dir, _PC_CASE_SENSITIVE);
+    if (case_sensitive >= 0) {
+        return case_sensitive == 0;
+    }
+#endif
+
+    size_t i;
+    for (i = 0; i < listing->count; i++) {
+        char swapped[NAME_MAX + 1];
+        bool has_letter = false;
+        size_t j;
+        for (j = 0; listing->names[i][j] && j < NAME_MAX; j++) {
+            char c = listing->names[i][j];
+            if (c >= 'a' && c <= 'z') {
+                c = (char) (c - 'a' + 'A');
+                has_letter = true;
+            } else if (c >= 'A' && c <= 'Z') {
+                c = (char) (c - 'A' + 'a');
+                has_letter = true;
+            }
+            swapped[j] = c;
+        }
+        swapped[j] = '\0';
+        if (!has_letter) {
+            continue;
+        }
+
+        // Names differing only in case can only coexist if case matters
+        char *key = swapped;
+        if (bsearch(&key, listing->names, listing->count, sizeof(char *), compare_names)) {
+            return false;
+        }
+
+        char path[PATH_MAX];
+        snprintf(path, PATH_MAX, "%s%s", dir, swapped);
+        struct stat file_stat;
+        return lstat(path, &file_stat) == 0;
+    }
+
+    return false;
+}
+
+static bool is_ascii(const char *name) {
+    for (; *name; name++) {
+        if ((unsigned char) *name >= 0x80) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns false if name is known not to be in listing.
+static bool listing_may_contain(listing_t *listing, const char *name) {
+    const char *key = name;
+    return bsearch(&key, listing->names, listing->count, sizeof(char *),
+                   listing->folded ? compare_folded_names : compare_names) != NULL || !is_ascii(name);
+}
+
+// Returns the listing for dir, which must end in a slash, or NULL if it can't be read.
+// Sets *absent if dir definitely does not exist.
+static listing_t *get_listing(const char *dir, bool *absent) {
+    unsigned long bucket = dir_hash(dir) % DIR_CACHE_BUCKETS;
+    listing_t *listing;
+    for (listing = listings[bucket]; listing; listing = listing->next) {
+        if (strcmp(listing->dir, dir) == 0) {
+            return listing;
+        }
+    }
+
+    int wd = -1;
+#ifdef __linux__
+    if (inotify_fd >= 0) {
+        // Watch before listing so that no change can slip in between
+        wd = inotify_add_watch(inotify_fd, dir,
+                               IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+                               IN_ONLYDIR);
+        if (wd < 0) {
+            *absent = errno == ENOENT || errno == ENOTDIR;
+            return NULL;
+        }
+    }
+#endif
+
+    struct stat dir_stat;
+    if (stat(dir, &dir_stat) != 0) {
+        *absent = errno == ENOENT || errno == ENOTDIR;
+        return NULL;
+    }
+
+    DIR *d = opendir(dir);
+    if (!d) {
+        *absent = errno == ENOENT || errno == ENOTDIR;
+        return NULL;
+    }
+
+    listing = calloc(1, sizeof(listing_t));
+    listing->dir = strdup(dir);
+    listing->wd = wd;
+    listing->mtime = mtime_ns(&dir_stat);
+    listing->read_at = time(NULL);
+    listing->validated = system_time();
+
+    size_t capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (listing->count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            listing->names = realloc(listing->names, capacity * sizeof(char *));
+        }
+        listing->names[listing->count++] = strdup(entry->d_name);
+    }
+    closedir(d);
+
+    qsort(listing->names, listing->count, sizeof(char *), compare_names);
+    listing->folded = is_case_insensitive(dir, listing);
+    if (listing->folded) {
+        qsort(listing->names, listing->count, sizeof(char *), compare_folded_names);
+    }
+
+    listing->next = listings[bucket];
+    listings[bucket] = listing;
+
+    return listing;
+}
+
+// Returns whether an unwatched listing is due to be checked against its directory and has
+// changed, or may have changed within the resolution of its modification time.
+static bool is_stale(listing_t *listing) {
+    if (listing->wd >= 0) {
+        return false;
+    }
+
+    uint64_t now = system_time();
+    if (now - listing->validated < DIR_CACHE_REVALIDATE_NS) {
+        return false;
+    }
+    listing->validated = now;
+
+    struct stat dir_stat;
+    if (stat(listing->dir, &dir_stat) != 0) {
+        return true;
+    }
+    return mtime_ns(&dir_stat) != listing->mtime || dir_stat.st_mtime + 1 >= listing->read_at;
+}
+
+bool dir_cache_may_exist(const char *root, const char *path) {
+    pthread_mutex_lock(&dir_cache_lock);
+
+    if (!initialized) {
+        init();
+    }
+
+    bool result = true;
+    if (!enabled || str_has_suffix(root, "/") != 0) {
+        goto done;
+    }
+
+    process_inotify_events();
+
+    char dir[PATH_MAX];
+    size_t dir_len = strlen(root);
+    if (dir_len + strlen(path) + 2 > PATH_MAX) {
+        goto done;
+    }
+    strcpy(dir, root);
+
+    const char *component = path;
+    while (*component) {
+        const char *slash = strchr(component, '/');
+        size_t len = slash ? slash - component : strlen(component);
+
+        // Leave anything unusual to the file system
+        if (len == 0 || (len == 1 && component[0] == '.') || (len == 2 && strncmp(component, "..", 2) == 0)) {
+            goto done;
+        }
+
+        bool absent = false;
+        listing_t *listing = get_listing(dir, &absent);
+        if (!listing) {
+            result = !absent;
+            goto done;
+        }
+
+        char name[NAME_MAX + 1];
+        if (len > NAME_MAX) {
+            result = false;
+            goto done;
+        }
+        memcpy(name, component, len);
+        name[len] = '\0';
+        if (!listing_may_contain(listing, name) && is_stale(listing)) {
+            drop_listing(listing);
+            listing = get_listing(dir, &absent);
+            if (!listing) {
+                result = !absent;
+                goto done;
+            }
+        }
+        if (!listing_may_contain(listing, name)) {
+            result = false;
+            goto done;
+        }
+
+        if (!slash) {
+            break;
+        }
+        memcpy(dir + dir_len, component, len + 1);
+        dir_len += len + 1;
+        dir[dir_len] = '\0';
+        component = slash + 1;
+    }
+
+done:
+    pthread_mutex_unlock(&dir_cache_lock);
+    return result;
+}
+
+void dir_cache_invalidate() {
+    pthread_mutex_lock(&dir_cache_lock);
+    clear_listings();
+    pthread_mutex_unlock(&dir_cache_lock);
+}
@@ -0,0 +1,7 @@
+#include <stdbool.h>
+
+// Returns false if path, relative to the root directory (which must end in a slash), is known not to exist.
+bool dir_cache_may_exist(const char *root, const char *path);
+
+// Drops all cached directory listings. Called whenever Planck modifies the file system.
+void dir_cache_invalidate();
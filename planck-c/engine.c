@@ -14,6 +14,7 @@
 #include "http.h"
 #include "shell.h"
 #include "io.h"
+#include "prefetch.h"
 #include "jsc_utils.h"
 #include "str.h"
 #include "engine.h"
@@ -27,6 +28,10 @@ void acquire_eval_lock() {
     pthread_mutex_lock(&eval_lock);
 }
 
+bool try_acquire_eval_lock() {
+    return pthread_mutex_trylock(&eval_lock) == 0;
+}
+
 void release_eval_lock() {
     pthread_mutex_unlock(&eval_lock);
 }
@@ -197,6 +202,10 @@ void evaluate_source(char *type, char *source, bool expression, bool print_nil,
         }
     }
 
+    if (strcmp(type, "text") == 0) {
+        prefetch_dependencies(source);
+    }
+
     acquire_eval_lock();
     JSValueRef args[6];
     size_t num_args = 6;
@@ -228,6 +237,7 @@ void evaluate_source(char *type, char *source, bool expression, bool print_nil,
     JSObjectRef global_obj = JSContextGetGlobalObject(ctx);
 
     JSObjectCallAsFunction(ctx, execute_fn, global_obj, num_args, args, NULL);
+    prefetch_discard();
     release_eval_lock();
 }
 
@@ -321,6 +331,24 @@ void run_main_in_ns(char *ns, size_t argc, char **argv) {
     JSObjectRef global_obj = JSContextGetGlobalObject(ctx);
     JSObjectRef run_main_fn = get_function("planck.repl", "run-main");
     JSObjectCallAsFunction(ctx, run_main_fn, global_obj, num_arguments, arguments, NULL);
+    prefetch_discard();
+}
+
+void run_lines(char *body, bool print) {
+    int err = block_until_engine_ready();
+    if (err) {
+        engine_println(block_until_engine_ready_failed_msg);
+        return;
+    }
+
+    acquire_eval_lock();
+    JSValueRef arguments[2];
+    arguments[0] = c_string_to_value(ctx, body);
+    arguments[1] = JSValueMakeBoolean(ctx, print);
+    JSObjectRef global_obj = JSContextGetGlobalObject(ctx);
+    JSObjectRef run_lines_fn = get_function("planck.repl", "run-lines");
+    JSObjectCallAsFunction(ctx, run_lines_fn, global_obj, 2, arguments, NULL);
+    release_eval_lock();
 }
 
 void run_main_cli_fn() {
@@ -460,6 +488,7 @@ void *do_engine_init(void *data) {
 
     register_global_function(ctx, "PLANCK_READ_FILE", function_read_file);
     register_global_function(ctx, "PLANCK_LOAD", function_load);
+    register_global_function(ctx, "PLANCK_LOAD_JS_LIB", function_load_js_lib);
     register_global_function(ctx, "PLANCK_LOAD_DEPS_CLJS_FILES", function_load_deps_cljs_files);
     register_global_function(ctx, "PLANCK_LOAD_DATA_READERS_FILES", function_load_data_readers_files);
     register_global_function(ctx, "PLANCK_LOAD_FROM_JAR", function_load_from_jar);
@@ -472,8 +501,20 @@ void *do_engine_init(void *data) {
     register_global_function(ctx, "PLANCK_EXIT_WITH_VALUE", function_exit_with_value);
 
     register_global_function(ctx, "PLANCK_SHELL_SH", function_shellexec);
+    register_global_function(ctx, "PLANCK_SHELL_PIPELINE", function_shell_pipeline);
+    register_global_function(ctx, "PLANCK_SHELL_ALL", function_shell_all);
+    register_global_function(ctx, "PLANCK_SHELL_SET_ASYNC_LIMIT", function_shell_set_async_limit);
+    register_global_function(ctx, "PLANCK_PROCESS_START", function_process_start);
+    register_global_function(ctx, "PLANCK_PROCESS_READ", function_process_read);
+    register_global_function(ctx, "PLANCK_PROCESS_WRITE", function_process_write);
+    register_global_function(ctx, "PLANCK_PROCESS_FLUSH", function_process_flush);
+    register_global_function(ctx, "PLANCK_PROCESS_CLOSE", function_process_close);
+    register_global_function(ctx, "PLANCK_PROCESS_WAIT", function_process_wait);
+    register_global_function(ctx, "PLANCK_PROCESS_EXIT_CODE", function_process_exit_code);
+    register_global_function(ctx, "PLANCK_PROCESS_KILL", function_process_kill);
 
     register_global_function(ctx, "PLANCK_RAW_READ_STDIN", function_raw_read_stdin);
+    register_global_function(ctx, "PLANCK_STDIN_READER_OPEN", function_stdin_reader_open);
     register_global_function(ctx, "PLANCK_RAW_WRITE_STDOUT", function_raw_write_stdout);
     register_global_function(ctx, "PLANCK_RAW_FLUSH_STDOUT", function_raw_flush_stdout);
     register_global_function(ctx, "PLANCK_RAW_WRITE_STDERR", function_raw_write_stderr);
@@ -481,6 +522,9 @@ void *do_engine_init(void *data) {
 
     register_global_function(ctx, "PLANCK_FILE_READER_OPEN", function_file_reader_open);
     register_global_function(ctx, "PLANCK_FILE_READER_READ", function_file_reader_read);
+    register_global_function(ctx, "PLANCK_FILE_READER_READ_LINE", function_file_reader_read_line);
+    register_global_function(ctx, "PLANCK_FILE_READER_READ_LINES", function_file_reader_read_lines);
+    register_global_function(ctx, "PLANCK_FILE_SLURP", function_file_slurp);
     register_global_function(ctx, "PLANCK_FILE_READER_CLOSE", function_file_reader_close);
 
     register_global_function(ctx, "PLANCK_FILE_WRITER_OPEN", function_file_writer_open);
@@ -496,19 +540,34 @@ void *do_engine_init(void *data) {
     register_global_function(ctx, "PLANCK_FILE_OUTPUT_STREAM_WRITE", function_file_output_stream_write);
     register_global_function(ctx, "PLANCK_FILE_OUTPUT_STREAM_FLUSH", function_file_output_stream_flush);
     register_global_function(ctx, "PLANCK_FILE_OUTPUT_STREAM_CLOSE", function_file_output_stream_close);
+    register_global_function(ctx, "PLANCK_FILE_STREAM_COPY", function_file_stream_copy);
 
     register_global_function(ctx, "PLANCK_MKDIRS", function_mkdirs);
     register_global_function(ctx, "PLANCK_DELETE", function_delete_file);
     register_global_function(ctx, "PLANCK_COPY", function_copy_file);
 
+    register_global_function(ctx, "PLANCK_READ_FILE_ASYNC", function_read_file_async);
+    register_global_function(ctx, "PLANCK_WRITE_FILE_ASYNC", function_write_file_async);
+    register_global_function(ctx, "PLANCK_COPY_FILE_ASYNC", function_copy_file_async);
+
     register_global_function(ctx, "PLANCK_LIST_FILES", function_list_files);
 
     register_global_function(ctx, "PLANCK_IS_DIRECTORY", function_is_directory);
 
     register_global_function(ctx, "PLANCK_FSTAT", function_fstat);
 
+    register_global_function(ctx, "PLANCK_WALK_OPEN", function_walk_open);
+    register_global_function(ctx, "PLANCK_WALK_NEXT", function_walk_next);
+
+    register_global_function(ctx, "PLANCK_WATCH", function_watch);
+    register_global_function(ctx, "PLANCK_UNWATCH", function_unwatch);
+
     register_global_function(ctx, "PLANCK_MKTEMP", function_mktemp);
 
+    register_global_function(ctx, "PLANCK_ZIP_ENTRIES", function_zip_entries);
+    register_global_function(ctx, "PLANCK_ZIP_EXTRACT", function_zip_extract);
+    register_global_function(ctx, "PLANCK_ZIP_CREATE", function_zip_create);
+
     register_global_function(ctx, "PLANCK_REQUEST", function_http_request);
 
     register_global_function(ctx, "PLANCK_READ_PASSWORD", function_read_password);
@@ -4,6 +4,9 @@ extern JSGlobalContextRef ctx;
 
 void acquire_eval_lock();
 
+// Acquires the eval lock only if it is free, returning whether it was acquired.
+bool try_acquire_eval_lock();
+
 void release_eval_lock();
 
 void set_int_handler();
@@ -27,6 +30,10 @@ JSObjectRef get_function(char *namespace, char *name);
 
 void run_main_in_ns(char *ns, size_t argc, char **argv);
 
+// Evaluates body as a function of line for each line of standard input, printing non-nil
+// results if print is set.
+void run_lines(char *body, bool print);
+
 void run_main_cli_fn();
 
 char *get_current_ns();
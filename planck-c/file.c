@@ -1,59 +1,770 @@
+// Define _GNU_SOURCE so that fopencookie is defined for non macOS builds
+#ifndef __APPLE__
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
 #include <search.h>
+#include <zlib.h>
 #include <JavaScriptCore/JavaScript.h>
+#include "unicode/ucnv.h"
 #include "unicode/ustdio.h"
+#include "unicode/ustring.h"
+#include "unicode/utf16.h"
+#include "unicode/utf8.h"
 #include "file.h"
+#include "io.h"
+
+// Text in UTF-8, ASCII, and Latin-1 is transcoded directly between file bytes and UTF-16,
+// bypassing ICU's UFILE. Runs of ASCII, the common case, are found a word at a time and simply
+// widened or narrowed, and other well-formed text is transcoded a character at a time. Malformed
+// UTF-8 is handed to ICU's bulk conversion so that it is replaced exactly as before. Other
+// encodings are read and written through UFILE.
+
+typedef enum {
+    CODEC_ICU,
+    CODEC_UTF_8,
+    CODEC_ASCII,
+    CODEC_LATIN_1
+} codec_t;
+
+static codec_t codec_for_encoding(const char *encoding) {
+    if (strcasecmp(encoding, "UTF-8") == 0 || strcasecmp(encoding, "UTF8") == 0) {
+        return CODEC_UTF_8;
+    }
+    if (strcasecmp(encoding, "US-ASCII") == 0 || strcasecmp(encoding, "ASCII") == 0) {
+        return CODEC_ASCII;
+    }
+    if (strcasecmp(encoding, "ISO-8859-1") == 0 || strcasecmp(encoding, "ISO8859-1") == 0 ||
+        strcasecmp(encoding, "ISO_8859_1") == 0 || strcasecmp(encoding, "Latin1") == 0 ||
+        strcasecmp(encoding, "Latin-1") == 0) {
+        return CODEC_LATIN_1;
+    }
+    return CODEC_ICU;
+}
+
+#define ASCII_BYTES_MASK 0x8080808080808080ULL
+#define ASCII_CHARS_MASK 0xFF80FF80FF80FF80ULL
+
+static size_t ascii_bytes_prefix(const uint8_t *bytes, size_t length) {
+    size_t i = 0;
+    uint64_t word;
+    for (; i + sizeof(word) <= length; i += sizeof(word)) {
+        memcpy(&word, bytes + i, sizeof(word));
+        if (word & ASCII_BYTES_MASK) {
+            break;
+        }
+    }
+    while (i < length && bytes[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
 
-descriptor_t ufile_to_descriptor(UFILE *ufile) {
-    return (descriptor_t) ufile;
+static size_t ascii_chars_prefix(const UChar *chars, size_t length) {
+    size_t i = 0;
+    uint64_t word;
+    for (; i + sizeof(word) / sizeof(UChar) <= length; i += sizeof(word) / sizeof(UChar)) {
+        memcpy(&word, chars + i, sizeof(word));
+        if (word & ASCII_CHARS_MASK) {
+            break;
+        }
+    }
+    while (i < length && chars[i] < 0x80) {
+        i++;
+    }
+    return i;
 }
 
-UFILE *descriptor_to_ufile(descriptor_t descriptor) {
-    return (UFILE *) descriptor;
+// Decodes bytes into chars, which must have room for length characters, returning the number
+// of characters written. Malformed input is replaced with U+FFFD, as ICU does.
+static size_t decode(codec_t codec, const uint8_t *bytes, size_t length, UChar *chars) {
+    size_t i = 0;
+    size_t n = 0;
+    while (i < length) {
+        size_t run = ascii_bytes_prefix(bytes + i, length - i);
+        size_t j;
+        for (j = 0; j < run; j++) {
+            chars[n + j] = bytes[i + j];
+        }
+        i += run;
+        n += run;
+        if (i == length) {
+            break;
+        }
+
+        if (codec == CODEC_UTF_8) {
+            int32_t next = (int32_t) i;
+            UChar32 c;
+            U8_NEXT(bytes, next, (int32_t) length, c);
+            if (c >= 0) {
+                U16_APPEND_UNSAFE(chars, n, c);
+                i = (size_t) next;
+                continue;
+            }
+
+            // Leave the substitution of malformed input to ICU
+            int32_t written = 0;
+            UErrorCode status = U_ZERO_ERROR;
+            u_strFromUTF8WithSub(chars + n, (int32_t) (length - i), &written, (const char *) bytes + i,
+                                 (int32_t) (length - i), 0xFFFD, NULL, &status);
+            return U_SUCCESS(status) ? n + written : n;
+        }
+
+        chars[n++] = codec == CODEC_LATIN_1 ? bytes[i] : 0xFFFD;
+        i++;
+    }
+    return n;
 }
 
-descriptor_t ufile_open(const char *path, const char *encoding, const char *mode) {
-    return ufile_to_descriptor(u_fopen(path, mode, NULL, encoding));
+// Unmappable default-ignorable code points are dropped rather than substituted, matching ICU.
+static bool is_default_ignorable(UChar32 c) {
+    return c == 0x00AD || c == 0x034F || c == 0x061C || c == 0x115F || c == 0x1160 ||
+           (0x17B4 <= c && c <= 0x17B5) || (0x180B <= c && c <= 0x180F) || (0x200B <= c && c <= 0x200F) ||
+           (0x202A <= c && c <= 0x202E) || (0x2060 <= c && c <= 0x206F) || c == 0x3164 ||
+           (0xFE00 <= c && c <= 0xFE0F) || c == 0xFEFF || c == 0xFFA0 || (0xFFF0 <= c && c <= 0xFFF8) ||
+           (0x1BCA0 <= c && c <= 0x1BCA3) || (0x1D173 <= c && c <= 0x1D17A) || (0xE0000 <= c && c <= 0xE0FFF);
 }
 
-descriptor_t ufile_open_read(const char *path, const char *encoding) {
-    return ufile_open(path, encoding, "r");
+// Encodes chars into bytes, which must have room for three bytes per character, returning the
+// number of bytes written. Unpaired surrogates are replaced as ICU does: with U+FFFD in UTF-8,
+// and with the ASCII substitute character otherwise, which also replaces unmappable characters.
+static size_t encode(codec_t codec, const UChar *chars, size_t length, uint8_t *bytes) {
+    size_t i = 0;
+    size_t n = 0;
+    while (i < length) {
+        size_t run = ascii_chars_prefix(chars + i, length - i);
+        size_t j;
+        for (j = 0; j < run; j++) {
+            bytes[n + j] = (uint8_t) chars[i + j];
+        }
+        i += run;
+        n += run;
+        if (i == length) {
+            break;
+        }
+
+        if (codec == CODEC_UTF_8) {
+            UChar32 c = chars[i++];
+            if (U16_IS_LEAD(c) && i < length && U16_IS_TRAIL(chars[i])) {
+                c = U16_GET_SUPPLEMENTARY(c, chars[i++]);
+            } else if (U16_IS_SURROGATE(c)) {
+                c = 0xFFFD;
+            }
+            U8_APPEND_UNSAFE(bytes, n, c);
+        } else if (codec == CODEC_LATIN_1 && chars[i] <= 0xFF) {
+            bytes[n++] = (uint8_t) chars[i++];
+        } else if (U16_IS_LEAD(chars[i]) && i + 1 < length && U16_IS_TRAIL(chars[i + 1])) {
+            if (!is_default_ignorable(U16_GET_SUPPLEMENTARY(chars[i], chars[i + 1]))) {
+                bytes[n++] = 0x1A;
+            }
+            i += 2;
+        } else {
+            if (U16_IS_SURROGATE(chars[i]) || !is_default_ignorable(chars[i])) {
+                bytes[n++] = 0x1A;
+            }
+            i++;
+        }
+    }
+    return n;
 }
 
-descriptor_t ufile_open_write(const char *path, bool append, const char *encoding) {
-    return ufile_open(path, encoding, (append ? "a" : "w"));
+// Returns the length of bytes excluding any incomplete UTF-8 sequence at the end.
+static size_t utf_8_complete_length(const uint8_t *bytes, size_t length) {
+    size_t i;
+    for (i = 1; i <= 3 && i <= length; i++) {
+        uint8_t b = bytes[length - i];
+        if ((b & 0xC0) != 0x80) {
+            size_t needed = b >= 0xF0 ? 4 : b >= 0xE0 ? 3 : b >= 0xC0 ? 2 : 1;
+            return needed > i ? length - i : length;
+        }
+    }
+    return length;
 }
 
-JSStringRef ufile_read(descriptor_t descriptor) {
-    UFILE *ufile = descriptor_to_ufile(descriptor);
-    JSStringRef rv = NULL;
-    void *buffer = malloc(sizeof(uint16_t) * 1024);
-    int32_t read = u_file_read(buffer, 1024, ufile);
+// Compressed files are opened as stdio streams whose reads and writes go through zlib, so that
+// they can be used anywhere a plain file can be.
+
+#define GZIP_BUFFER_SIZE (64 * 1024)
+
+#ifdef __APPLE__
+static int gzip_cookie_read(void *cookie, char *buf, int size) {
+#else
+static ssize_t gzip_cookie_read(void *cookie, char *buf, size_t size) {
+#endif
+    return gzread((gzFile) cookie, buf, (unsigned) size);
+}
+
+#ifdef __APPLE__
+static int gzip_cookie_write(void *cookie, const char *buf, int size) {
+#else
+static ssize_t gzip_cookie_write(void *cookie, const char *buf, size_t size) {
+#endif
+    if (size == 0) {
+        return 0;
+    }
+    int written = gzwrite((gzFile) cookie, buf, (unsigned) size);
+    return written > 0 ? written : -1;
+}
+
+static int gzip_cookie_close(void *cookie) {
+    return gzclose((gzFile) cookie) == Z_OK ? 0 : -1;
+}
+
+// Opens the gzip file at path for reading, writing, or appending a new member, according to
+// the first character of mode. Concatenated members are read as a single stream.
+static FILE *gzip_fopen(const char *path, const char *mode) {
+    const char *gz_mode = mode[0] == 'r' ? "rb" : mode[0] == 'a' ? "ab" : "wb";
+    gzFile gz = gzopen(path, gz_mode);
+    if (!gz) {
+        return NULL;
+    }
+    gzbuffer(gz, GZIP_BUFFER_SIZE);
+
+#ifdef __APPLE__
+    FILE *file = funopen(gz, mode[0] == 'r' ? gzip_cookie_read : NULL,
+                         mode[0] == 'r' ? NULL : gzip_cookie_write, NULL, gzip_cookie_close);
+#else
+    cookie_io_functions_t functions = {
+            .read = mode[0] == 'r' ? gzip_cookie_read : NULL,
+            .write = mode[0] == 'r' ? NULL : gzip_cookie_write,
+            .seek = NULL,
+            .close = gzip_cookie_close
+    };
+    FILE *file = fopencookie(gz, mode[0] == 'r' ? "r" : "w", functions);
+#endif
+    if (!file) {
+        int saved_errno = errno;
+        gzclose(gz);
+        errno = saved_errno;
+    }
+    return file;
+}
+
+static FILE *open_file(const char *path, const char *mode, bool gzip) {
+    return gzip ? gzip_fopen(path, mode) : fopen(path, mode);
+}
+
+// Readers buffer decoded characters in large blocks so that lines can be found with a single
+// scan, no matter how the file is consumed.
+
+#define UFILE_READ_BLOCK_SIZE (64 * 1024)
+
+typedef struct ufile_reader {
+    UFILE *ufile;
+    FILE *file;
+    // Whether to take whatever input is available from the file's descriptor, rather than
+    // waiting for a full block, as for pipes that are written to gradually
+    bool partial_reads;
+    codec_t codec;
+    uint8_t *bytes;
+    size_t held;
+    UChar *buf;
+    size_t start;
+    size_t end;
+    size_t capacity;
+} ufile_reader_t;
+
+descriptor_t ufile_open_read(const char *path, const char *encoding, bool gzip) {
+    ufile_reader_t *reader = calloc(1, sizeof(ufile_reader_t));
+    if (!reader) {
+        return 0;
+    }
+
+    reader->codec = codec_for_encoding(encoding);
+    if (reader->codec == CODEC_ICU) {
+        if (gzip) {
+            FILE *file = gzip_fopen(path, "r");
+            reader->ufile = file ? u_fadopt(file, NULL, encoding) : NULL;
+            if (file && !reader->ufile) {
+                fclose(file);
+            }
+        } else {
+            reader->ufile = u_fopen(path, "r", NULL, encoding);
+        }
+    } else {
+        reader->bytes = malloc(UFILE_READ_BLOCK_SIZE);
+        if (reader->bytes) {
+            reader->file = open_file(path, "r", gzip);
+        }
+    }
+
+    if (!reader->ufile && !reader->file) {
+        free(reader->bytes);
+        free(reader);
+        return 0;
+    }
+
+    return (descriptor_t) reader;
+}
+
+descriptor_t ufile_open_stdin(void) {
+    ufile_reader_t *reader = calloc(1, sizeof(ufile_reader_t));
+    if (!reader) {
+        return 0;
+    }
+
+    reader->bytes = malloc(UFILE_READ_BLOCK_SIZE);
+    if (!reader->bytes) {
+        free(reader);
+        return 0;
+    }
+
+    reader->file = stdin;
+    reader->partial_reads = true;
+    reader->codec = CODEC_UTF_8;
+    return (descriptor_t) reader;
+}
+
+descriptor_t ufile_open_fd(int fd, const char *encoding) {
+    ufile_reader_t *reader = calloc(1, sizeof(ufile_reader_t));
+    if (!reader) {
+        return 0;
+    }
+
+    FILE *file = fdopen(fd, "r");
+    reader->codec = codec_for_encoding(encoding);
+    if (file && reader->codec == CODEC_ICU) {
+        reader->ufile = u_fadopt(file, NULL, encoding);
+    } else if (file) {
+        reader->bytes = malloc(UFILE_READ_BLOCK_SIZE);
+        if (reader->bytes) {
+            reader->file = file;
+            reader->partial_reads = true;
+        }
+    }
+
+    if (!reader->ufile && !reader->file) {
+        if (file) {
+            fclose(file);
+        } else {
+            close(fd);
+        }
+        free(reader->bytes);
+        free(reader);
+        return 0;
+    }
+
+    return (descriptor_t) reader;
+}
+
+static size_t read_block(ufile_reader_t *reader) {
+    uint8_t *buf = reader->bytes + reader->held;
+    size_t size = UFILE_READ_BLOCK_SIZE - reader->held;
+
+    if (reader->partial_reads) {
+        ssize_t n;
+        do {
+            n = read(fileno(reader->file), buf, size);
+        } while (n == -1 && errno == EINTR);
+        return n > 0 ? (size_t) n : 0;
+    }
+
+    size_t n = fread(buf, 1, size, reader->file);
+    if (feof(reader->file)) {
+        clearerr(reader->file);
+    }
+    return n;
+}
+
+// Reads and decodes up to UFILE_READ_BLOCK_SIZE bytes into chars, holding back any incomplete
+// sequence at the end for the next read. Returns the number of characters decoded.
+static size_t file_read_chars(ufile_reader_t *reader, UChar *chars) {
+    for (;;) {
+        size_t read = read_block(reader);
+
+        size_t length = reader->held + read;
+        size_t complete = length;
+        if (reader->codec == CODEC_UTF_8 && read > 0) {
+            complete = utf_8_complete_length(reader->bytes, length);
+        }
+
+        size_t count = decode(reader->codec, reader->bytes, complete, chars);
+        reader->held = length - complete;
+        memmove(reader->bytes, reader->bytes + complete, reader->held);
+
+        if (count > 0 || read == 0) {
+            return count;
+        }
+    }
+}
+
+// Reads another block into the buffer, returning the number of characters read.
+static size_t ufile_fill(ufile_reader_t *reader) {
+    if (reader->start > 0) {
+        memmove(reader->buf, reader->buf + reader->start, (reader->end - reader->start) * sizeof(UChar));
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+
+    if (reader->capacity - reader->end < UFILE_READ_BLOCK_SIZE) {
+        size_t capacity = reader->end + UFILE_READ_BLOCK_SIZE;
+        if (capacity < 2 * reader->capacity) {
+            capacity = 2 * reader->capacity;
+        }
+        UChar *buf = realloc(reader->buf, capacity * sizeof(UChar));
+        if (!buf) {
+            return 0;
+        }
+        reader->buf = buf;
+        reader->capacity = capacity;
+    }
+
+    if (reader->file) {
+        size_t read = file_read_chars(reader, reader->buf + reader->end);
+        reader->end += read;
+        return read;
+    }
+
+    int32_t read = u_file_read(reader->buf + reader->end, UFILE_READ_BLOCK_SIZE, reader->ufile);
     /* If we've read to the end of the file, clear the EOF indicator
      * so that subsequent read calls will try again. */
-    if (u_feof(ufile)) {
-        clearerr(u_fgetfile(ufile));
+    if (u_feof(reader->ufile)) {
+        clearerr(u_fgetfile(reader->ufile));
+    }
+    if (read <= 0) {
+        return 0;
+    }
+
+    reader->end += read;
+    return (size_t) read;
+}
+
+static JSStringRef ufile_take(ufile_reader_t *reader, size_t end, size_t next) {
+    JSStringRef rv = JSStringCreateWithCharacters(reader->buf + reader->start, end - reader->start);
+    reader->start = next;
+    if (reader->start == reader->end) {
+        reader->start = reader->end = 0;
+    }
+    return rv;
+}
+
+JSStringRef ufile_read(descriptor_t descriptor) {
+    ufile_reader_t *reader = (ufile_reader_t *) descriptor;
+    if (reader->start == reader->end && ufile_fill(reader) == 0) {
+        return NULL;
+    }
+    return ufile_take(reader, reader->end, reader->end);
+}
+
+JSStringRef ufile_read_line(descriptor_t descriptor) {
+    ufile_reader_t *reader = (ufile_reader_t *) descriptor;
+    size_t scanned = 0;
+    for (;;) {
+        size_t available = reader->end - reader->start;
+        UChar *newline = u_memchr(reader->buf + reader->start + scanned, '\n', (int32_t) (available - scanned));
+        if (newline) {
+            size_t end = newline - reader->buf;
+            return ufile_take(reader, end, end + 1);
+        }
+        scanned = available;
+        if (ufile_fill(reader) == 0) {
+            if (reader->start == reader->end) {
+                return NULL;
+            }
+            return ufile_take(reader, reader->end, reader->end);
+        }
+    }
+}
+
+bool ufile_read_available(descriptor_t descriptor) {
+    return ufile_fill((ufile_reader_t *) descriptor) > 0;
+}
+
+JSStringRef ufile_read_buffered_line(descriptor_t descriptor) {
+    ufile_reader_t *reader = (ufile_reader_t *) descriptor;
+    UChar *newline = u_memchr(reader->buf + reader->start, '\n', (int32_t) (reader->end - reader->start));
+    if (!newline) {
+        return NULL;
+    }
+    size_t end = newline - reader->buf;
+    return ufile_take(reader, end, end + 1);
+}
+
+static JSStringRef decode_to_string(codec_t codec, const uint8_t *bytes, size_t length) {
+    if (length > INT32_MAX) {
+        errno = EFBIG;
+        return NULL;
+    }
+
+    UChar *chars = malloc((length + 1) * sizeof(UChar));
+    if (!chars) {
+        return NULL;
     }
-    if (read > 0) {
-        rv = JSStringCreateWithCharacters(buffer, (size_t) read);
+
+    JSStringRef rv = JSStringCreateWithCharacters(chars, decode(codec, bytes, length, chars));
+    free(chars);
+    return rv;
+}
+
+JSStringRef file_slurp(const char *path, const char *encoding) {
+    codec_t codec = codec_for_encoding(encoding);
+    if (codec == CODEC_ICU) {
+        return NULL;
+    }
+
+    size_t length;
+    uint8_t *contents = read_regular_file(path, &length);
+    if (!contents) {
+        return NULL;
     }
-    free(buffer);
+
+    JSStringRef rv = decode_to_string(codec, contents, length);
+    free(contents);
     return rv;
 }
 
+JSStringRef file_read_text(const char *path, const char *encoding) {
+    codec_t codec = codec_for_encoding(encoding);
+    if (codec != CODEC_ICU) {
+        size_t length;
+        uint8_t *contents = read_file(path, &length);
+        if (!contents) {
+            return NULL;
+        }
+
+        JSStringRef rv = decode_to_string(codec, contents, length);
+        free(contents);
+        return rv;
+    }
+
+    errno = 0;
+    descriptor_t descriptor = ufile_open_read(path, encoding, false);
+    if (!descriptor) {
+        if (!errno) {
+            errno = EINVAL;
+        }
+        return NULL;
+    }
+
+    ufile_reader_t *reader = (ufile_reader_t *) descriptor;
+    while (ufile_fill(reader) > 0) {
+    }
+    JSStringRef rv = JSStringCreateWithCharacters(reader->buf, reader->end);
+    ufile_close_read(descriptor);
+    return rv;
+}
+
+void ufile_close_read(descriptor_t descriptor) {
+    ufile_reader_t *reader = (ufile_reader_t *) descriptor;
+    if (reader->file) {
+        fclose(reader->file);
+    } else {
+        u_fclose(reader->ufile);
+    }
+    free(reader->bytes);
+    free(reader->buf);
+    free(reader);
+}
+
+// Writers on the fast path encode in chunks, never splitting a surrogate pair, and hold a
+// trailing lead surrogate over to the next write.
+
+#define UFILE_WRITE_CHUNK_SIZE (16 * 1024)
+
+typedef struct ufile_writer {
+    UFILE *ufile;
+    FILE *file;
+    codec_t codec;
+    uint8_t *bytes;
+    UChar lead;
+} ufile_writer_t;
+
+descriptor_t ufile_open_write(const char *path, bool append, const char *encoding, bool gzip) {
+    ufile_writer_t *writer = calloc(1, sizeof(ufile_writer_t));
+    if (!writer) {
+        return 0;
+    }
+
+    const char *mode = append ? "a" : "w";
+    writer->codec = codec_for_encoding(encoding);
+    if (writer->codec == CODEC_ICU) {
+        if (gzip) {
+            FILE *file = gzip_fopen(path, mode);
+            writer->ufile = file ? u_fadopt(file, NULL, encoding) : NULL;
+            if (file && !writer->ufile) {
+                fclose(file);
+            }
+        } else {
+            writer->ufile = u_fopen(path, mode, NULL, encoding);
+        }
+    } else {
+        writer->bytes = malloc(3 * UFILE_WRITE_CHUNK_SIZE);
+        if (writer->bytes) {
+            writer->file = open_file(path, mode, gzip);
+        }
+    }
+
+    if (!writer->ufile && !writer->file) {
+        free(writer->bytes);
+        free(writer);
+        return 0;
+    }
+
+    return (descriptor_t) writer;
+}
+
+static void file_write_chars(ufile_writer_t *writer, const UChar *chars, size_t length) {
+    size_t written = encode(writer->codec, chars, length, writer->bytes);
+    fwrite(writer->bytes, 1, written, writer->file);
+}
+
+static void file_write_lead(ufile_writer_t *writer) {
+    if (writer->lead) {
+        file_write_chars(writer, &writer->lead, 1);
+        writer->lead = 0;
+    }
+}
+
 void ufile_write(descriptor_t descriptor, JSStringRef text) {
-    UFILE *ufile = descriptor_to_ufile(descriptor);
-    u_file_write(JSStringGetCharactersPtr(text), (uint32_t) JSStringGetLength(text), ufile);
+    ufile_writer_t *writer = (ufile_writer_t *) descriptor;
+    const UChar *chars = JSStringGetCharactersPtr(text);
+    size_t length = JSStringGetLength(text);
+
+    if (writer->ufile) {
+        u_file_write(chars, (int32_t) length, writer->ufile);
+        return;
+    }
+
+    if (writer->lead && length > 0 && U16_IS_TRAIL(chars[0])) {
+        UChar pair[2] = {writer->lead, chars[0]};
+        file_write_chars(writer, pair, 2);
+        writer->lead = 0;
+        chars++;
+        length--;
+    } else if (length > 0) {
+        file_write_lead(writer);
+    }
+
+    if (length > 0 && U16_IS_LEAD(chars[length - 1])) {
+        writer->lead = chars[length - 1];
+        length--;
+    }
+
+    while (length > 0) {
+        size_t chunk = length < UFILE_WRITE_CHUNK_SIZE ? length : UFILE_WRITE_CHUNK_SIZE;
+        if (chunk < length && U16_IS_LEAD(chars[chunk - 1])) {
+            chunk--;
+        }
+        file_write_chars(writer, chars, chunk);
+        chars += chunk;
+        length -= chunk;
+    }
+}
+
+#define FILE_WRITE_STRING_CHUNK_SIZE 1024
+
+void file_write_string(FILE *file, JSStringRef text) {
+    const UChar *chars = JSStringGetCharactersPtr(text);
+    size_t length = JSStringGetLength(text);
+    uint8_t bytes[3 * FILE_WRITE_STRING_CHUNK_SIZE];
+
+    while (length > 0) {
+        size_t chunk = length < FILE_WRITE_STRING_CHUNK_SIZE ? length : FILE_WRITE_STRING_CHUNK_SIZE;
+        if (chunk < length && U16_IS_LEAD(chars[chunk - 1])) {
+            chunk--;
+        }
+        fwrite(bytes, 1, encode(CODEC_UTF_8, chars, chunk, bytes), file);
+        chars += chunk;
+        length -= chunk;
+    }
 }
 
 void ufile_flush(descriptor_t descriptor) {
-    UFILE *ufile = descriptor_to_ufile(descriptor);
-    u_fflush(ufile);
+    ufile_writer_t *writer = (ufile_writer_t *) descriptor;
+    if (writer->file) {
+        file_write_lead(writer);
+        fflush(writer->file);
+    } else {
+        u_fflush(writer->ufile);
+    }
 }
 
 void ufile_close(descriptor_t descriptor) {
-    UFILE *ufile = descriptor_to_ufile(descriptor);
-    u_fclose(ufile);
+    ufile_writer_t *writer = (ufile_writer_t *) descriptor;
+    if (writer->file) {
+        file_write_lead(writer);
+        fclose(writer->file);
+    } else {
+        u_fclose(writer->ufile);
+    }
+    free(writer->bytes);
+    free(writer);
+}
+
+int file_write_text(const char *path, bool append, const char *encoding, JSStringRef text) {
+    errno = 0;
+    descriptor_t descriptor = ufile_open_write(path, append, encoding, false);
+    if (!descriptor) {
+        if (!errno) {
+            errno = EINVAL;
+        }
+        return -1;
+    }
+
+    ufile_write(descriptor, text);
+
+    int rv = 0;
+    ufile_writer_t *writer = (ufile_writer_t *) descriptor;
+    if (writer->file) {
+        file_write_lead(writer);
+        if (fflush(writer->file) != 0 || ferror(writer->file)) {
+            rv = -1;
+        }
+    }
+
+    int saved_errno = errno;
+    ufile_close(descriptor);
+    errno = saved_errno;
+    return rv;
+}
+
+uint8_t *file_encode_text(JSStringRef text, const char *encoding, size_t *length) {
+    const UChar *chars = JSStringGetCharactersPtr(text);
+    size_t count = JSStringGetLength(text);
+
+    codec_t codec = codec_for_encoding(encoding);
+    if (codec != CODEC_ICU) {
+        uint8_t *bytes = malloc(3 * count + 1);
+        if (!bytes) {
+            return NULL;
+        }
+        *length = encode(codec, chars, count, bytes);
+        uint8_t *shrunk = realloc(bytes, *length + 1);
+        return shrunk ? shrunk : bytes;
+    }
+
+    if (count > INT32_MAX) {
+        errno = EFBIG;
+        return NULL;
+    }
+
+    UErrorCode status = U_ZERO_ERROR;
+    UConverter *converter = ucnv_open(encoding, &status);
+    if (U_FAILURE(status)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    int32_t size = ucnv_fromUChars(converter, NULL, 0, chars, (int32_t) count, &status);
+    uint8_t *bytes = malloc((size_t) size + 1);
+    if (bytes) {
+        status = U_ZERO_ERROR;
+        ucnv_fromUChars(converter, (char *) bytes, size + 1, chars, (int32_t) count, &status);
+        if (U_FAILURE(status)) {
+            free(bytes);
+            bytes = NULL;
+            errno = EINVAL;
+        }
+        *length = (size_t) size;
+    }
+    ucnv_close(converter);
+    return bytes;
 }
 
 descriptor_t file_to_descriptor(FILE *file) {
@@ -64,16 +775,16 @@ FILE *descriptor_to_file(descriptor_t descriptor) {
     return (FILE *) descriptor;
 }
 
-descriptor_t file_open(const char *path, const char *mode) {
-    return file_to_descriptor(fopen(path, mode));
+descriptor_t file_open(const char *path, const char *mode, bool gzip) {
+    return file_to_descriptor(open_file(path, mode, gzip));
 }
 
-descriptor_t file_open_read(const char *path) {
-    return file_open(path, "r");
+descriptor_t file_open_read(const char *path, bool gzip) {
+    return file_open(path, "r", gzip);
 }
 
-descriptor_t file_open_write(const char *path, bool append) {
-    return file_open(path, (append ? "a" : "w"));
+descriptor_t file_open_write(const char *path, bool append, bool gzip) {
+    return file_open(path, (append ? "a" : "w"), gzip);
 }
 
 size_t file_read(descriptor_t descriptor, size_t buf_size, uint8_t *buf) {
@@ -95,3 +806,48 @@ void file_close(descriptor_t descriptor) {
     FILE *file = descriptor_to_file(descriptor);
     fclose(file);
 }
+
+#define FILE_COPY_BUFFER_SIZE (128 * 1024)
+
+int file_copy(descriptor_t from_descriptor, descriptor_t to_descriptor) {
+    FILE *from = descriptor_to_file(from_descriptor);
+    FILE *to = descriptor_to_file(to_descriptor);
+
+    if (fflush(to) != 0) {
+        return -1;
+    }
+
+    // Position the input descriptor where reading left off, past anything stdio has buffered,
+    // so that the rest can be copied between descriptors. Compressed streams have no descriptor.
+    off_t offset = fileno(from) == -1 || fileno(to) == -1 ? -1 : ftello(from);
+    if (offset == -1 || lseek(fileno(from), offset, SEEK_SET) == -1) {
+        uint8_t *buf = malloc(FILE_COPY_BUFFER_SIZE);
+        if (!buf) {
+            return -1;
+        }
+        size_t n;
+        while ((n = fread(buf, 1, FILE_COPY_BUFFER_SIZE, from)) > 0) {
+            if (fwrite(buf, 1, n, to) < n) {
+                break;
+            }
+        }
+        free(buf);
+        return ferror(from) || ferror(to) || fflush(to) != 0 ? -1 : 0;
+    }
+
+    int rv = copy_fd(fileno(from), fileno(to));
+    int saved_errno = errno;
+
+    // Bring the streams back in step with their descriptors
+    offset = lseek(fileno(from), 0, SEEK_CUR);
+    if (offset != -1) {
+        fseeko(from, offset, SEEK_SET);
+    }
+    offset = lseek(fileno(to), 0, SEEK_CUR);
+    if (offset != -1) {
+        fseeko(to, offset, SEEK_SET);
+    }
+
+    errno = saved_errno;
+    return rv;
+}
@@ -1,22 +1,62 @@
+#include <stdio.h>
 #include <JavaScriptCore/JavaScript.h>
 
 typedef unsigned long descriptor_t;
 
-descriptor_t ufile_open_read(const char *path, const char *encoding);
+// Opens a reader or writer on the file at path, which is gzip compressed if gzip is set, returning
+// 0 on failure.
+descriptor_t ufile_open_read(const char *path, const char *encoding, bool gzip);
 
-descriptor_t ufile_open_write(const char *path, bool append, const char *encoding);
+descriptor_t ufile_open_write(const char *path, bool append, const char *encoding, bool gzip);
+
+// Opens a UTF-8 reader on standard input, which must be unbuffered, that returns input as soon as
+// it is available. It is never closed.
+descriptor_t ufile_open_stdin(void);
+
+// Opens a reader on the descriptor fd, such as a pipe, which it takes ownership of, returning input
+// as soon as it is available for UTF-8, ASCII, and Latin-1. Returns 0 on failure, having closed fd.
+descriptor_t ufile_open_fd(int fd, const char *encoding);
 
 JSStringRef ufile_read(descriptor_t descriptor);
 
+// Reads the next line, without its terminating newline, or returns NULL at end of file.
+JSStringRef ufile_read_line(descriptor_t descriptor);
+
+// Reads whatever input is available, waiting for some if there is none, into the buffer that
+// lines are taken from. Returns false at end of file.
+bool ufile_read_available(descriptor_t descriptor);
+
+// Reads the next line only if it has already been read into the buffer, returning NULL otherwise.
+JSStringRef ufile_read_buffered_line(descriptor_t descriptor);
+
+void ufile_close_read(descriptor_t descriptor);
+
+// Reads the whole of a regular file in one go, returning NULL if the file isn't a regular file
+// or the encoding isn't UTF-8, ASCII, or Latin-1, in which case a reader should be used instead.
+JSStringRef file_slurp(const char *path, const char *encoding);
+
+// Reads the whole of the file at path as text, returning NULL with errno set on failure.
+JSStringRef file_read_text(const char *path, const char *encoding);
+
+// Writes text to the file at path, returning -1 with errno set on failure.
+int file_write_text(const char *path, bool append, const char *encoding, JSStringRef text);
+
+// Encodes text in encoding, returning the bytes, which the caller frees, and setting length, or
+// NULL with errno set on failure.
+uint8_t *file_encode_text(JSStringRef text, const char *encoding, size_t *length);
+
 void ufile_write(descriptor_t descriptor, JSStringRef text);
 
+// Writes text to file as UTF-8, a chunk at a time, without copying the whole string.
+void file_write_string(FILE *file, JSStringRef text);
+
 void ufile_flush(descriptor_t descriptor);
 
 void ufile_close(descriptor_t descriptor);
 
-descriptor_t file_open_read(const char *path);
+descriptor_t file_open_read(const char *path, bool gzip);
 
-descriptor_t file_open_write(const char *path, bool append);
+descriptor_t file_open_write(const char *path, bool append, bool gzip);
 
 size_t file_read(descriptor_t descriptor, size_t buf_size, uint8_t *buffer);
 
@@ -25,3 +65,7 @@ void file_write(descriptor_t descriptor, size_t buf_size, uint8_t *buffer);
 void file_flush(descriptor_t descriptor);
 
 void file_close(descriptor_t descriptor);
+
+// Copies the rest of the input stream from to the output stream to, between descriptors where
+// possible. Returns -1 with errno set on failure.
+int file_copy(descriptor_t from, descriptor_t to);
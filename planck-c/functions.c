@@ -22,12 +22,19 @@
 #include "jsc_utils.h"
 #include "str.h"
 #include "archive.h"
+#include "async_io.h"
+#include "classpath.h"
+#include "dir_cache.h"
 #include "file.h"
+#include "js_lib_cache.h"
 #include "timers.h"
+#include "walk.h"
+#include "watch.h"
 #include "engine.h"
 #include "repl.h"
 #include "clock.h"
 #include "sockets.h"
+#include "prefetch.h"
 #include "tasks.h"
 
 JSValueRef make_error_with_errno(JSContextRef ctx) {
@@ -36,6 +43,13 @@ JSValueRef make_error_with_errno(JSContextRef ctx) {
     return JSObjectMakeError(ctx, 1, arguments, NULL);
 }
 
+static JSValueRef make_error_with_message(JSContextRef ctx, char *message) {
+    JSValueRef arguments[1];
+    arguments[0] = c_string_to_value(ctx, message ? message : "Unknown error");
+    free(message);
+    return JSObjectMakeError(ctx, 1, arguments, NULL);
+}
+
 #define CONSOLE_LOG_BUF_SIZE 1000
 char console_log_buf[CONSOLE_LOG_BUF_SIZE];
 
@@ -88,15 +102,28 @@ JSValueRef function_read_file(JSContextRef ctx, JSObjectRef function, JSObjectRe
 
         // debug_print_value("read_file", ctx, args[0]);
 
-        time_t last_modified = 0;
-        char *contents = get_contents(path, &last_modified);
-        if (contents != NULL) {
-            JSStringRef contents_str = JSStringCreateWithUTF8CString(contents);
-            free(contents);
+        struct loaded_source source;
+        prefetch_status_t status = prefetch_take(PREFETCH_READ, path, &source);
+        if (status == PREFETCH_MISS) {
+            source.path = NULL;
+            source.last_modified = 0;
+            source.contents = get_contents(path, &source.last_modified);
+            if (source.contents != NULL) {
+                status = PREFETCH_FOUND;
+                if (is_prefetchable_source(path)) {
+                    prefetch_dependencies(source.contents);
+                }
+            }
+        }
+
+        if (status == PREFETCH_FOUND) {
+            JSStringRef contents_str = JSStringCreateWithUTF8CString(source.contents);
+            free(source.contents);
+            free(source.path);
 
             JSValueRef res[2];
             res[0] = JSValueMakeString(ctx, contents_str);
-            res[1] = JSValueMakeNumber(ctx, last_modified);
+            res[1] = JSValueMakeNumber(ctx, source.last_modified);
             return JSObjectMakeArray(ctx, 2, res, NULL);
         }
     }
@@ -117,113 +144,76 @@ JSValueRef function_load(JSContextRef ctx, JSObjectRef function, JSObjectRef thi
 
         // debug_print_value("load", ctx, args[0]);
 
-        time_t last_modified = 0;
-        char *contents = NULL;
-        char *loaded_path = strdup(path);
-        char *loaded_type = NULL;
-        char *loaded_location = NULL;
-
-        bool developing = (config.num_src_paths == 1 &&
-                           strcmp(config.src_paths[0].type, "src") == 0 &&
-                           str_has_suffix(config.src_paths[0].path, "/planck-cljs/src/") == 0);
-
-        if (!developing) {
-            contents = bundle_get_contents(path);
-            loaded_type = "bundled";
-            last_modified = 0;
-        }
-
-        // load from classpath
-        if (contents == NULL) {
-            int i;
-            for (i = 0; i < config.num_src_paths; i++) {
-                if (config.src_paths[i].blacklisted) {
-                    continue;
-                }
-
-                char *type = config.src_paths[i].type;
-                char *location = config.src_paths[i].path;
-
-                if (strcmp(type, "src") == 0) {
-                    char *full_path = str_concat(location, path);
-                    contents = get_contents(full_path, &last_modified);
-                    if (contents != NULL) {
-                        free(loaded_path);
-                        loaded_path = strdup(full_path);
-                        loaded_type = type;
-                        loaded_location = location;
-                    }
-                    free(full_path);
-                } else if (strcmp(type, "jar") == 0) {
-                    struct stat file_stat;
-                    if (stat(location, &file_stat) == 0) {
-                        char *error_msg = NULL;
-                        if (!config.src_paths[i].archive) {
-                            config.src_paths[i].archive = open_archive(location, &error_msg);
-                            if (error_msg) {
-                                engine_print(error_msg);
-                                engine_print("\n");
-                                free(error_msg);
-                            }
-                        }
-                        if (config.src_paths[i].archive) {
-                            contents_zip_t contents_zip;
-                            contents_zip = get_contents_zip(config.src_paths[i].archive, path,
-                                                            &last_modified, &error_msg);
-                            contents = (char *) contents_zip.payload;
-                            if (!contents && error_msg) {
-                                engine_print(error_msg);
-                                engine_print("\n");
-                                free(error_msg);
-                            }
-                        }
-                        loaded_type = type;
-                        loaded_location = location;
-                    } else {
-                        engine_perror(location);
-                        config.src_paths[i].blacklisted = true;
-                    }
-                }
-
-                if (contents != NULL) {
-                    break;
+        struct loaded_source source;
+        prefetch_status_t status = prefetch_take(PREFETCH_LOAD, path, &source);
+        if (status == PREFETCH_MISS) {
+            if (classpath_load(path, &source, false)) {
+                status = PREFETCH_FOUND;
+                if (is_prefetchable_source(path)) {
+                    prefetch_dependencies(source.contents);
                 }
             }
         }
 
-        // load from out/
-        if (contents == NULL) {
-            if (config.out_path != NULL) {
-                char *full_path = str_concat(config.out_path, path);
-                contents = get_contents(full_path, &last_modified);
-                free(full_path);
-            }
-        }
-
-        if (developing && contents == NULL) {
-            contents = bundle_get_contents(path);
-            last_modified = 0;
-        }
-
-        if (contents != NULL) {
-            JSStringRef contents_str = JSStringCreateWithUTF8CString(contents);
-            free(contents);
-            JSStringRef loaded_path_str = JSStringCreateWithUTF8CString(loaded_path);
-            free(loaded_path);
-            JSStringRef loaded_type_str = JSStringCreateWithUTF8CString(loaded_type);
-            JSStringRef loaded_location_str = JSStringCreateWithUTF8CString(loaded_location);
+        if (status == PREFETCH_FOUND) {
+            JSStringRef contents_str = JSStringCreateWithUTF8CString(source.contents);
+            free(source.contents);
+            JSStringRef loaded_path_str = JSStringCreateWithUTF8CString(source.path);
+            free(source.path);
+            JSStringRef loaded_type_str = JSStringCreateWithUTF8CString(source.type);
+            JSStringRef loaded_location_str = JSStringCreateWithUTF8CString(source.location);
 
 
             JSValueRef res[5];
             res[0] = JSValueMakeString(ctx, contents_str);
-            res[1] = JSValueMakeNumber(ctx, last_modified);
+            res[1] = JSValueMakeNumber(ctx, source.last_modified);
             res[2] = JSValueMakeString(ctx, loaded_path_str);
             res[3] = JSValueMakeString(ctx, loaded_type_str);
             res[4] = JSValueMakeString(ctx, loaded_location_str);
             return JSObjectMakeArray(ctx, 5, res, NULL);
         }
+    }
+
+    return JSValueMakeNull(ctx);
+}
+
+JSValueRef function_load_js_lib(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 1 && JSValueGetType(ctx, args[0]) == kJSTypeString) {
+        char *path = value_to_c_string(ctx, args[0]);
+
+        JSStringRef contents_str = NULL;
+
+        js_lib_t lib;
+        if (js_lib_cache_open(path, &lib)) {
+            contents_str = JSStringCreateWithCharacters(lib.chars, lib.length);
+            js_lib_cache_close(&lib);
+        } else {
+            struct loaded_source source;
+            if (classpath_load(path, &source, false)) {
+                if (config.cache_path && source.type && strcmp(source.type, "jar") == 0) {
+                    size_t length;
+                    uint16_t *chars = js_lib_cache_store(path, source.location, source.contents, &length);
+                    if (chars) {
+                        contents_str = JSStringCreateWithCharacters(chars, length);
+                        free(chars);
+                    }
+                }
+                if (!contents_str) {
+                    contents_str = JSStringCreateWithUTF8CString(source.contents);
+                }
+                free(source.contents);
+                free(source.path);
+            }
+        }
 
-        free(loaded_path);
+        free(path);
+
+        if (contents_str) {
+            JSValueRef rv = JSValueMakeString(ctx, contents_str);
+            JSStringRelease(contents_str);
+            return rv;
+        }
     }
 
     return JSValueMakeNull(ctx);
@@ -247,35 +237,16 @@ JSValueRef function_load_all_files(const char* filename, JSContextRef ctx, JSObj
             if (strcmp(type, "jar") == 0) {
                 struct stat file_stat;
                 if (stat(location, &file_stat) == 0) {
-                    char *error_msg = NULL;
-                    if (!config.src_paths[i].archive) {
-                        config.src_paths[i].archive = open_archive(location, &error_msg);
-                        if (error_msg) {
-                            engine_print(error_msg);
-                            engine_print("\n");
-                            free(error_msg);
-                        }
-                    }
-                    if (config.src_paths[i].archive) {
-                        contents_zip_t contents_zip;
-                        contents_zip = get_contents_zip(config.src_paths[i].archive, filename,
-                                                        NULL, &error_msg);
-                        char *source = (char *) contents_zip.payload;
-                        if (source != NULL) {
-                            num_files += 1;
-                            paths = realloc(paths, num_files * sizeof(char *));
-                            sources = realloc(sources, num_files * sizeof(char *));
-                            char buffer[1024];
-                            snprintf(buffer, 1024, "jar:file://%s!/%s", location, filename);
-                            paths[num_files - 1] = strdup(buffer);
-                            sources[num_files - 1] = source;
-                        } else {
-                            if (error_msg) {
-                                engine_print(error_msg);
-                                engine_print("\n");
-                                free(error_msg);
-                            }
-                        }
+                    contents_zip_t contents_zip = classpath_get_contents_zip(i, filename, NULL, false);
+                    char *source = (char *) contents_zip.payload;
+                    if (source != NULL) {
+                        num_files += 1;
+                        paths = realloc(paths, num_files * sizeof(char *));
+                        sources = realloc(sources, num_files * sizeof(char *));
+                        char buffer[1024];
+                        snprintf(buffer, 1024, "jar:file://%s!/%s", location, filename);
+                        paths[num_files - 1] = strdup(buffer);
+                        sources[num_files - 1] = source;
                     }
                 } else {
                     engine_perror(location);
@@ -351,7 +322,7 @@ JSValueRef function_load_from_jar(JSContextRef ctx, JSObjectRef function, JSObje
         contents_zip_t contents;
         contents.payload = NULL;
         JSStringRef contents_str = NULL;
-        JSValueRef* contents_arr = NULL;
+        JSObjectRef contents_arr = NULL;
 
         char *error_msg = NULL;
         void *archive = open_archive(jar_path, &error_msg);
@@ -366,14 +337,11 @@ JSValueRef function_load_from_jar(JSContextRef ctx, JSObjectRef function, JSObje
 
             if (contents.payload != NULL) {
                 if (convertToString) {
-                   contents_str = JSStringCreateWithUTF8CString((char*)contents.payload);
+                    contents_str = JSStringCreateWithUTF8CString((char*)contents.payload);
+                    free(contents.payload);
                 } else {
-                    contents_arr = malloc(sizeof(JSValueRef) * contents.length);
-                    for (size_t i=0; i<contents.length; i++) {
-                        contents_arr[i] = JSValueMakeNumber(ctx, contents.payload[i]);
-                    }
+                    contents_arr = make_uint8_array(ctx, contents.payload, contents.length);
                 }
-                free(contents.payload);
             } else {
                 if (!error_msg) {
                     error_msg = strdup("Resource not found in JAR");
@@ -392,8 +360,7 @@ JSValueRef function_load_from_jar(JSContextRef ctx, JSObjectRef function, JSObje
             if (convertToString) {
                 res[0] = JSValueMakeString(ctx, contents_str);
             } else {
-                res[0] = JSObjectMakeArray(ctx, contents.length, contents_arr, NULL);
-                free(contents_arr);
+                res[0] = contents_arr;
             }
         } else {
             res[0] = JSValueMakeNull(ctx);
@@ -431,17 +398,20 @@ JSValueRef function_cache(JSContextRef ctx, JSObjectRef function, JSObjectRef th
         suffix = ".js";
         strcpy(path, cache_prefix);
         strcat(path, suffix);
+        prefetch_forget(PREFETCH_READ, path);
         write_contents(path, source);
 
         suffix = ".cache.json";
         strcpy(path, cache_prefix);
         strcat(path, suffix);
+        prefetch_forget(PREFETCH_READ, path);
         write_contents(path, cache);
 
         suffix = ".js.map.json";
         strcpy(path, cache_prefix);
         strcat(path, suffix);
         if (sourcemap) {
+            prefetch_forget(PREFETCH_READ, path);
             write_contents(path, sourcemap);
         }
 
@@ -502,12 +472,19 @@ JSValueRef function_print_fn(JSContextRef ctx, JSObjectRef function, JSObjectRef
     }
 
     if (argc == 1) {
-        char *str = value_to_c_string_ext(ctx, args[0], true);
-
-        fprintf(stdout, "%s", str);
-        fflush(stdout);
+        if (JSValueIsString(ctx, args[0])) {
+            JSStringRef str = JSValueToStringCopy(ctx, args[0], NULL);
+            file_write_string(stdout, str);
+            JSStringRelease(str);
+        } else {
+            char *str = value_to_c_string_ext(ctx, args[0], true);
+            fprintf(stdout, "%s", str);
+            free(str);
+        }
 
-        free(str);
+        if (!config.buffered_stdout) {
+            fflush(stdout);
+        }
     }
 
     return JSValueMakeNull(ctx);
@@ -525,6 +502,11 @@ JSValueRef function_print_err_fn(JSContextRef ctx, JSObjectRef function, JSObjec
     if (argc == 1) {
         char *str = value_to_c_string_ext(ctx, args[0], true);
 
+        // Keep output interleaved as written when both streams go to the same place
+        if (config.buffered_stdout) {
+            fflush(stdout);
+        }
+
         fprintf(stderr, "%s", str);
         fflush(stderr);
 
@@ -547,6 +529,11 @@ JSValueRef function_raw_read_stdin(JSContextRef ctx, JSObjectRef function, JSObj
                                    size_t argc, const JSValueRef args[], JSValueRef *exception) {
     char buf[1024 + 1];
 
+    // Make sure any prompt has been written before waiting on the terminal
+    if (config.is_tty && config.buffered_stdout) {
+        fflush(stdout);
+    }
+
     size_t n = fread(buf, 1, config.is_tty ? 1 : 1024, stdin);
     if (n > 0) {
         buf[n] = '\0';
@@ -559,9 +546,9 @@ JSValueRef function_raw_read_stdin(JSContextRef ctx, JSObjectRef function, JSObj
 JSValueRef function_raw_write_stdout(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
                                      size_t argc, const JSValueRef args[], JSValueRef *exception) {
     if (argc == 1 && JSValueGetType(ctx, args[0]) == kJSTypeString) {
-        char *s = value_to_c_string(ctx, args[0]);
-        fprintf(stdout, "%s", s);
-        free(s);
+        JSStringRef s = JSValueToStringCopy(ctx, args[0], NULL);
+        file_write_string(stdout, s);
+        JSStringRelease(s);
     }
 
     return JSValueMakeNull(ctx);
@@ -577,6 +564,9 @@ JSValueRef function_raw_flush_stdout(JSContextRef ctx, JSObjectRef function, JSO
 JSValueRef function_raw_write_stderr(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
                                      size_t argc, const JSValueRef args[], JSValueRef *exception) {
     if (argc == 1 && JSValueGetType(ctx, args[0]) == kJSTypeString) {
+        if (config.buffered_stdout) {
+            fflush(stdout);
+        }
         char *s = value_to_c_string(ctx, args[0]);
         fprintf(stderr, "%s", s);
         free(s);
@@ -675,15 +665,41 @@ char *descriptor_int_to_str(descriptor_t i) {
     return rv;
 }
 
+JSValueRef function_stdin_reader_open(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                      size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    // Terminal input is read a character at a time by PLANCK_RAW_READ_STDIN instead, except when
+    // processing lines, where there is no REPL. Piped input to the REPL is read through stdio as
+    // well, since the REPL's own reads leave input in the stdio buffer.
+    if ((config.is_tty || config.repl) && !config.each_line) {
+        return JSValueMakeNull(ctx);
+    }
+
+    static descriptor_t descriptor = 0;
+    if (!descriptor) {
+        descriptor = ufile_open_stdin();
+        if (!descriptor) {
+            return JSValueMakeNull(ctx);
+        }
+    }
+
+    char *descriptor_str = descriptor_int_to_str(descriptor);
+    JSValueRef rv = c_string_to_value(ctx, descriptor_str);
+    free(descriptor_str);
+
+    return rv;
+}
+
 JSValueRef function_file_reader_open(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
                                      size_t argc, const JSValueRef args[], JSValueRef *exception) {
-    if (argc == 2
-        && JSValueGetType(ctx, args[0]) == kJSTypeString) {
+    if (argc == 3
+        && JSValueGetType(ctx, args[0]) == kJSTypeString
+        && JSValueGetType(ctx, args[2]) == kJSTypeBoolean) {
 
         char *path = value_to_c_string(ctx, args[0]);
         char *encoding = value_to_c_string(ctx, args[1]);
+        bool gzip = JSValueToBoolean(ctx, args[2]);
 
-        descriptor_t descriptor = ufile_open_read(path, encoding);
+        descriptor_t descriptor = ufile_open_read(path, encoding, gzip);
 
         free(path);
         free(encoding);
@@ -723,13 +739,100 @@ JSValueRef function_file_reader_read(JSContextRef ctx, JSObjectRef function, JSO
     return JSValueMakeNull(ctx);
 }
 
+JSValueRef function_file_slurp(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                               size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 2
+        && JSValueGetType(ctx, args[0]) == kJSTypeString
+        && JSValueGetType(ctx, args[1]) == kJSTypeString) {
+
+        char *path = value_to_c_string(ctx, args[0]);
+        char *encoding = value_to_c_string(ctx, args[1]);
+
+        JSStringRef result = file_slurp(path, encoding);
+
+        free(path);
+        free(encoding);
+
+        if (result != NULL) {
+            JSValueRef rv = JSValueMakeString(ctx, result);
+            JSStringRelease(result);
+            return rv;
+        }
+    }
+
+    return JSValueMakeNull(ctx);
+}
+
+JSValueRef function_file_reader_read_line(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                          size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 1
+        && JSValueGetType(ctx, args[0]) == kJSTypeString) {
+
+        char *descriptor = value_to_c_string(ctx, args[0]);
+
+        JSStringRef result = ufile_read_line(descriptor_str_to_int(descriptor));
+
+        free(descriptor);
+
+        if (result != NULL) {
+            JSValueRef rv = JSValueMakeString(ctx, result);
+            JSStringRelease(result);
+            return rv;
+        }
+    }
+
+    return JSValueMakeNull(ctx);
+}
+
+JSValueRef function_file_reader_read_lines(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                           size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 2
+        && JSValueGetType(ctx, args[0]) == kJSTypeString
+        && JSValueGetType(ctx, args[1]) == kJSTypeNumber) {
+
+        char *descriptor_str = value_to_c_string(ctx, args[0]);
+        descriptor_t descriptor = descriptor_str_to_int(descriptor_str);
+        free(descriptor_str);
+
+        size_t max_lines = (size_t) JSValueToNumber(ctx, args[1], NULL);
+        if (max_lines == 0) {
+            max_lines = 1;
+        }
+
+        JSStringRef line = ufile_read_line(descriptor);
+        if (line == NULL) {
+            return JSValueMakeNull(ctx);
+        }
+
+        JSValueRef *lines = malloc(max_lines * sizeof(JSValueRef));
+        if (!lines) {
+            JSStringRelease(line);
+            *exception = make_error_with_errno(ctx);
+            return JSValueMakeNull(ctx);
+        }
+
+        // Only wait for the first line, so that lines are handed over as soon as they arrive
+        size_t count = 0;
+        do {
+            lines[count++] = JSValueMakeString(ctx, line);
+            JSStringRelease(line);
+        } while (count < max_lines && (line = ufile_read_buffered_line(descriptor)) != NULL);
+
+        JSValueRef rv = JSObjectMakeArray(ctx, count, lines, NULL);
+        free(lines);
+        return rv;
+    }
+
+    return JSValueMakeNull(ctx);
+}
+
 JSValueRef function_file_reader_close(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
                                       size_t argc, const JSValueRef args[], JSValueRef *exception) {
     if (argc == 1
         && JSValueGetType(ctx, args[0]) == kJSTypeString) {
 
         char *descriptor = value_to_c_string(ctx, args[0]);
-        ufile_close(descriptor_str_to_int(descriptor));
+        ufile_close_read(descriptor_str_to_int(descriptor));
         free(descriptor);
     }
     return JSValueMakeNull(ctx);
@@ -737,15 +840,18 @@ JSValueRef function_file_reader_close(JSContextRef ctx, JSObjectRef function, JS
 
 JSValueRef function_file_writer_open(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
                                      size_t argc, const JSValueRef args[], JSValueRef *exception) {
-    if (argc == 3
+    if (argc == 4
         && JSValueGetType(ctx, args[0]) == kJSTypeString
-        && JSValueGetType(ctx, args[1]) == kJSTypeBoolean) {
+        && JSValueGetType(ctx, args[1]) == kJSTypeBoolean
+        && JSValueGetType(ctx, args[3]) == kJSTypeBoolean) {
 
         char *path = value_to_c_string(ctx, args[0]);
         bool append = JSValueToBoolean(ctx, args[1]);
         char *encoding = value_to_c_string(ctx, args[2]);
+        bool gzip = JSValueToBoolean(ctx, args[3]);
 
-        uint64_t descriptor = ufile_open_write(path, append, encoding);
+        uint64_t descriptor = ufile_open_write(path, append, encoding, gzip);
+        dir_cache_invalidate();
 
         free(path);
         free(encoding);
@@ -804,12 +910,14 @@ JSValueRef function_file_writer_close(JSContextRef ctx, JSObjectRef function, JS
 
 JSValueRef function_file_input_stream_open(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
                                            size_t argc, const JSValueRef args[], JSValueRef *exception) {
-    if (argc == 1
-        && JSValueGetType(ctx, args[0]) == kJSTypeString) {
+    if (argc == 2
+        && JSValueGetType(ctx, args[0]) == kJSTypeString
+        && JSValueGetType(ctx, args[1]) == kJSTypeBoolean) {
 
         char *path = value_to_c_string(ctx, args[0]);
+        bool gzip = JSValueToBoolean(ctx, args[1]);
 
-        uint64_t descriptor = file_open_read(path);
+        uint64_t descriptor = file_open_read(path, gzip);
 
         free(path);
 
@@ -823,42 +931,38 @@ JSValueRef function_file_input_stream_open(JSContextRef ctx, JSObjectRef functio
     return JSValueMakeNull(ctx);
 }
 
+#define FILE_INPUT_STREAM_BUF_SIZE (64 * 1024)
+
 JSValueRef function_file_input_stream_read(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
                                            size_t argc, const JSValueRef args[], JSValueRef *exception) {
-
-    static JSValueRef *charmap = NULL;
-    if (!charmap) {
-        charmap = malloc(256 * sizeof (JSValueRef));
-        int i;
-        for (i = 0; i < 256; i++) {
-            charmap[i] = JSValueMakeNumber(ctx, i);
-            JSValueProtect(ctx, charmap[i]);
-        }
-    }
-
     if (argc == 1
         && JSValueGetType(ctx, args[0]) == kJSTypeString) {
 
         char *descriptor = value_to_c_string(ctx, args[0]);
 
-        size_t buf_size = 4096;
-        uint8_t *buf = malloc(buf_size * sizeof(uint8_t));
+        uint8_t *buf = malloc(FILE_INPUT_STREAM_BUF_SIZE * sizeof(uint8_t));
+        if (!buf) {
+            free(descriptor);
+            *exception = make_error_with_errno(ctx);
+            return JSValueMakeNull(ctx);
+        }
 
-        size_t read = file_read(descriptor_str_to_int(descriptor), buf_size, buf);
+        size_t read = file_read(descriptor_str_to_int(descriptor), FILE_INPUT_STREAM_BUF_SIZE, buf);
 
         free(descriptor);
 
         if (read) {
             // TODO distinguish between eof and error down in fread call and throw if errro
-            JSValueRef arguments[read];
-            int num_arguments = (int) read;
-            int i;
-            for (i = 0; i < num_arguments; i++) {
-                arguments[i] = charmap[buf[i]];
+            if (read < FILE_INPUT_STREAM_BUF_SIZE / 2) {
+                uint8_t *shrunk = realloc(buf, read);
+                if (shrunk) {
+                    buf = shrunk;
+                }
             }
-
-            return JSObjectMakeArray(ctx, num_arguments, arguments, NULL);
+            return make_uint8_array(ctx, buf, read);
         }
+
+        free(buf);
     }
 
     return JSValueMakeNull(ctx);
@@ -878,14 +982,17 @@ JSValueRef function_file_input_stream_close(JSContextRef ctx, JSObjectRef functi
 
 JSValueRef function_file_output_stream_open(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
                                             size_t argc, const JSValueRef args[], JSValueRef *exception) {
-    if (argc == 2
+    if (argc == 3
         && JSValueGetType(ctx, args[0]) == kJSTypeString
-        && JSValueGetType(ctx, args[1]) == kJSTypeBoolean) {
+        && JSValueGetType(ctx, args[1]) == kJSTypeBoolean
+        && JSValueGetType(ctx, args[2]) == kJSTypeBoolean) {
 
         char *path = value_to_c_string(ctx, args[0]);
         bool append = JSValueToBoolean(ctx, args[1]);
+        bool gzip = JSValueToBoolean(ctx, args[2]);
 
-        uint64_t descriptor = file_open_write(path, append);
+        uint64_t descriptor = file_open_write(path, append, gzip);
+        dir_cache_invalidate();
 
         free(path);
 
@@ -907,10 +1014,19 @@ JSValueRef function_file_output_stream_write(JSContextRef ctx, JSObjectRef funct
 
         char *descriptor = value_to_c_string(ctx, args[0]);
 
+        uint8_t *bytes;
+        size_t length;
+        if (get_bytes(ctx, args[1], &bytes, &length)) {
+            file_write(descriptor_str_to_int(descriptor), length, bytes);
+            free(descriptor);
+            return JSValueMakeNull(ctx);
+        }
+
         unsigned int count = (unsigned int) array_get_count(ctx, (JSObjectRef) args[1]);
 
         uint8_t* buf = malloc(sizeof(uint8_t) * count);
         if (!buf) {
+            free(descriptor);
             *exception = make_error_with_errno(ctx);
             return JSValueMakeNull(ctx);
         }
@@ -963,12 +1079,32 @@ JSValueRef function_file_output_stream_close(JSContextRef ctx, JSObjectRef funct
     return JSValueMakeNull(ctx);
 }
 
+JSValueRef function_file_stream_copy(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                     size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 2
+        && JSValueGetType(ctx, args[0]) == kJSTypeString
+        && JSValueGetType(ctx, args[1]) == kJSTypeString) {
+
+        char *from = value_to_c_string(ctx, args[0]);
+        char *to = value_to_c_string(ctx, args[1]);
+
+        if (file_copy(descriptor_str_to_int(from), descriptor_str_to_int(to)) == -1) {
+            *exception = make_error_with_errno(ctx);
+        }
+
+        free(from);
+        free(to);
+    }
+    return JSValueMakeNull(ctx);
+}
+
 JSValueRef function_mkdirs(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
                            size_t argc, const JSValueRef args[], JSValueRef *exception) {
     if (argc == 1
         && JSValueGetType(ctx, args[0]) == kJSTypeString) {
         char *path = value_to_c_string(ctx, args[0]);
         int rv = mkdir_parents(path);
+        dir_cache_invalidate();
         free(path);
         
         if (rv == -1) {
@@ -985,6 +1121,7 @@ JSValueRef function_delete_file(JSContextRef ctx, JSObjectRef function, JSObject
 
         char *path = value_to_c_string(ctx, args[0]);
         remove(path);
+        dir_cache_invalidate();
         free(path);
     }
     return JSValueMakeNull(ctx);
@@ -1000,6 +1137,7 @@ JSValueRef function_copy_file(JSContextRef ctx, JSObjectRef function, JSObjectRe
         char *dst = value_to_c_string(ctx, args[1]);
 
         int rv = copy_file(src, dst);
+        dir_cache_invalidate();
         if (rv) {
             *exception = make_error_with_errno(ctx);
         }
@@ -1010,6 +1148,69 @@ JSValueRef function_copy_file(JSContextRef ctx, JSObjectRef function, JSObjectRe
     return JSValueMakeNull(ctx);
 }
 
+JSValueRef function_read_file_async(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                    size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 3
+        && JSValueGetType(ctx, args[0]) == kJSTypeString
+        && JSValueGetType(ctx, args[2]) == kJSTypeNumber) {
+
+        char *path = value_to_c_string(ctx, args[0]);
+        char *encoding = JSValueIsNull(ctx, args[1]) ? NULL : value_to_c_string(ctx, args[1]);
+        int cb_idx = (int) JSValueToNumber(ctx, args[2], NULL);
+
+        async_io_read(path, encoding, cb_idx);
+    }
+    return JSValueMakeNull(ctx);
+}
+
+JSValueRef function_write_file_async(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                     size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 5
+        && JSValueGetType(ctx, args[0]) == kJSTypeString
+        && JSValueGetType(ctx, args[2]) == kJSTypeBoolean
+        && JSValueGetType(ctx, args[4]) == kJSTypeNumber) {
+
+        bool append = JSValueToBoolean(ctx, args[2]);
+        int cb_idx = (int) JSValueToNumber(ctx, args[4], NULL);
+
+        if (JSValueGetType(ctx, args[1]) == kJSTypeString
+            && JSValueGetType(ctx, args[3]) == kJSTypeString) {
+            async_io_write_text(value_to_c_string(ctx, args[0]), append, value_to_c_string(ctx, args[3]),
+                                JSValueToStringCopy(ctx, args[1], NULL), cb_idx);
+            return JSValueMakeNull(ctx);
+        }
+
+        uint8_t *bytes;
+        size_t length;
+        if (get_bytes(ctx, args[1], &bytes, &length)) {
+            // The worker needs its own copy, as the array may be collected or modified
+            uint8_t *copy = malloc(length ? length : 1);
+            if (!copy) {
+                *exception = make_error_with_errno(ctx);
+                return JSValueMakeNull(ctx);
+            }
+            memcpy(copy, bytes, length);
+            async_io_write_bytes(value_to_c_string(ctx, args[0]), append, copy, length, cb_idx);
+            return JSValueMakeNull(ctx);
+        }
+    }
+    *exception = make_error_with_message(ctx, strdup("Unsupported content for asynchronous write"));
+    return JSValueMakeNull(ctx);
+}
+
+JSValueRef function_copy_file_async(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                    size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 3
+        && JSValueGetType(ctx, args[0]) == kJSTypeString
+        && JSValueGetType(ctx, args[1]) == kJSTypeString
+        && JSValueGetType(ctx, args[2]) == kJSTypeNumber) {
+
+        async_io_copy(value_to_c_string(ctx, args[0]), value_to_c_string(ctx, args[1]),
+                      (int) JSValueToNumber(ctx, args[2], NULL));
+    }
+    return JSValueMakeNull(ctx);
+}
+
 JSValueRef function_list_files(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
                                size_t argc, const JSValueRef args[], JSValueRef *exception) {
     if (argc == 1
@@ -1105,6 +1306,7 @@ JSValueRef function_mktemp(JSContextRef ctx, JSObjectRef function, JSObjectRef t
 
         free(suffix);
         free(prefix);
+        dir_cache_invalidate();
 
         if (temp_name) {
             return c_string_to_value(ctx, temp_name);
@@ -1141,6 +1343,76 @@ JSValueRef function_is_directory(JSContextRef ctx, JSObjectRef function, JSObjec
     return JSValueMakeNull(ctx);
 }
 
+static void set_attribute(JSContextRef ctx, JSObjectRef object, const char *name, JSValueRef value) {
+    JSStringRef name_str = JSStringCreateWithUTF8CString(name);
+    JSObjectSetProperty(ctx, object, name_str, value, kJSPropertyAttributeReadOnly, NULL);
+    JSStringRelease(name_str);
+}
+
+static JSObjectRef stat_to_object(JSContextRef ctx, struct stat *file_stat) {
+    JSObjectRef result = JSObjectMake(ctx, NULL, NULL);
+
+    char *type = "unknown";
+    if (S_ISDIR(file_stat->st_mode)) {
+        type = "directory";
+    } else if (S_ISREG(file_stat->st_mode)) {
+        type = "file";
+    } else if (S_ISLNK(file_stat->st_mode)) {
+        type = "symbolic-link";
+    } else if (S_ISSOCK(file_stat->st_mode)) {
+        type = "socket";
+    } else if (S_ISFIFO(file_stat->st_mode)) {
+        type = "fifo";
+    } else if (S_ISCHR(file_stat->st_mode)) {
+        type = "character-special";
+    } else if (S_ISBLK(file_stat->st_mode)) {
+        type = "block-special";
+    }
+
+    set_attribute(ctx, result, "type", c_string_to_value(ctx, type));
+
+    double device_id = (double) file_stat->st_rdev;
+    if (device_id) {
+        set_attribute(ctx, result, "device-id", JSValueMakeNumber(ctx, device_id));
+    }
+
+    double file_number = (double) file_stat->st_ino;
+    if (file_number) {
+        set_attribute(ctx, result, "file-number", JSValueMakeNumber(ctx, file_number));
+    }
+
+    set_attribute(ctx, result, "permissions", JSValueMakeNumber(ctx, (double) (ACCESSPERMS & file_stat->st_mode)));
+    set_attribute(ctx, result, "reference-count", JSValueMakeNumber(ctx, (double) file_stat->st_nlink));
+    set_attribute(ctx, result, "uid", JSValueMakeNumber(ctx, (double) file_stat->st_uid));
+
+    struct passwd *uid_passwd = getpwuid(file_stat->st_uid);
+
+    if (uid_passwd) {
+        set_attribute(ctx, result, "uname", c_string_to_value(ctx, uid_passwd->pw_name));
+    }
+
+    set_attribute(ctx, result, "gid", JSValueMakeNumber(ctx, (double) file_stat->st_gid));
+
+    struct group *gid_group = getgrgid(file_stat->st_gid);
+
+    if (gid_group) {
+        set_attribute(ctx, result, "gname", c_string_to_value(ctx, gid_group->gr_name));
+    }
+
+    set_attribute(ctx, result, "file-size", JSValueMakeNumber(ctx, (double) file_stat->st_size));
+
+#ifdef __APPLE__
+#define birthtime(x) x->st_birthtime
+#else
+#define birthtime(x) x->st_ctime
+#endif
+
+    set_attribute(ctx, result, "created", JSValueMakeNumber(ctx, 1000 * birthtime(file_stat)));
+    set_attribute(ctx, result, "modified", JSValueMakeNumber(ctx, 1000 * file_stat->st_mtime));
+
+    return result;
+}
+
 JSValueRef function_fstat(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
                           size_t argc, const JSValueRef args[], JSValueRef *exception) {
     if (argc == 1
@@ -1152,99 +1424,301 @@ JSValueRef function_fstat(JSContextRef ctx, JSObjectRef function, JSObjectRef th
 
         int retval = lstat(path, &file_stat);
 
+        free(path);
+
         if (retval == 0) {
-            JSObjectRef result = JSObjectMake(ctx, NULL, NULL);
+            return stat_to_object(ctx, &file_stat);
+        }
+    }
+    return JSValueMakeNull(ctx);
+}
 
-            char *type = "unknown";
-            if (S_ISDIR(file_stat.st_mode)) {
-                type = "directory";
-            } else if (S_ISREG(file_stat.st_mode)) {
-                type = "file";
-            } else if (S_ISLNK(file_stat.st_mode)) {
-                type = "symbolic-link";
-            } else if (S_ISSOCK(file_stat.st_mode)) {
-                type = "socket";
-            } else if (S_ISFIFO(file_stat.st_mode)) {
-                type = "fifo";
-            } else if (S_ISCHR(file_stat.st_mode)) {
-                type = "character-special";
-            } else if (S_ISBLK(file_stat.st_mode)) {
-                type = "block-special";
-            }
+static void finalize_walk(JSObjectRef object) {
+    walk_t *walk = JSObjectGetPrivate(object);
+    if (walk) {
+        walk_close(walk);
+    }
+}
 
-            JSObjectSetProperty(ctx, result, JSStringCreateWithUTF8CString("type"),
-                                c_string_to_value(ctx, type),
-                                kJSPropertyAttributeReadOnly, NULL);
+JSValueRef function_walk_open(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                              size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 6
+        && JSValueGetType(ctx, args[0]) == kJSTypeString
+        && JSValueGetType(ctx, args[1]) == kJSTypeNumber
+        && JSValueGetType(ctx, args[2]) == kJSTypeBoolean
+        && JSValueGetType(ctx, args[5]) == kJSTypeBoolean) {
 
+        char *root = value_to_c_string(ctx, args[0]);
+        char *glob = JSValueGetType(ctx, args[3]) == kJSTypeString ? value_to_c_string(ctx, args[3]) : NULL;
+        char *regex = JSValueGetType(ctx, args[4]) == kJSTypeString ? value_to_c_string(ctx, args[4]) : NULL;
 
-            double device_id = (double) file_stat.st_rdev;
-            if (device_id) {
-                JSObjectSetProperty(ctx, result, JSStringCreateWithUTF8CString("device-id"),
-                                    JSValueMakeNumber(ctx, device_id),
-                                    kJSPropertyAttributeReadOnly, NULL);
-            }
+        walk_options_t options;
+        options.max_depth = (int) JSValueToNumber(ctx, args[1], NULL);
+        options.follow_links = JSValueToBoolean(ctx, args[2]);
+        options.glob = glob;
+        options.regex = regex;
+        options.attributes = JSValueToBoolean(ctx, args[5]);
 
-            double file_number = (double) file_stat.st_ino;
-            if (file_number) {
-                JSObjectSetProperty(ctx, result, JSStringCreateWithUTF8CString("file-number"),
-                                    JSValueMakeNumber(ctx, file_number),
-                                    kJSPropertyAttributeReadOnly, NULL);
+        char *error_msg = NULL;
+        walk_t *walk = walk_open(root, &options, &error_msg);
+
+        free(root);
+        free(glob);
+        free(regex);
+
+        if (!walk) {
+            if (error_msg) {
+                *exception = make_error_with_message(ctx, error_msg);
             }
+            return JSValueMakeNull(ctx);
+        }
+
+        // The walk is closed when the object is collected, so that abandoned walks don't hold
+        // directories open
+        static JSClassRef walk_class = NULL;
+        if (!walk_class) {
+            JSClassDefinition definition = kJSClassDefinitionEmpty;
+            definition.className = "Walk";
+            definition.finalize = finalize_walk;
+            walk_class = JSClassCreate(&definition);
+        }
 
-            JSObjectSetProperty(ctx, result, JSStringCreateWithUTF8CString("permissions"),
-                                JSValueMakeNumber(ctx, (double) (ACCESSPERMS & file_stat.st_mode)),
-                                kJSPropertyAttributeReadOnly, NULL);
+        return JSObjectMake(ctx, walk_class, walk);
+    }
+    return JSValueMakeNull(ctx);
+}
 
-            JSObjectSetProperty(ctx, result, JSStringCreateWithUTF8CString("reference-count"),
-                                JSValueMakeNumber(ctx, (double) file_stat.st_nlink),
-                                kJSPropertyAttributeReadOnly, NULL);
+JSValueRef function_walk_next(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                              size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 2
+        && JSValueGetType(ctx, args[0]) == kJSTypeObject
+        && JSValueGetType(ctx, args[1]) == kJSTypeNumber) {
 
-            JSObjectSetProperty(ctx, result, JSStringCreateWithUTF8CString("uid"),
-                                JSValueMakeNumber(ctx, (double) file_stat.st_uid),
-                                kJSPropertyAttributeReadOnly, NULL);
+        JSObjectRef walk_object = JSValueToObject(ctx, args[0], NULL);
+        walk_t *walk = JSObjectGetPrivate(walk_object);
+        if (!walk) {
+            return JSValueMakeNull(ctx);
+        }
 
-            struct passwd *uid_passwd = getpwuid(file_stat.st_uid);
+        size_t capacity = (size_t) JSValueToNumber(ctx, args[1], NULL);
+        if (capacity == 0) {
+            capacity = 1;
+        }
 
-            if (uid_passwd) {
-                JSObjectSetProperty(ctx, result, JSStringCreateWithUTF8CString("uname"),
-                                    c_string_to_value(ctx, uid_passwd->pw_name),
-                                    kJSPropertyAttributeReadOnly, NULL);
+        JSValueRef *entries = malloc(capacity * sizeof(JSValueRef));
+        size_t count = 0;
+
+        const char *path;
+        struct stat *file_stat = NULL;
+        while (count < capacity && (path = walk_next(walk, &file_stat)) != NULL) {
+            JSValueRef entry = c_string_to_value(ctx, path);
+            if (file_stat) {
+                JSObjectRef attributes = stat_to_object(ctx, file_stat);
+                set_attribute(ctx, attributes, "path", entry);
+                entry = attributes;
             }
+            JSValueProtect(ctx, entry);
+            entries[count++] = entry;
+        }
+
+        if (count < capacity) {
+            // Release the directory handles as soon as the walk is complete
+            walk_close(walk);
+            JSObjectSetPrivate(walk_object, NULL);
+        }
+
+        JSValueRef rv = count ? JSObjectMakeArray(ctx, count, entries, NULL) : JSValueMakeNull(ctx);
+
+        size_t i;
+        for (i = 0; i < count; i++) {
+            JSValueUnprotect(ctx, entries[i]);
+        }
+        free(entries);
 
-            JSObjectSetProperty(ctx, result, JSStringCreateWithUTF8CString("gid"),
-                                JSValueMakeNumber(ctx, (double) file_stat.st_gid),
-                                kJSPropertyAttributeReadOnly, NULL);
+        return rv;
+    }
+    return JSValueMakeNull(ctx);
+}
 
-            struct group *gid_group = getgrgid(file_stat.st_gid);
+static char **array_to_c_strings(JSContextRef ctx, JSObjectRef array, size_t count) {
+    char **strings = calloc(count ? count : 1, sizeof(char *));
+    size_t i;
+    for (i = 0; i < count; i++) {
+        JSValueRef value = array_get_value_at_index(ctx, array, (unsigned) i);
+        if (JSValueGetType(ctx, value) == kJSTypeString) {
+            strings[i] = value_to_c_string(ctx, value);
+        }
+    }
+    return strings;
+}
+
+static void free_c_strings(char **strings, size_t count) {
+    size_t i;
+    for (i = 0; i < count; i++) {
+        free(strings[i]);
+    }
+    free(strings);
+}
+
+JSValueRef function_watch(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                          size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 4
+        && JSValueGetType(ctx, args[0]) == kJSTypeObject
+        && JSValueGetType(ctx, args[1]) == kJSTypeBoolean
+        && JSValueGetType(ctx, args[2]) == kJSTypeNumber
+        && JSValueGetType(ctx, args[3]) == kJSTypeObject) {
+
+        JSObjectRef paths_array = JSValueToObject(ctx, args[0], NULL);
+        JSObjectRef callback = JSValueToObject(ctx, args[3], NULL);
+        if (!JSObjectIsFunction(ctx, callback)) {
+            return JSValueMakeNull(ctx);
+        }
+
+        size_t num_paths = (size_t) array_get_count(ctx, paths_array);
+        char **paths = array_to_c_strings(ctx, paths_array, num_paths);
+
+        int id = watch_start(paths, num_paths, JSValueToBoolean(ctx, args[1]),
+                             (int) JSValueToNumber(ctx, args[2], NULL), callback);
+
+        free_c_strings(paths, num_paths);
+
+        if (id == -1) {
+            *exception = make_error_with_errno(ctx);
+            return JSValueMakeNull(ctx);
+        }
+
+        return JSValueMakeNumber(ctx, id);
+    }
+    return JSValueMakeNull(ctx);
+}
+
+JSValueRef function_unwatch(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                            size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 1
+        && JSValueGetType(ctx, args[0]) == kJSTypeNumber) {
+        return JSValueMakeBoolean(ctx, watch_stop((int) JSValueToNumber(ctx, args[0], NULL)) == 0);
+    }
+    return JSValueMakeNull(ctx);
+}
+
+JSValueRef function_zip_entries(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 1
+        && JSValueGetType(ctx, args[0]) == kJSTypeString) {
 
-            if (gid_group) {
-                JSObjectSetProperty(ctx, result, JSStringCreateWithUTF8CString("gname"),
-                                    c_string_to_value(ctx, gid_group->gr_name),
-                                    kJSPropertyAttributeReadOnly, NULL);
+        char *path = value_to_c_string(ctx, args[0]);
+
+        archive_entry_t *entries;
+        size_t num_entries;
+        char *error_msg = NULL;
+        int rv = list_archive(path, &entries, &num_entries, &error_msg);
+        free(path);
+
+        if (rv != 0) {
+            *exception = make_error_with_message(ctx, error_msg);
+            return JSValueMakeNull(ctx);
+        }
+
+        JSValueRef *values = malloc((num_entries ? num_entries : 1) * sizeof(JSValueRef));
+        size_t i;
+        for (i = 0; i < num_entries; i++) {
+            archive_entry_t *entry = &entries[i];
+            JSObjectRef result = JSObjectMake(ctx, NULL, NULL);
+
+            set_attribute(ctx, result, "name", c_string_to_value(ctx, entry->name));
+            set_attribute(ctx, result, "size", JSValueMakeNumber(ctx, (double) entry->size));
+            set_attribute(ctx, result, "compressed-size", JSValueMakeNumber(ctx, (double) entry->compressed_size));
+            set_attribute(ctx, result, "modified", JSValueMakeNumber(ctx, 1000 * (double) entry->modified));
+            set_attribute(ctx, result, "crc", JSValueMakeNumber(ctx, (double) entry->crc));
+            set_attribute(ctx, result, "method", JSValueMakeNumber(ctx, (double) entry->method));
+
+            if (entry->mode) {
+                set_attribute(ctx, result, "permissions", JSValueMakeNumber(ctx, (double) (ACCESSPERMS & entry->mode)));
             }
 
-            JSObjectSetProperty(ctx, result, JSStringCreateWithUTF8CString("file-size"),
-                                JSValueMakeNumber(ctx, (double) file_stat.st_size),
-                                kJSPropertyAttributeReadOnly, NULL);
+            values[i] = result;
+        }
 
-#ifdef __APPLE__
-#define birthtime(x) x.st_birthtime
-#else
-#define birthtime(x) x.st_ctime
-#endif
+        JSObjectRef result = JSObjectMakeArray(ctx, num_entries, values, NULL);
+        free(values);
+        free_archive_entries(entries, num_entries);
+
+        return result;
+    }
+    return JSValueMakeNull(ctx);
+}
+
+JSValueRef function_zip_extract(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 4
+        && JSValueGetType(ctx, args[0]) == kJSTypeString
+        && JSValueGetType(ctx, args[1]) == kJSTypeString
+        && (JSValueGetType(ctx, args[2]) == kJSTypeObject || JSValueGetType(ctx, args[2]) == kJSTypeNull)
+        && JSValueGetType(ctx, args[3]) == kJSTypeNumber) {
+
+        char *path = value_to_c_string(ctx, args[0]);
+        char *dir = value_to_c_string(ctx, args[1]);
+
+        char **names = NULL;
+        size_t num_names = 0;
+        if (JSValueGetType(ctx, args[2]) == kJSTypeObject) {
+            JSObjectRef array = JSValueToObject(ctx, args[2], NULL);
+            num_names = (size_t) array_get_count(ctx, array);
+            names = array_to_c_strings(ctx, array, num_names);
+        }
+
+        int parallelism = (int) JSValueToNumber(ctx, args[3], NULL);
 
-            JSObjectSetProperty(ctx, result, JSStringCreateWithUTF8CString("created"),
-                                JSValueMakeNumber(ctx, 1000 * birthtime(file_stat)),
-                                kJSPropertyAttributeReadOnly, NULL);
+        char *error_msg = NULL;
+        int rv = extract_archive(path, dir, names, num_names, parallelism, &error_msg);
+        dir_cache_invalidate();
 
-            JSObjectSetProperty(ctx, result, JSStringCreateWithUTF8CString("modified"),
-                                JSValueMakeNumber(ctx, 1000 * file_stat.st_mtime),
-                                kJSPropertyAttributeReadOnly, NULL);
+        if (names) {
+            free_c_strings(names, num_names);
+        }
+        free(dir);
+        free(path);
+
+        if (rv != 0) {
+            *exception = make_error_with_message(ctx, error_msg);
+        }
+    }
+    return JSValueMakeNull(ctx);
+}
 
-            return result;
+JSValueRef function_zip_create(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                               size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 5
+        && JSValueGetType(ctx, args[0]) == kJSTypeString
+        && JSValueGetType(ctx, args[1]) == kJSTypeObject
+        && JSValueGetType(ctx, args[2]) == kJSTypeObject
+        && JSValueGetType(ctx, args[3]) == kJSTypeNumber
+        && JSValueGetType(ctx, args[4]) == kJSTypeNumber) {
+
+        JSObjectRef names_array = JSValueToObject(ctx, args[1], NULL);
+        JSObjectRef sources_array = JSValueToObject(ctx, args[2], NULL);
+        size_t num_entries = (size_t) array_get_count(ctx, names_array);
+        if (array_get_count(ctx, sources_array) != num_entries) {
+            return JSValueMakeNull(ctx);
         }
 
+        char *path = value_to_c_string(ctx, args[0]);
+        char **names = array_to_c_strings(ctx, names_array, num_entries);
+        char **sources = array_to_c_strings(ctx, sources_array, num_entries);
+        int level = (int) JSValueToNumber(ctx, args[3], NULL);
+        int parallelism = (int) JSValueToNumber(ctx, args[4], NULL);
+
+        char *error_msg = NULL;
+        int rv = create_archive(path, names, sources, num_entries, level, parallelism, &error_msg);
+        dir_cache_invalidate();
+
+        free_c_strings(sources, num_entries);
+        free_c_strings(names, num_entries);
         free(path);
+
+        if (rv != 0) {
+            *exception = make_error_with_message(ctx, error_msg);
+        }
     }
     return JSValueMakeNull(ctx);
 }
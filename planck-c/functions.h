@@ -1,3 +1,5 @@
+JSValueRef make_error_with_errno(JSContextRef ctx);
+
 JSValueRef function_console_stdout(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object, size_t argc,
                                    JSValueRef const *args, JSValueRef *exception);
 
@@ -12,6 +14,9 @@ JSValueRef
 function_load(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argc, const JSValueRef args[],
               JSValueRef *exception);
 
+JSValueRef function_load_js_lib(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                size_t argc, const JSValueRef args[], JSValueRef *exception);
+
 JSValueRef function_load_deps_cljs_files(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argc,
                                          const JSValueRef args[], JSValueRef *exception);
 
@@ -45,6 +50,9 @@ JSValueRef function_exit_with_value(JSContextRef ctx, JSObjectRef function, JSOb
 JSValueRef function_raw_read_stdin(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argc,
                                    const JSValueRef args[], JSValueRef *exception);
 
+JSValueRef function_stdin_reader_open(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argc,
+                                      const JSValueRef args[], JSValueRef *exception);
+
 JSValueRef function_raw_write_stdout(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argc,
                                      const JSValueRef args[], JSValueRef *exception);
 
@@ -66,6 +74,15 @@ JSValueRef function_file_reader_open(JSContextRef ctx, JSObjectRef function, JSO
 JSValueRef function_file_reader_read(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argc,
                                      const JSValueRef args[], JSValueRef *exception);
 
+JSValueRef function_file_slurp(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                               size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_file_reader_read_line(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                          size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_file_reader_read_lines(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argc,
+                                           const JSValueRef args[], JSValueRef *exception);
+
 JSValueRef function_file_reader_close(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argc,
                                       const JSValueRef args[], JSValueRef *exception);
 
@@ -105,6 +122,9 @@ JSValueRef
 function_file_output_stream_close(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argc,
                                   const JSValueRef args[], JSValueRef *exception);
 
+JSValueRef function_file_stream_copy(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                     size_t argc, const JSValueRef args[], JSValueRef *exception);
+
 JSValueRef function_mkdirs(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
                            size_t argc, const JSValueRef args[], JSValueRef *exception);
 
@@ -114,6 +134,15 @@ JSValueRef function_delete_file(JSContextRef ctx, JSObjectRef function, JSObject
 JSValueRef function_copy_file(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
                               size_t argc, const JSValueRef args[], JSValueRef *exception);
 
+JSValueRef function_read_file_async(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                    size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_write_file_async(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                     size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_copy_file_async(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                    size_t argc, const JSValueRef args[], JSValueRef *exception);
+
 JSValueRef function_list_files(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argc,
                                const JSValueRef args[], JSValueRef *exception);
 
@@ -127,6 +156,27 @@ JSValueRef
 function_fstat(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argc, const JSValueRef args[],
                JSValueRef *exception);
 
+JSValueRef function_walk_open(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                              size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_walk_next(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                              size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_watch(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                          size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_unwatch(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                            size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_zip_entries(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_zip_extract(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_zip_create(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                               size_t argc, const JSValueRef args[], JSValueRef *exception);
+
 JSValueRef function_read_password(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argc,
                                   const JSValueRef args[], JSValueRef *exception);
 
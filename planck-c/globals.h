@@ -30,8 +30,12 @@ struct config {
     char* optimizations;
     const char *theme;
     bool dumb_terminal;
+    bool buffered_stdout;
 
     char *main_ns_name;
+    bool each_line;
+    bool print_lines;
+    char *lines_body;
     size_t num_rest_args;
     char **rest_args;
 
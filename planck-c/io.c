@@ -7,8 +7,15 @@
 #endif
 #endif
 
+#ifdef __linux__
+// Define _GNU_SOURCE so that splice is defined
+#define _GNU_SOURCE
+#define PLANCK_USE_KERNEL_COPY 1
+#endif
 
 #include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,6 +31,13 @@
 #include "engine.h"
 #endif
 
+#ifdef PLANCK_USE_KERNEL_COPY
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#endif
+
 #define CHUNK_SIZE 1024
 
 char *read_all(FILE *f) {
@@ -88,6 +102,101 @@ char *get_contents(char *path, time_t *last_modified) {
     return NULL;
 }
 
+// Reads fd up to EOF, starting with a buffer sized for size bytes, and closes it.
+static uint8_t *read_fd(int fd, size_t size, size_t *length) {
+    // Read up to EOF rather than trusting the size, in case the file is growing
+    size_t capacity = size + 1;
+    uint8_t *buf = malloc(capacity);
+    size_t offset = 0;
+    while (buf) {
+        if (offset == capacity) {
+            capacity *= 2;
+            uint8_t *grown = realloc(buf, capacity);
+            if (!grown) {
+                free(buf);
+                buf = NULL;
+                break;
+            }
+            buf = grown;
+        }
+        ssize_t n = read(fd, buf + offset, capacity - offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            free(buf);
+            buf = NULL;
+        } else if (n == 0) {
+            break;
+        } else {
+            offset += n;
+        }
+    }
+
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+
+    if (buf) {
+        *length = offset;
+    }
+    return buf;
+}
+
+uint8_t *read_regular_file(const char *path, size_t *length) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat f_stat;
+    if (fstat(fd, &f_stat) < 0 || !S_ISREG(f_stat.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    return read_fd(fd, (size_t) f_stat.st_size, length);
+}
+
+uint8_t *read_file(const char *path, size_t *length) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat f_stat;
+    size_t size = 0;
+    if (fstat(fd, &f_stat) == 0 && S_ISREG(f_stat.st_mode)) {
+        size = (size_t) f_stat.st_size;
+    }
+
+    return read_fd(fd, size, length);
+}
+
+int write_file(const char *path, const uint8_t *bytes, size_t length, bool append) {
+    int fd = open(path, O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0666);
+    if (fd < 0) {
+        return -1;
+    }
+
+    while (length > 0) {
+        ssize_t n = write(fd, bytes, length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            int saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
+            return -1;
+        }
+        bytes += n;
+        length -= n;
+    }
+
+    return close(fd);
+}
+
 void write_contents(char *path, char *contents) {
     FILE *f = fopen(path, "w");
     if (f == NULL) {
@@ -157,26 +266,26 @@ int mkdir_parents(const char *path) {
     return 0;
 }
 
-int copy_file_loop(const char *from, const char *to) {
-    int fd_to, fd_from;
-    char buf[4096];
-    ssize_t nread;
-    int saved_errno;
+#define COPY_BUFFER_SIZE (128 * 1024)
 
-    fd_from = open(from, O_RDONLY);
-    if (fd_from < 0)
+static int copy_fd_loop(int fd_from, int fd_to) {
+    uint8_t *buf = malloc(COPY_BUFFER_SIZE);
+    if (!buf) {
         return -1;
+    }
 
-    fd_to = open(to, O_WRONLY | O_CREAT | O_EXCL, 0666);
-    if (fd_to < 0)
-        goto out_error;
-
-    while (nread = read(fd_from, buf, sizeof buf), nread > 0) {
-        char *out_ptr = buf;
-        ssize_t nwritten;
+    ssize_t nread;
+    while ((nread = read(fd_from, buf, COPY_BUFFER_SIZE)) != 0) {
+        if (nread < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            goto out_error;
+        }
 
+        uint8_t *out_ptr = buf;
         do {
-            nwritten = write(fd_to, out_ptr, (size_t) nread);
+            ssize_t nwritten = write(fd_to, out_ptr, (size_t) nread);
 
             if (nwritten >= 0) {
                 nread -= nwritten;
@@ -187,7 +296,109 @@ int copy_file_loop(const char *from, const char *to) {
         } while (nread > 0);
     }
 
-    if (nread == 0) {
+    free(buf);
+    return 0;
+
+    out_error:
+    {
+        int saved_errno = errno;
+        free(buf);
+        errno = saved_errno;
+    }
+    return -1;
+}
+
+#ifdef PLANCK_USE_KERNEL_COPY
+
+// Upper bound on each kernel copy call, which may copy less
+#define KERNEL_COPY_CHUNK_SIZE (1 << 30)
+
+typedef ssize_t (*kernel_copy_fn_t)(int fd_from, int fd_to, size_t length);
+
+static ssize_t copy_range(int fd_from, int fd_to, size_t length) {
+#ifdef __NR_copy_file_range
+    return syscall(__NR_copy_file_range, fd_from, NULL, fd_to, NULL, length, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static ssize_t copy_splice(int fd_from, int fd_to, size_t length) {
+    return splice(fd_from, NULL, fd_to, NULL, length, SPLICE_F_MOVE);
+}
+
+static ssize_t copy_sendfile(int fd_from, int fd_to, size_t length) {
+    return sendfile(fd_to, fd_from, NULL, length);
+}
+
+// Copies with copy_fn until end of file, returning 1 on success, or -1 with errno set on
+// failure. Returns 0 if nothing was copied because copy_fn doesn't support these descriptors,
+// or because it reports end of file straight away, as it does for some special files whose
+// size isn't known up front; in either case the next mechanism should be tried.
+static int kernel_copy(kernel_copy_fn_t copy_fn, int fd_from, int fd_to) {
+    bool copied = false;
+    for (;;) {
+        ssize_t n = copy_fn(fd_from, fd_to, KERNEL_COPY_CHUNK_SIZE);
+        if (n > 0) {
+            copied = true;
+        } else if (n == 0) {
+            return copied ? 1 : 0;
+        } else if (errno != EINTR) {
+            if (!copied && (errno == ENOSYS || errno == EINVAL || errno == EXDEV
+                            || errno == EOPNOTSUPP || errno == EBADF)) {
+                return 0;
+            }
+            return -1;
+        }
+    }
+}
+
+#endif
+
+int copy_fd(int fd_from, int fd_to) {
+#ifdef PLANCK_USE_KERNEL_COPY
+    struct stat from_stat, to_stat;
+    if (fstat(fd_from, &from_stat) == 0 && fstat(fd_to, &to_stat) == 0) {
+        int rv = 0;
+        if (S_ISREG(from_stat.st_mode) && S_ISREG(to_stat.st_mode)) {
+            rv = kernel_copy(copy_range, fd_from, fd_to);
+        }
+        if (rv == 0 && (S_ISFIFO(from_stat.st_mode) || S_ISFIFO(to_stat.st_mode))) {
+            rv = kernel_copy(copy_splice, fd_from, fd_to);
+        }
+        if (rv == 0 && S_ISREG(from_stat.st_mode)) {
+            rv = kernel_copy(copy_sendfile, fd_from, fd_to);
+        }
+        if (rv != 0) {
+            return rv == 1 ? 0 : -1;
+        }
+    }
+#endif
+    return copy_fd_loop(fd_from, fd_to);
+}
+
+int copy_file_loop(const char *from, const char *to) {
+    int fd_to, fd_from;
+    int saved_errno;
+
+    fd_from = open(from, O_RDONLY);
+    if (fd_from < 0)
+        return -1;
+
+    fd_to = open(to, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd_to < 0)
+        goto out_error;
+
+#ifdef FICLONE
+    // Share the source's extents on file systems that support reflinks
+    if (ioctl(fd_to, FICLONE, fd_from) == 0) {
+        close(fd_from);
+        return close(fd_to);
+    }
+#endif
+
+    if (copy_fd(fd_from, fd_to) == 0) {
         if (close(fd_to) < 0) {
             fd_to = -1;
             goto out_error;
@@ -1,13 +1,31 @@
+#include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 
 char *read_all(FILE *f);
 
 char *get_contents(char *path, time_t *last_modified);
 
+// Reads the whole of the regular file at path, returning NULL if it isn't a regular file or
+// can't be read.
+uint8_t *read_regular_file(const char *path, size_t *length);
+
+// Reads the whole of the file at path, which need not be a regular file, returning NULL with
+// errno set on failure.
+uint8_t *read_file(const char *path, size_t *length);
+
+// Writes length bytes to the file at path, returning -1 with errno set on failure.
+int write_file(const char *path, const uint8_t *bytes, size_t length, bool append);
+
 void write_contents(char *path, char *contents);
 
 int mkdir_p(char *path);
 
 int mkdir_parents(const char *path);
 
+// Copies from the current offset of fd_from to its end, writing at the current offset of fd_to.
+// Uses copy_file_range, splice, or sendfile where the kernel supports them for the descriptors,
+// and otherwise a read/write loop. Returns -1 with errno set on failure.
+int copy_fd(int fd_from, int fd_to);
+
 int copy_file(const char *from, const char *to);
\ No newline at end of file
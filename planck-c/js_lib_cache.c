@@ -0,0 +1,266 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <unicode/ustring.h>
+
+#include "archive.h"
+#include "bundle.h"
+#include "classpath.h"
+#include "dir_cache.h"
+#include "globals.h"
+#include "js_lib_cache.h"
+
+// A cached foreign lib starts with a text header naming the format and byte order, followed by
+// a line for each source path up to and including the JAR that supplied the lib, recording the
+// state of the classpath the lib was resolved against. A blank line ends the header, which is
+// padded to an even length, and the UTF-16 characters follow.
+
+#define JS_LIB_CACHE_MAGIC "planck-js-lib 1"
+
+static const char *byte_order() {
+    uint16_t probe = 1;
+    return *(uint8_t *) &probe ? "LE" : "BE";
+}
+
+static char *cache_file_path(const char *path) {
+    if (!config.cache_path) {
+        return NULL;
+    }
+
+    char file[PATH_MAX];
+    size_t len = (size_t) snprintf(file, PATH_MAX, "%s/", config.cache_path);
+    const char *p;
+    for (p = path; *p && len + 8 < PATH_MAX; p++) {
+        if (*p == '/') {
+            memcpy(file + len, "_SLASH_", 7);
+            len += 7;
+        } else {
+            file[len++] = *p;
+        }
+    }
+    if (*p || len + 7 >= PATH_MAX) {
+        return NULL;
+    }
+    strcpy(file + len, ".utf16");
+    return strdup(file);
+}
+
+// Describes source path i, or returns false if it can't be described.
+static bool describe_src_path(size_t i, char *buf, size_t buf_len) {
+    struct src_path *src_path = &config.src_paths[i];
+    if (src_path->blacklisted) {
+        return false;
+    }
+    if (strcmp(src_path->type, "jar") == 0) {
+        struct stat file_stat;
+        if (stat(src_path->path, &file_stat) != 0) {
+            return false;
+        }
+        snprintf(buf, buf_len, "jar %lld %lld %s", (long long) file_stat.st_mtime,
+                 (long long) file_stat.st_size, src_path->path);
+    } else {
+        snprintf(buf, buf_len, "%s 0 0 %s", src_path->type, src_path->path);
+    }
+    return true;
+}
+
+// Checks that a source path preceding the JAR still doesn't supply the lib.
+static bool is_shadowed_by(size_t i, const char *path) {
+    struct src_path *src_path = &config.src_paths[i];
+    if (strcmp(src_path->type, "src") != 0) {
+        return false;
+    }
+    if (!dir_cache_may_exist(src_path->path, path)) {
+        return false;
+    }
+    char full_path[PATH_MAX];
+    snprintf(full_path, PATH_MAX, "%s%s", src_path->path, path);
+    struct stat file_stat;
+    return stat(full_path, &file_stat) == 0;
+}
+
+static bool is_bundled(const char *path) {
+    if (is_developing()) {
+        return false;
+    }
+    char *contents = bundle_get_contents((char *) path);
+    free(contents);
+    return contents != NULL;
+}
+
+bool js_lib_cache_open(const char *path, js_lib_t *lib) {
+    char *file = cache_file_path(path);
+    if (!file) {
+        return false;
+    }
+
+    int fd = open(file, O_RDONLY);
+    free(file);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    size_t mapping_length = (size_t) file_stat.st_size;
+    void *mapping = mmap(NULL, mapping_length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    const char *start = mapping;
+    const char *end = start + mapping_length;
+    const char *line = start;
+    size_t line_num = 0;
+    bool valid = false;
+
+    for (;;) {
+        const char *newline = memchr(line, '\n', end - line);
+        if (!newline) {
+            break;
+        }
+        size_t line_len = newline - line;
+
+        if (line_num == 0) {
+            char expected[64];
+            snprintf(expected, sizeof(expected), "%s %s", JS_LIB_CACHE_MAGIC, byte_order());
+            if (line_len != strlen(expected) || memcmp(line, expected, line_len) != 0) {
+                break;
+            }
+        } else if (line_len == 0) {
+            // End of header; the last source path described must be the JAR
+            if (line_num < 2) {
+                break;
+            }
+            size_t offset = newline + 1 - start;
+            offset += offset % 2;
+            if (offset > mapping_length || (mapping_length - offset) % 2 != 0) {
+                break;
+            }
+            lib->chars = (const uint16_t *) (start + offset);
+            lib->length = (mapping_length - offset) / 2;
+            valid = !is_bundled(path);
+            break;
+        } else {
+            size_t i = line_num - 1;
+            char description[PATH_MAX + 64];
+            if (i >= config.num_src_paths
+                || !describe_src_path(i, description, sizeof(description))
+                || line_len != strlen(description)
+                || memcmp(line, description, line_len) != 0
+                || is_shadowed_by(i, path)) {
+                break;
+            }
+        }
+
+        line = newline + 1;
+        line_num++;
+    }
+
+    if (!valid) {
+        munmap(mapping, mapping_length);
+        return false;
+    }
+
+    lib->mapping = mapping;
+    lib->mapping_length = mapping_length;
+    return true;
+}
+
+void js_lib_cache_close(js_lib_t *lib) {
+    munmap(lib->mapping, lib->mapping_length);
+}
+
+static void write_cache_file(const char *path, const char *location, const uint16_t *chars, size_t length) {
+    size_t provider;
+    for (provider = 0; provider < config.num_src_paths; provider++) {
+        if (strcmp(config.src_paths[provider].path, location) == 0) {
+            break;
+        }
+    }
+    if (provider == config.num_src_paths) {
+        return;
+    }
+
+    char *file = cache_file_path(path);
+    if (!file) {
+        return;
+    }
+
+    char *tmp_path = malloc(strlen(file) + 8);
+    sprintf(tmp_path, "%s.XXXXXX", file);
+    int fd = mkstemp(tmp_path);
+    FILE *f = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (!f) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp_path);
+        }
+        goto free_paths;
+    }
+
+    long header_length = fprintf(f, "%s %s\n", JS_LIB_CACHE_MAGIC, byte_order());
+
+    size_t i;
+    bool ok = true;
+    for (i = 0; ok && i <= provider; i++) {
+        char description[PATH_MAX + 64];
+        ok = describe_src_path(i, description, sizeof(description));
+        if (ok) {
+            header_length += fprintf(f, "%s\n", description);
+        }
+    }
+    header_length += fprintf(f, header_length % 2 ? "\n" : "\n\n");
+
+    if (ok) {
+        ok = fwrite(chars, sizeof(uint16_t), length, f) == length;
+    }
+
+    if (fclose(f) != 0) {
+        ok = false;
+    }
+
+    if (ok) {
+        rename(tmp_path, file);
+    } else {
+        unlink(tmp_path);
+    }
+
+    free_paths:
+    free(tmp_path);
+    free(file);
+}
+
+uint16_t *js_lib_cache_store(const char *path, const char *location, const char *contents, size_t *length) {
+    size_t contents_length = strlen(contents);
+    UChar *chars = malloc((contents_length + 1) * sizeof(UChar));
+    if (!chars) {
+        return NULL;
+    }
+
+    int32_t chars_length = 0;
+    UErrorCode status = U_ZERO_ERROR;
+    u_strFromUTF8WithSub(chars, (int32_t) contents_length + 1, &chars_length, contents, (int32_t) contents_length,
+                         0xFFFD, NULL, &status);
+    if (U_FAILURE(status)) {
+        free(chars);
+        return NULL;
+    }
+
+    *length = (size_t) chars_length;
+    write_cache_file(path, location, (uint16_t *) chars, *length);
+
+    return (uint16_t *) chars;
+}
@@ -0,0 +1,22 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Caches foreign libs loaded from JARs in the compilation cache, stored as UTF-16 so that
+// later runs can map the cached file and hand it to JavaScriptCore without inflating or
+// decoding anything.
+
+typedef struct js_lib {
+    const uint16_t *chars;
+    size_t length;
+    void *mapping;
+    size_t mapping_length;
+} js_lib_t;
+
+// Maps the cached copy of the foreign lib at path, returning false if there is no valid copy.
+bool js_lib_cache_open(const char *path, js_lib_t *lib);
+void js_lib_cache_close(js_lib_t *lib);
+
+// Converts contents, loaded for path from the JAR at location, to UTF-16 and writes it to the
+// cache. Returns the converted characters, which the caller frees, or NULL if conversion fails.
+uint16_t *js_lib_cache_store(const char *path, const char *location, const char *contents, size_t *length);
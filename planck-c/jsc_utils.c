@@ -130,3 +130,34 @@ int array_get_count(JSContextRef ctx, JSObjectRef arr) {
     JSStringRelease(pname);
     return (int) JSValueToNumber(ctx, val, NULL);
 }
+
+static void free_bytes(void *bytes, void *deallocator_context) {
+    free(bytes);
+}
+
+JSObjectRef make_uint8_array(JSContextRef ctx, uint8_t *bytes, size_t length) {
+    return JSObjectMakeTypedArrayWithBytesNoCopy(ctx, kJSTypedArrayTypeUint8Array, bytes, length, free_bytes, NULL,
+                                                 NULL);
+}
+
+bool get_bytes(JSContextRef ctx, JSValueRef val, uint8_t **bytes, size_t *length) {
+    if (!JSValueIsObject(ctx, val)) {
+        return false;
+    }
+
+    JSObjectRef obj = JSValueToObject(ctx, val, NULL);
+    switch (JSValueGetTypedArrayType(ctx, val, NULL)) {
+        case kJSTypedArrayTypeNone:
+            return false;
+        case kJSTypedArrayTypeArrayBuffer:
+            *bytes = JSObjectGetArrayBufferBytesPtr(ctx, obj, NULL);
+            *length = JSObjectGetArrayBufferByteLength(ctx, obj, NULL);
+            return true;
+        default:
+            // The bytes pointer is to the start of the backing buffer, not the view
+            *bytes = (uint8_t *) JSObjectGetTypedArrayBytesPtr(ctx, obj, NULL)
+                     + JSObjectGetTypedArrayByteOffset(ctx, obj, NULL);
+            *length = JSObjectGetTypedArrayByteLength(ctx, obj, NULL);
+            return true;
+    }
+}
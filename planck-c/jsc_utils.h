@@ -1,3 +1,6 @@
+#include <stdbool.h>
+#include <stdint.h>
+
 #include <JavaScriptCore/JavaScript.h>
 
 JSStringRef to_string(JSContextRef ctx, JSValueRef val);
@@ -21,3 +24,10 @@ JSValueRef c_string_to_value(JSContextRef ctx, const char *s);
 int array_get_count(JSContextRef ctx, JSObjectRef arr);
 
 #define array_get_value_at_index(ctx, array, i) JSObjectGetPropertyAtIndex(ctx, array, i, NULL)
+
+// Makes a Uint8Array backed by bytes, which it takes ownership of and frees when collected.
+JSObjectRef make_uint8_array(JSContextRef ctx, uint8_t *bytes, size_t length);
+
+// Gets the backing store of a typed array or ArrayBuffer without copying, returning false if
+// val is neither. The bytes are only valid until control returns to JavaScript.
+bool get_bytes(JSContextRef ctx, JSValueRef val, uint8_t **bytes, size_t *length);
@@ -14,6 +14,7 @@
 #endif
 
 #include "bundle.h"
+#include "deps.h"
 #include "engine.h"
 #include "globals.h"
 #include "io.h"
@@ -57,6 +58,8 @@ void usage(char *program_name) {
     "                                look for in the local Maven repository.\n"
     "                                Dependencies should be specified in the form\n"
     "                                SYM:VERSION (e.g.: foo/bar:1.2.3).\n"
+    "                                Transitive dependencies are resolved using\n"
+    "                                the POMs in the local repository.\n"
     "    -L path, --local-repo path  Path to the local Maven repository where Planck\n"
     "                                will look for dependencies. Defaults to\n"
     "                                ~/.m2/repository.\n"
@@ -76,6 +79,10 @@ void usage(char *program_name) {
     "    -A x, --checked-arrays x    Enables checked arrays where x is either warn\n"
     "                                or error.\n"
     "    -a, --elide-asserts         Set *assert* to false to remove asserts\n"
+    "    -N, --each-line             Evaluate the last -e expression for each line\n"
+    "                                of standard input, with the line bound to\n"
+    "                                line, instead of as an init option\n"
+    "    -P, --print-lines           Like -N, printing each non-nil result\n"
     "\n"
     "  main options:\n"
     "    -m ns-name, --main ns-name Call the -main function from a namespace with\n"
@@ -150,55 +157,6 @@ char *get_current_working_dir() {
     return NULL;
 }
 
-char *calculate_dependencies_classpath(char *dependencies, char *local_repo) {
-
-    char *paths[1024] = { 0 };
-    size_t ndx = 0;
-
-    char *saveptr = NULL;
-    char *dependency = strtok_r(dependencies, ",", &saveptr);
-    while (dependency != NULL) {
-        char *saveptr2 = NULL;
-        char *sym = strtok_r(dependency, ":", &saveptr2);
-        char *version = strtok_r(NULL, ":", &saveptr2);
-
-        char *saveptr3 = NULL;
-        char *group = strtok_r(sym, "/", &saveptr3);
-        char *p = group;
-        while (*p) {
-            if (*p == '.') {
-                *p = '/';
-            }
-            p++;
-        }
-        char *artifact = strtok_r(NULL, "/", &saveptr3);
-        if (artifact == NULL) {
-            artifact = group;
-        }
-
-        char path[PATH_MAX];
-        sprintf(path, "%s/%s/%s/%s/%s-%s.jar", local_repo, group, artifact, version, artifact, version);
-
-        paths[ndx++] = strdup(path);
-
-        dependency = strtok_r(NULL, ",", &saveptr);
-    }
-
-    char *result = "";
-
-    size_t n = 0;
-    for (;;) {
-        result = str_concat(result, paths[n]);
-        if (++n < ndx) {
-            result = str_concat(result, ":");
-        } else {
-            break;
-        }
-    }
-
-    return result;
-}
-
 void init_classpath(char *classpath) {
 
     char *cwd = get_current_working_dir();
@@ -349,6 +307,8 @@ char** expand_medium_opts(int argc, char **argv) {
     return rv;
 }
 
+#define STDOUT_BUFFER_SIZE (256 * 1024)
+
 int main(int argc, char **argv) {
 
     control_FTL_JIT();
@@ -401,6 +361,9 @@ int main(int argc, char **argv) {
     config.scripts = NULL;
 
     config.main_ns_name = NULL;
+    config.each_line = false;
+    config.print_lines = false;
+    config.lines_body = NULL;
 
     config.socket_repl_port = 0;
     config.socket_repl_host = NULL;
@@ -439,6 +402,8 @@ int main(int argc, char **argv) {
             {"init",             required_argument, NULL, 'i'},
             {"main",             required_argument, NULL, 'm'},
             {"compile-opts",     required_argument, NULL, '\1'},
+            {"each-line",        no_argument,       NULL, 'N'},
+            {"print-lines",      no_argument,       NULL, 'P'},
 
             // development options
             {"javascript",       no_argument,       NULL, 'j'},
@@ -452,7 +417,7 @@ int main(int argc, char **argv) {
     // pass index_of_script_path_or_hyphen instead of argc to guarantee that everything
     // after a bare dash "-" or a script path gets passed as *command-line-args*
     while (!did_encounter_main_opt &&
-           (opt = getopt_long(index_of_script_path_or_hyphen, argv, "O:Xh?VS:D:L:\1:lvrA:sfak:je:t:n:dc:o:Ki:qm:", long_options, &option_index)) != -1) {
+           (opt = getopt_long(index_of_script_path_or_hyphen, argv, "O:Xh?VS:D:L:\1:lvrA:sfak:je:t:n:dc:o:Ki:qm:NP", long_options, &option_index)) != -1) {
         switch (opt) {
             case '\1':
                 process_compile_opts(optarg);
@@ -569,6 +534,13 @@ int main(int argc, char **argv) {
             case 'd':
                 config.dumb_terminal = true;
                 break;
+            case 'N':
+                config.each_line = true;
+                break;
+            case 'P':
+                config.each_line = true;
+                config.print_lines = true;
+                break;
             case 'c': {
                 classpath = strdup(optarg);
                 break;
@@ -592,6 +564,23 @@ int main(int argc, char **argv) {
         }
     }
 
+    if (config.each_line) {
+        // The last -e is the body evaluated for each line rather than an init option
+        for (i = (int) config.num_scripts - 1; i >= 0; i--) {
+            if (config.scripts[i].expression) {
+                config.lines_body = config.scripts[i].source;
+                memmove(config.scripts + i, config.scripts + i + 1,
+                        (config.num_scripts - i - 1) * sizeof(struct script));
+                config.num_scripts--;
+                break;
+            }
+        }
+        if (!config.lines_body) {
+            print_usage_error("-N and -P require an expression to evaluate, given with -e.", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
     display_launch_timing("parse opts");
 
     if (config.cache_path) {
@@ -612,7 +601,7 @@ int main(int argc, char **argv) {
             }
         }
         if (local_repo) {
-            dependencies_classpath = calculate_dependencies_classpath(dependencies, local_repo);
+            dependencies_classpath = resolve_dependencies_classpath(dependencies, local_repo);
             if (classpath) {
                 classpath = str_concat(classpath, ":");
                 classpath = str_concat(classpath, dependencies_classpath);
@@ -655,7 +644,7 @@ int main(int argc, char **argv) {
     }
 
     if (config.num_scripts == 0 && config.main_ns_name == NULL && config.num_rest_args == 0
-        && config.num_compile_opts == 0) {
+        && config.num_compile_opts == 0 && config.lines_body == NULL) {
         config.repl = true;
     }
 
@@ -670,8 +659,26 @@ int main(int argc, char **argv) {
         return EXIT_FAILURE;
     }
 
+    if (config.lines_body != NULL && (config.main_ns_name != NULL || config.repl || config.num_rest_args > 0)) {
+        print_usage_error("-N and -P can't be combined with a main-opt.", argv[0]);
+        return EXIT_FAILURE;
+    }
+
     config.is_tty = isatty(STDIN_FILENO) == 1;
 
+    // Piped input to scripts is read natively as it arrives, so stdio mustn't read ahead of it.
+    // The REPL reads its forms through stdio, so it keeps stdin buffered.
+    if ((!config.is_tty && !config.repl) || config.each_line) {
+        setvbuf(stdin, NULL, _IONBF, 0);
+    }
+
+    // Block buffer output from scripts to pipes and files, rather than writing on every print.
+    // It is written when the buffer fills, on flush, before subprocesses start, and at exit.
+    config.buffered_stdout = !config.repl && isatty(STDOUT_FILENO) != 1;
+    if (config.buffered_stdout) {
+        setvbuf(stdout, NULL, _IOFBF, STDOUT_BUFFER_SIZE);
+    }
+
     display_launch_timing("check tty");
 
     engine_init();
@@ -688,7 +695,9 @@ int main(int argc, char **argv) {
 
     // Process main arguments
 
-    if (config.main_ns_name != NULL) {
+    if (config.lines_body != NULL) {
+        run_lines(config.lines_body, config.print_lines);
+    } else if (config.main_ns_name != NULL) {
         run_main_in_ns(config.main_ns_name, config.num_rest_args, config.rest_args);
     } else if (!config.repl && config.num_rest_args > 0) {
         char *path = config.rest_args[0];
@@ -723,7 +732,7 @@ int main(int argc, char **argv) {
         run_repl();
     }
 
-    if (!config.repl && !config.main_ns_name) {
+    if (!config.repl && !config.main_ns_name && !config.lines_body) {
         run_main_cli_fn();
     }
 
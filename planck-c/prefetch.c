@@ -0,0 +1,814 @@
+#include <ctype.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "archive.h"
+#include "classpath.h"
+#include "engine.h"
+#include "globals.h"
+#include "io.h"
+#include "prefetch.h"
+#include "str.h"
+
+#define PREFETCH_BUCKETS 512
+#define PREFETCH_MIN_THREADS 2
+#define PREFETCH_MAX_THREADS 8
+#define PREFETCH_MAX_JOB_ENTRIES 6
+#define PREFETCH_MAX_NESTING 128
+#define PREFETCH_MAX_TOKEN 1024
+
+typedef enum {
+    ENTRY_PENDING,
+    ENTRY_IN_PROGRESS,
+    ENTRY_FOUND,
+    ENTRY_ABSENT,
+    ENTRY_SKIPPED,
+    ENTRY_TAKEN
+} entry_state_t;
+
+typedef struct entry {
+    prefetch_kind_t kind;
+    char *key;
+    entry_state_t state;
+    struct loaded_source source;
+    struct entry *next;
+} entry_t;
+
+// A job resolves its entries in order. Lib jobs hold the candidate sources for a lib and stop
+// at the first one found, mirroring the order in which planck.repl tries extensions.
+typedef struct job {
+    size_t num_entries;
+    entry_t *entries[PREFETCH_MAX_JOB_ENTRIES];
+    char *lib_path;
+    bool macros;
+    struct job *next;
+} job_t;
+
+typedef struct seen_lib {
+    char *name;
+    struct seen_lib *next;
+} seen_lib_t;
+
+static pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_available_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t entry_resolved_cond = PTHREAD_COND_INITIALIZER;
+
+static bool pool_started = false;
+static job_t *queue_head = NULL;
+static job_t *queue_tail = NULL;
+static entry_t *entries[PREFETCH_BUCKETS];
+// Libs are only ever prefetched once; a lib that is loaded again (say, via :reload) is loaded directly.
+static seen_lib_t *seen_libs[PREFETCH_BUCKETS];
+static unsigned long generation = 0;
+
+static unsigned long prefetch_hash(prefetch_kind_t kind, const char *key) {
+    unsigned long hash = 5381 + kind;
+    int c;
+    while ((c = (unsigned char) *key++)) {
+        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+    }
+    return hash;
+}
+
+static void free_source(struct loaded_source *source) {
+    free(source->contents);
+    free(source->path);
+    source->contents = NULL;
+    source->path = NULL;
+}
+
+bool is_prefetchable_source(const char *path) {
+    return str_has_suffix(path, ".cljs") == 0 ||
+           str_has_suffix(path, ".cljc") == 0 ||
+           str_has_suffix(path, ".clj") == 0;
+}
+
+// ns form scanning
+
+typedef void (*lib_fn_t)(const char *lib, bool macros, void *data);
+
+static bool is_delimiter(char c) {
+    return c == '\0' || isspace((unsigned char) c) || c == ',' || c == ';' || c == '"' ||
+           c == '(' || c == ')' || c == '[' || c == ']' || c == '{' || c == '}';
+}
+
+static bool skip_form(const char **p, int nesting);
+
+static void skip_whitespace(const char **p) {
+    for (;;) {
+        char c = **p;
+        if (isspace((unsigned char) c) || c == ',') {
+            (*p)++;
+        } else if (c == ';') {
+            while (**p && **p != '\n') {
+                (*p)++;
+            }
+        } else if (c == '#' && (*p)[1] == '_') {
+            *p += 2;
+            if (!skip_form(p, 0)) {
+                return;
+            }
+        } else {
+            return;
+        }
+    }
+}
+
+static void skip_token(const char **p) {
+    while (!is_delimiter(**p)) {
+        (*p)++;
+    }
+}
+
+static bool read_token(const char **p, char *buf) {
+    const char *start = *p;
+    skip_token(p);
+    size_t len = *p - start;
+    if (len == 0 || len >= PREFETCH_MAX_TOKEN) {
+        return false;
+    }
+    memcpy(buf, start, len);
+    buf[len] = '\0';
+    return true;
+}
+
+static bool skip_string(const char **p) {
+    (*p)++;
+    while (**p && **p != '"') {
+        if (**p == '\\' && (*p)[1]) {
+            (*p)++;
+        }
+        (*p)++;
+    }
+    if (!**p) {
+        return false;
+    }
+    (*p)++;
+    return true;
+}
+
+static bool skip_seq(const char **p, char closer, int nesting) {
+    (*p)++;
+    for (;;) {
+        skip_whitespace(p);
+        char c = **p;
+        if (c == closer) {
+            (*p)++;
+            return true;
+        }
+        if (!skip_form(p, nesting)) {
+            return false;
+        }
+    }
+}
+
+static bool skip_form(const char **p, int nesting) {
+    if (nesting > PREFETCH_MAX_NESTING) {
+        return false;
+    }
+
+    skip_whitespace(p);
+
+    switch (**p) {
+        case '\0':
+        case ')':
+        case ']':
+        case '}':
+            return false;
+        case '(':
+            return skip_seq(p, ')', nesting + 1);
+        case '[':
+            return skip_seq(p, ']', nesting + 1);
+        case '{':
+            return skip_seq(p, '}', nesting + 1);
+        case '"':
+            return skip_string(p);
+        case '\\':
+            (*p)++;
+            if (**p) {
+                (*p)++;
+            }
+            skip_token(p);
+            return true;
+        case '\'':
+        case '`':
+        case '~':
+        case '@':
+            (*p)++;
+            return skip_form(p, nesting + 1);
+        case '^':
+            (*p)++;
+            return skip_form(p, nesting + 1) && skip_form(p, nesting + 1);
+        case '#':
+            (*p)++;
+            switch (**p) {
+                case '{':
+                case '(':
+                case '"':
+                    return skip_form(p, nesting + 1);
+                case '?':
+                    (*p)++;
+                    if (**p == '@') {
+                        (*p)++;
+                    }
+                    return skip_form(p, nesting + 1);
+                case '\'':
+                case '#':
+                    (*p)++;
+                    return skip_form(p, nesting + 1);
+                default:
+                    // tagged literal or namespaced map
+                    skip_token(p);
+                    return skip_form(p, nesting + 1);
+            }
+        default:
+            skip_token(p);
+            return true;
+    }
+}
+
+typedef bool (*element_scanner_t)(const char **p, bool macros, lib_fn_t f, void *data);
+
+// Scans the branch of a reader conditional that applies to ClojureScript, splicing if need be.
+static bool scan_reader_conditional(const char **p, element_scanner_t scan, bool macros, lib_fn_t f, void *data) {
+    *p += 2;
+    bool splicing = **p == '@';
+    if (splicing) {
+        (*p)++;
+    }
+    skip_whitespace(p);
+    if (**p != '(') {
+        return false;
+    }
+    (*p)++;
+
+    bool taken = false;
+    char feature[PREFETCH_MAX_TOKEN];
+    for (;;) {
+        skip_whitespace(p);
+        if (**p == ')') {
+            (*p)++;
+            return true;
+        }
+        if (!read_token(p, feature)) {
+            return false;
+        }
+        skip_whitespace(p);
+        if (!taken && (strcmp(feature, ":cljs") == 0 || strcmp(feature, ":default") == 0)) {
+            taken = true;
+            if (splicing && (**p == '[' || **p == '(')) {
+                char closer = **p == '[' ? ']' : ')';
+                (*p)++;
+                for (;;) {
+                    skip_whitespace(p);
+                    if (**p == closer) {
+                        (*p)++;
+                        break;
+                    }
+                    if (!scan(p, macros, f, data)) {
+                        return false;
+                    }
+                }
+            } else if (!scan(p, macros, f, data)) {
+                return false;
+            }
+        } else if (!skip_form(p, 0)) {
+            return false;
+        }
+    }
+}
+
+static bool scan_libspec(const char **p, bool macros, lib_fn_t f, void *data) {
+    skip_whitespace(p);
+
+    char lib[PREFETCH_MAX_TOKEN];
+    if (**p == '#' && (*p)[1] == '?') {
+        return scan_reader_conditional(p, scan_libspec, macros, f, data);
+    } else if (**p == '[') {
+        (*p)++;
+        skip_whitespace(p);
+        bool found = !is_delimiter(**p) && **p != ':' && read_token(p, lib);
+        bool include_macros = false;
+        bool as_alias = false;
+        char option[PREFETCH_MAX_TOKEN];
+        for (;;) {
+            skip_whitespace(p);
+            if (**p == ']') {
+                (*p)++;
+                break;
+            }
+            if (**p == ':' && read_token(p, option)) {
+                if (strcmp(option, ":include-macros") == 0 || strcmp(option, ":refer-macros") == 0) {
+                    include_macros = true;
+                } else if (strcmp(option, ":as-alias") == 0) {
+                    as_alias = true;
+                }
+            } else if (!skip_form(p, 0)) {
+                return false;
+            }
+        }
+        if (found && !as_alias) {
+            f(lib, macros, data);
+            if (include_macros && !macros) {
+                f(lib, true, data);
+            }
+        }
+        return true;
+    } else if (!is_delimiter(**p) && **p != ':' && **p != '#' && **p != '\'') {
+        if (read_token(p, lib)) {
+            f(lib, macros, data);
+        }
+        return true;
+    }
+
+    return skip_form(p, 0);
+}
+
+static bool scan_ns_clause(const char **p, bool macros, lib_fn_t f, void *data) {
+    skip_whitespace(p);
+
+    if (**p == '#' && (*p)[1] == '?') {
+        return scan_reader_conditional(p, scan_ns_clause, macros, f, data);
+    } else if (**p != '(') {
+        return skip_form(p, 0);
+    }
+
+    const char *start = *p;
+    (*p)++;
+    skip_whitespace(p);
+    char head[PREFETCH_MAX_TOKEN];
+    if (**p != ':' || !read_token(p, head)) {
+        *p = start;
+        return skip_form(p, 0);
+    }
+
+    bool clause_macros;
+    if (strcmp(head, ":require") == 0 || strcmp(head, ":use") == 0) {
+        clause_macros = false;
+    } else if (strcmp(head, ":require-macros") == 0 || strcmp(head, ":use-macros") == 0) {
+        clause_macros = true;
+    } else {
+        *p = start;
+        return skip_form(p, 0);
+    }
+
+    for (;;) {
+        skip_whitespace(p);
+        if (**p == ')') {
+            (*p)++;
+            return true;
+        }
+        if (!scan_libspec(p, clause_macros, f, data)) {
+            return false;
+        }
+    }
+}
+
+static void scan_ns_requires(const char *source, lib_fn_t f, void *data) {
+    const char *p = source;
+
+    if (p[0] == '#' && p[1] == '!') {
+        while (*p && *p != '\n') {
+            p++;
+        }
+    }
+
+    skip_whitespace(&p);
+    if (*p != '(') {
+        return;
+    }
+    p++;
+    skip_whitespace(&p);
+
+    char head[PREFETCH_MAX_TOKEN];
+    if (!read_token(&p, head) || strcmp(head, "ns") != 0) {
+        return;
+    }
+
+    for (;;) {
+        skip_whitespace(&p);
+        if (*p == ')' || *p == '\0') {
+            return;
+        }
+        if (!scan_ns_clause(&p, false, f, data)) {
+            return;
+        }
+    }
+}
+
+// Queueing; all of the following must be called with prefetch_lock held
+
+static entry_t *find_entry(prefetch_kind_t kind, const char *key) {
+    entry_t *entry = entries[prefetch_hash(kind, key) % PREFETCH_BUCKETS];
+    while (entry) {
+        if (entry->kind == kind && strcmp(entry->key, key) == 0) {
+            return entry;
+        }
+        entry = entry->next;
+    }
+    return NULL;
+}
+
+static void add_job_entry(job_t *job, prefetch_kind_t kind, const char *key) {
+    entry_t *entry = find_entry(kind, key);
+    if (entry) {
+        // A compiled lib.js is both the last candidate source for a lib and a cache artifact
+        if (entry->state == ENTRY_SKIPPED) {
+            entry->state = ENTRY_PENDING;
+            job->entries[job->num_entries++] = entry;
+        }
+        return;
+    }
+
+    entry = calloc(1, sizeof(entry_t));
+    entry->kind = kind;
+    entry->key = strdup(key);
+    entry->state = ENTRY_PENDING;
+
+    unsigned long bucket = prefetch_hash(kind, key) % PREFETCH_BUCKETS;
+    entry->next = entries[bucket];
+    entries[bucket] = entry;
+
+    job->entries[job->num_entries++] = entry;
+}
+
+static void *prefetch_worker(void *data);
+
+static void start_pool() {
+    pool_started = true;
+
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads < PREFETCH_MIN_THREADS) {
+        num_threads = PREFETCH_MIN_THREADS;
+    } else if (num_threads > PREFETCH_MAX_THREADS) {
+        num_threads = PREFETCH_MAX_THREADS;
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    long i;
+    for (i = 0; i < num_threads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, prefetch_worker, NULL) != 0) {
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
+}
+
+static void enqueue_job(job_t *job) {
+    if (job->num_entries == 0) {
+        free(job->lib_path);
+        free(job);
+        return;
+    }
+
+    if (!pool_started) {
+        start_pool();
+    }
+
+    if (queue_tail) {
+        queue_tail->next = job;
+    } else {
+        queue_head = job;
+    }
+    queue_tail = job;
+
+    pthread_cond_signal(&job_available_cond);
+}
+
+static bool mark_seen(const char *lib, bool macros) {
+    char *name = str_concat(lib, macros ? "$macros" : "");
+    unsigned long bucket = prefetch_hash(PREFETCH_LOAD, name) % PREFETCH_BUCKETS;
+    seen_lib_t *seen = seen_libs[bucket];
+    while (seen) {
+        if (strcmp(seen->name, name) == 0) {
+            free(name);
+            return false;
+        }
+        seen = seen->next;
+    }
+
+    seen = malloc(sizeof(seen_lib_t));
+    seen->name = name;
+    seen->next = seen_libs[bucket];
+    seen_libs[bucket] = seen;
+    return true;
+}
+
+static void enqueue_lib(const char *lib, bool macros) {
+    if (str_has_prefix(lib, "goog") == 0 || strcmp(lib, "cljs.core") == 0) {
+        return;
+    }
+
+    if (!mark_seen(lib, macros)) {
+        return;
+    }
+
+    job_t *job = calloc(1, sizeof(job_t));
+    job->lib_path = munge((char *) lib);
+    char *c;
+    for (c = job->lib_path; *c; c++) {
+        if (*c == '.') {
+            *c = '/';
+        }
+    }
+    job->macros = macros;
+
+    const char *macros_extensions[] = {".clj", ".cljc", NULL};
+    const char *extensions[] = {".cljs", ".cljc", ".js", NULL};
+    const char **extension;
+    for (extension = macros ? macros_extensions : extensions; *extension; extension++) {
+        char *key = str_concat(job->lib_path, *extension);
+        add_job_entry(job, PREFETCH_LOAD, key);
+        free(key);
+    }
+
+    enqueue_job(job);
+}
+
+static void add_job_entry_suffixed(job_t *job, prefetch_kind_t kind, const char *prefix, const char *suffix) {
+    char *key = str_concat(prefix, suffix);
+    add_job_entry(job, kind, key);
+    free(key);
+}
+
+// Enqueues the compilation cache artifacts that planck.repl looks for after loading the source
+// at key: first alongside the source and then, if there is a cache, in the cache directory.
+static void enqueue_artifacts(const char *key, const char *lib_path, bool macros, bool bundled) {
+    job_t *job = calloc(1, sizeof(job_t));
+
+    char *path;
+    if (macros) {
+        path = str_concat(lib_path, "$macros");
+        add_job_entry_suffixed(job, PREFETCH_LOAD, path, ".js");
+    } else {
+        path = strdup(key);
+        add_job_entry_suffixed(job, PREFETCH_LOAD, lib_path, ".js");
+    }
+    add_job_entry_suffixed(job, PREFETCH_LOAD, path, ".cache.json");
+    add_job_entry_suffixed(job, PREFETCH_LOAD, path, ".js.map.json");
+    free(path);
+
+    if (config.cache_path != NULL && !bundled) {
+        size_t slashes = 0;
+        const char *c;
+        for (c = lib_path; *c; c++) {
+            if (*c == '/') {
+                slashes++;
+            }
+        }
+
+        size_t len = strlen(config.cache_path) + strlen(lib_path) + 6 * slashes + strlen("/$macros") + 1;
+        char *cache_prefix = malloc(len);
+        char *d = cache_prefix + sprintf(cache_prefix, "%s/", config.cache_path);
+        for (c = lib_path; *c; c++) {
+            if (*c == '/') {
+                d += sprintf(d, "_SLASH_");
+            } else {
+                *d++ = *c;
+            }
+        }
+        strcpy(d, macros ? "$macros" : "");
+
+        add_job_entry_suffixed(job, PREFETCH_READ, cache_prefix, ".js");
+        add_job_entry_suffixed(job, PREFETCH_READ, cache_prefix, ".cache.json");
+        add_job_entry_suffixed(job, PREFETCH_READ, cache_prefix, ".js.map.json");
+        free(cache_prefix);
+    }
+
+    enqueue_job(job);
+}
+
+// Workers
+
+typedef struct deps {
+    size_t count;
+    char **libs;
+    bool *macros;
+} deps_t;
+
+static void collect_dep(const char *lib, bool macros, void *data) {
+    deps_t *deps = data;
+    deps->libs = realloc(deps->libs, (deps->count + 1) * sizeof(char *));
+    deps->macros = realloc(deps->macros, (deps->count + 1) * sizeof(bool));
+    deps->libs[deps->count] = strdup(lib);
+    deps->macros[deps->count] = macros;
+    deps->count++;
+}
+
+static void enqueue_deps(deps_t *deps) {
+    size_t i;
+    for (i = 0; i < deps->count; i++) {
+        enqueue_lib(deps->libs[i], deps->macros[i]);
+    }
+}
+
+static void free_deps(deps_t *deps) {
+    size_t i;
+    for (i = 0; i < deps->count; i++) {
+        free(deps->libs[i]);
+    }
+    free(deps->libs);
+    free(deps->macros);
+}
+
+static bool fetch(prefetch_kind_t kind, char *key, struct loaded_source *source) {
+    if (kind == PREFETCH_LOAD) {
+        return classpath_load(key, source, true);
+    }
+
+    source->contents = get_contents(key, &source->last_modified);
+    source->path = NULL;
+    source->type = NULL;
+    source->location = NULL;
+    return source->contents != NULL;
+}
+
+static void run_job(job_t *job) {
+    unsigned long job_generation = generation;
+
+    size_t i;
+    for (i = 0; i < job->num_entries; i++) {
+        entry_t *entry = job->entries[i];
+        if (entry->state != ENTRY_PENDING) {
+            if (job->lib_path) {
+                // the main thread got here first and is trying the candidates itself
+                return;
+            }
+            continue;
+        }
+
+        entry->state = ENTRY_IN_PROGRESS;
+        prefetch_kind_t kind = entry->kind;
+        char *key = strdup(entry->key);
+        pthread_mutex_unlock(&prefetch_lock);
+
+        struct loaded_source source;
+        bool found = fetch(kind, key, &source);
+        bool scan = found && job->lib_path && is_prefetchable_source(key);
+        deps_t deps = {0, NULL, NULL};
+        if (scan) {
+            scan_ns_requires(source.contents, collect_dep, &deps);
+        }
+
+        pthread_mutex_lock(&prefetch_lock);
+
+        if (generation != job_generation) {
+            if (found) {
+                free_source(&source);
+            }
+            free_deps(&deps);
+            free(key);
+            return;
+        }
+
+        if (entry->state == ENTRY_IN_PROGRESS) {
+            entry->state = found ? ENTRY_FOUND : ENTRY_ABSENT;
+            if (found) {
+                entry->source = source;
+            }
+        } else if (found) {
+            free_source(&source);
+        }
+        pthread_cond_broadcast(&entry_resolved_cond);
+
+        bool done = found && job->lib_path;
+        if (done) {
+            size_t j;
+            for (j = i + 1; j < job->num_entries; j++) {
+                if (job->entries[j]->state == ENTRY_PENDING) {
+                    job->entries[j]->state = ENTRY_SKIPPED;
+                }
+            }
+        }
+
+        if (scan) {
+            enqueue_artifacts(key, job->lib_path, job->macros, source.type && strcmp(source.type, "bundled") == 0);
+            enqueue_deps(&deps);
+        }
+        free_deps(&deps);
+        free(key);
+
+        if (done) {
+            return;
+        }
+    }
+}
+
+static void *prefetch_worker(void *data) {
+    pthread_mutex_lock(&prefetch_lock);
+    for (;;) {
+        while (queue_head == NULL) {
+            pthread_cond_wait(&job_available_cond, &prefetch_lock);
+        }
+
+        job_t *job = queue_head;
+        queue_head = job->next;
+        if (queue_head == NULL) {
+            queue_tail = NULL;
+        }
+
+        run_job(job);
+
+        free(job->lib_path);
+        free(job);
+    }
+    return NULL;
+}
+
+// Main thread interface
+
+prefetch_status_t prefetch_take(prefetch_kind_t kind, const char *key, struct loaded_source *result) {
+    prefetch_status_t status = PREFETCH_MISS;
+
+    pthread_mutex_lock(&prefetch_lock);
+
+    entry_t *entry = find_entry(kind, key);
+    if (entry) {
+        if (entry->state == ENTRY_PENDING) {
+            // Not worth waiting for the queue to get to it
+            entry->state = ENTRY_SKIPPED;
+        }
+        while (entry->state == ENTRY_IN_PROGRESS) {
+            pthread_cond_wait(&entry_resolved_cond, &prefetch_lock);
+        }
+        if (entry->state == ENTRY_FOUND) {
+            *result = entry->source;
+            entry->source.contents = NULL;
+            entry->source.path = NULL;
+            entry->state = ENTRY_TAKEN;
+            status = PREFETCH_FOUND;
+        } else if (entry->state == ENTRY_ABSENT) {
+            entry->state = ENTRY_TAKEN;
+            status = PREFETCH_ABSENT;
+        }
+    }
+
+    pthread_mutex_unlock(&prefetch_lock);
+
+    return status;
+}
+
+void prefetch_dependencies(const char *source) {
+    deps_t deps = {0, NULL, NULL};
+    scan_ns_requires(source, collect_dep, &deps);
+
+    pthread_mutex_lock(&prefetch_lock);
+    enqueue_deps(&deps);
+    pthread_mutex_unlock(&prefetch_lock);
+
+    free_deps(&deps);
+}
+
+void prefetch_forget(prefetch_kind_t kind, const char *key) {
+    pthread_mutex_lock(&prefetch_lock);
+
+    entry_t *entry = find_entry(kind, key);
+    if (entry) {
+        if (entry->state == ENTRY_FOUND) {
+            free_source(&entry->source);
+        }
+        entry->state = ENTRY_SKIPPED;
+    }
+
+    pthread_mutex_unlock(&prefetch_lock);
+}
+
+void prefetch_discard() {
+    pthread_mutex_lock(&prefetch_lock);
+
+    // Workers check the generation before touching entries again, so they can be freed
+    // even while being fetched.
+    generation++;
+
+    while (queue_head) {
+        job_t *job = queue_head;
+        queue_head = job->next;
+        free(job->lib_path);
+        free(job);
+    }
+    queue_tail = NULL;
+
+    int i;
+    for (i = 0; i < PREFETCH_BUCKETS; i++) {
+        entry_t *entry = entries[i];
+        while (entry) {
+            entry_t *next = entry->next;
+            if (entry->state == ENTRY_FOUND) {
+                free_source(&entry->source);
+            }
+            free(entry->key);
+            free(entry);
+            entry = next;
+        }
+        entries[i] = NULL;
+    }
+
+    pthread_mutex_unlock(&prefetch_lock);
+}
@@ -0,0 +1,33 @@
+#include <stdbool.h>
+
+struct loaded_source;
+
+// Prefetching speculatively loads the dependencies named in ns forms on a pool of worker
+// threads, so that the sources and compilation cache artifacts for a dependency tree are
+// read in parallel while the main thread compiles and evaluates.
+
+typedef enum {
+    PREFETCH_LOAD,
+    PREFETCH_READ
+} prefetch_kind_t;
+
+typedef enum {
+    PREFETCH_MISS,
+    PREFETCH_FOUND,
+    PREFETCH_ABSENT
+} prefetch_status_t;
+
+// Takes the prefetched result for key. On PREFETCH_FOUND ownership of the contents and path
+// in result passes to the caller. On PREFETCH_MISS the caller should load key itself.
+prefetch_status_t prefetch_take(prefetch_kind_t kind, const char *key, struct loaded_source *result);
+
+// Scans the ns form at the start of source and starts prefetching the libs it requires.
+void prefetch_dependencies(const char *source);
+
+// Drops any prefetched result for key, used when a file is written.
+void prefetch_forget(prefetch_kind_t kind, const char *key);
+
+// Drops all prefetched results not yet taken, so that later loads see fresh contents.
+void prefetch_discard();
+
+bool is_prefetchable_source(const char *path);
@@ -0,0 +1,779 @@
+// Define _GNU_SOURCE so that execvpe is defined for non macOS builds
+#ifndef __APPLE__
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "dir_cache.h"
+#include "engine.h"
+#include "file.h"
+#include "io.h"
+#include "process.h"
+#include "tasks.h"
+
+// posix_spawn can change the child's directory with glibc 2.29 and later, and on macOS 10.15 and later
+#ifdef __APPLE__
+#include "availability.h"
+#ifdef __MAC_OS_X_VERSION_MIN_REQUIRED
+#if __MAC_OS_X_VERSION_MIN_REQUIRED >= 101500
+#define HAVE_POSIX_SPAWN_CHDIR 1
+#endif
+#endif
+#elif defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+#define HAVE_POSIX_SPAWN_CHDIR 1
+#endif
+
+extern char **environ;
+
+#ifdef __APPLE__
+
+static const char *get_path(void) {
+    const char *s = getenv("PATH");
+    return (s != NULL) ? s : ":/bin:/usr/bin";
+}
+
+static size_t count_occurrences(const char *s, char c) {
+    size_t count;
+    for (count = 0; *s != '\0'; s++)
+        count += (*s == c);
+    return count;
+}
+
+static const char *const *split_path(const char *path) {
+    const char *p, *q;
+    char **pathv;
+    int i;
+    size_t count = count_occurrences(path, ':') + 1;
+
+    pathv = malloc((count + 1)*(sizeof(char*)));
+    pathv[count] = NULL;
+    for (p = path, i = 0; i < count; i++, p = q + 1) {
+        for (q = p; (*q != ':') && (*q != '\0'); q++);
+        if (q == p)
+            pathv[i] = "./";
+        else {
+            int add_slash = ((*(q - 1)) != '/');
+            pathv[i] = malloc(q - p + add_slash + 1);
+            memcpy(pathv[i], p, q - p);
+            if (add_slash)
+                pathv[i][q - p] = '/';
+            pathv[i][q - p + add_slash] = '\0';
+        }
+    }
+    return (const char *const *) pathv;
+}
+
+static void planck_execvpe(const char *file, char * const *argv, char * const * envp) {
+    if (strchr(file, '/') != NULL) {
+        execve(file, argv, envp);
+    } else {
+        char expanded_file[PATH_MAX];
+        size_t filelen = strlen(file);
+        int sticky_errno = 0;
+        const char *const *dirs = split_path(get_path());
+        for (; *dirs; dirs++) {
+            const char *dir = *dirs;
+            size_t dirlen = strlen(dir);
+            if (filelen + dirlen + 1 >= PATH_MAX) {
+                errno = ENAMETOOLONG;
+                continue;
+            }
+            memcpy(expanded_file, dir, dirlen);
+            memcpy(expanded_file + dirlen, file, filelen);
+            expanded_file[dirlen + filelen] = '\0';
+            execve(expanded_file, argv, envp);
+            switch (errno) {
+                case EACCES:
+                    sticky_errno = errno;
+                case ENOENT:
+                case ENOTDIR:
+                    break;
+                default:
+                    return;
+            }
+        }
+        if (sticky_errno != 0)
+            errno = sticky_errno;
+    }
+}
+#endif
+
+static void preopen(int old, int new) {
+    dup2(old, new);
+    close(old);
+}
+
+// Launches the child with fork, which reports failures to change directory or exec through its
+// exit code.
+static pid_t fork_spawn(char **cmd, char **env, const char *dir, int in_fd, int out_fd, int err_fd) {
+    pid_t pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+
+    if (dir) {
+        if (chdir(dir) == -1) {
+            _exit(1);
+        }
+    }
+    preopen(in_fd, STDIN_FILENO);
+    preopen(out_fd, STDOUT_FILENO);
+    preopen(err_fd, STDERR_FILENO);
+    // Planck ignores SIGPIPE, but children such as the early stages of a pipeline expect it
+    signal(SIGPIPE, SIG_DFL);
+    if (env) {
+#ifdef __APPLE__
+        planck_execvpe(cmd[0], cmd, env);
+#else
+        execvpe(cmd[0], cmd, env);
+#endif
+    } else {
+        execvp(cmd[0], cmd);
+    }
+    if (errno == EACCES || errno == EPERM) {
+        _exit(126);
+    } else if (errno == ENOENT) {
+        _exit(127);
+    } else {
+        _exit(1);
+    }
+}
+
+// Launches the child with posix_spawn, which doesn't copy the page tables of Planck's heap as fork
+// does, so that launching stays cheap as the heap grows. The pipes are close-on-exec, so only the
+// duplicated descriptors reach the child. Returns -1 without launching anything on failure.
+static pid_t posix_spawn_spawn(char **cmd, char **env, const char *dir, int in_fd, int out_fd, int err_fd) {
+#ifndef HAVE_POSIX_SPAWN_CHDIR
+    if (dir) {
+        return -1;
+    }
+#endif
+
+    posix_spawn_file_actions_t file_actions;
+    posix_spawnattr_t attr;
+    if (posix_spawn_file_actions_init(&file_actions) != 0) {
+        return -1;
+    }
+    if (posix_spawnattr_init(&attr) != 0) {
+        posix_spawn_file_actions_destroy(&file_actions);
+        return -1;
+    }
+
+    int err = 0;
+#ifdef HAVE_POSIX_SPAWN_CHDIR
+    if (dir) {
+        err = posix_spawn_file_actions_addchdir_np(&file_actions, dir);
+    }
+#endif
+    if (!err) err = posix_spawn_file_actions_adddup2(&file_actions, in_fd, STDIN_FILENO);
+    if (!err) err = posix_spawn_file_actions_adddup2(&file_actions, out_fd, STDOUT_FILENO);
+    if (!err) err = posix_spawn_file_actions_adddup2(&file_actions, err_fd, STDERR_FILENO);
+
+    sigset_t default_signals;
+    sigset_t mask;
+    sigemptyset(&default_signals);
+    sigaddset(&default_signals, SIGPIPE);
+    sigemptyset(&mask);
+    if (!err) err = posix_spawnattr_setsigdefault(&attr, &default_signals);
+    if (!err) err = posix_spawnattr_setsigmask(&attr, &mask);
+    if (!err) err = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+    pid_t pid;
+    if (!err) err = posix_spawnp(&pid, cmd[0], &file_actions, &attr, cmd, env ? env : environ);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&file_actions);
+
+    return err ? -1 : pid;
+}
+
+pid_t process_spawn(char **cmd, char **env, const char *dir, int in_fd, int out_fd, int err_fd) {
+    // Write out buffered output so that it precedes the child's
+    fflush(stdout);
+
+    pid_t pid = posix_spawn_spawn(cmd, env, dir, in_fd, out_fd, err_fd);
+    if (pid == -1) {
+        // Failures to change directory or exec are reported through the exit code, as in a
+        // shell, which a forked child can do
+        pid = fork_spawn(cmd, env, dir, in_fd, out_fd, err_fd);
+    }
+    return pid;
+}
+
+int process_spawn_pipeline(process_stage_t *stages, size_t num_stages, int in_fd, pid_t *pids, int fds[3]) {
+    int in[2] = {-1, -1};
+    int out[2] = {-1, -1};
+    int err[2] = {-1, -1};
+    if ((in_fd == -1 && process_pipe(in) == -1) || process_pipe(out) == -1 || process_pipe(err) == -1) {
+        int saved_errno = errno;
+        int i;
+        for (i = 0; i < 2; i++) {
+            if (in[i] != -1) close(in[i]);
+            if (out[i] != -1) close(out[i]);
+            if (err[i] != -1) close(err[i]);
+        }
+        if (in_fd != -1) {
+            close(in_fd);
+        }
+        errno = saved_errno;
+        return -1;
+    }
+
+    size_t num_pids = 0;
+    int stage_in = in_fd == -1 ? in[0] : in_fd;
+    int saved_errno = 0;
+    while (num_pids < num_stages) {
+        int link[2] = {-1, -1};
+        int stage_out = out[1];
+        if (num_pids < num_stages - 1) {
+            if (process_pipe(link) == -1) {
+                saved_errno = errno;
+                break;
+            }
+            stage_out = link[1];
+        }
+
+        process_stage_t *stage = &stages[num_pids];
+        pid_t pid = process_spawn(stage->cmd, stage->env, stage->dir, stage_in, stage_out, err[1]);
+        if (pid == -1) {
+            saved_errno = errno;
+            if (link[0] != -1) {
+                close(link[0]);
+                close(link[1]);
+            }
+            break;
+        }
+        pids[num_pids++] = pid;
+
+        // Only the stages hold the pipes between them
+        close(stage_in);
+        if (link[1] != -1) {
+            close(link[1]);
+        }
+        stage_in = link[0];
+    }
+    if (stage_in != -1) {
+        close(stage_in);
+    }
+    close(out[1]);
+    close(err[1]);
+
+    if (num_pids < num_stages) {
+        // Reap the stages already launched, which see end of file and exit
+        if (in[1] != -1) {
+            close(in[1]);
+        }
+        close(out[0]);
+        close(err[0]);
+        size_t i;
+        for (i = 0; i < num_pids; i++) {
+            waitpid(pids[i], NULL, 0);
+        }
+        errno = saved_errno;
+        return -1;
+    }
+
+    fds[PROCESS_STDIN] = in[1];
+    fds[PROCESS_STDOUT] = out[0];
+    fds[PROCESS_STDERR] = err[0];
+    return 0;
+}
+
+int process_exit_code(int status) {
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    } else {
+        return -1;
+    }
+}
+
+int process_pipe(int fds[2]) {
+    if (pipe(fds) == -1) {
+        return -1;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+}
+
+// Streams are owned by JavaScript unless they have a callback, in which case they are owned by
+// the background thread. Either way they are closed when their owner is done with them.
+struct process {
+    pid_t pid;
+    FILE *in;
+    int fds[3];
+    descriptor_t readers[3];
+    char *encoding;
+    JSObjectRef fns[3];
+    JSObjectRef exit_fn;
+
+    pthread_mutex_t lock;
+    pthread_cond_t exited_cond;
+    bool exited;
+    bool reaping;
+    int exit_code;
+    int refs;
+};
+
+// Reaps the process, waiting for it to exit if block is set. Returns whether the process has
+// exited. The pid is only reaped with the lock held, so that process_kill can't signal a pid that
+// has been reaped and possibly reused, and so a blocking wait only waits for the exit, leaving
+// the child to be reaped once the lock is taken again.
+static bool reap(process_t *process, bool block) {
+    pthread_mutex_lock(&process->lock);
+    while (!process->exited) {
+        int status;
+        pid_t rv;
+        do {
+            rv = waitpid(process->pid, &status, WNOHANG);
+        } while (rv == -1 && errno == EINTR);
+
+        if (rv == process->pid || rv == -1) {
+            process->exited = true;
+            process->exit_code = rv == -1 ? -1 : process_exit_code(status);
+            // The child may have changed the classpath
+            dir_cache_invalidate();
+            pthread_cond_broadcast(&process->exited_cond);
+            break;
+        }
+        if (!block) {
+            break;
+        }
+        if (process->reaping) {
+            pthread_cond_wait(&process->exited_cond, &process->lock);
+            continue;
+        }
+
+        process->reaping = true;
+        pthread_mutex_unlock(&process->lock);
+
+        siginfo_t info;
+        while (waitid(P_PID, (id_t) process->pid, &info, WEXITED | WNOWAIT) == -1 && errno == EINTR) {
+        }
+
+        pthread_mutex_lock(&process->lock);
+        process->reaping = false;
+        pthread_cond_broadcast(&process->exited_cond);
+    }
+    bool exited = process->exited;
+    pthread_mutex_unlock(&process->lock);
+    return exited;
+}
+
+static void close_stream(process_t *process, int stream) {
+    if (stream == PROCESS_STDIN) {
+        if (process->in) {
+            fclose(process->in);
+            process->in = NULL;
+        }
+    } else if (process->readers[stream]) {
+        ufile_close_read(process->readers[stream]);
+        process->readers[stream] = 0;
+        process->fds[stream] = -1;
+    } else if (process->fds[stream] != -1) {
+        close(process->fds[stream]);
+        process->fds[stream] = -1;
+    }
+}
+
+static void *orphan_reaper(void *arg) {
+    pid_t pid = (pid_t) (intptr_t) arg;
+    int status;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+    }
+    dir_cache_invalidate();
+    return NULL;
+}
+
+// Hands a child that is still running when its process is released to a detached thread
+// that waits for it, so it doesn't linger as a zombie.
+static void reap_orphan(pid_t pid) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN > 65536 ? PTHREAD_STACK_MIN : 65536);
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, orphan_reaper, (void *) (intptr_t) pid) != 0) {
+        engine_perror("reap");
+    }
+    pthread_attr_destroy(&attr);
+}
+
+static void unref(process_t *process) {
+    pthread_mutex_lock(&process->lock);
+    bool last = --process->refs == 0;
+    pthread_mutex_unlock(&process->lock);
+
+    if (last) {
+        if (!reap(process, false)) {
+            reap_orphan(process->pid);
+        }
+        int stream;
+        for (stream = PROCESS_STDIN; stream <= PROCESS_STDERR; stream++) {
+            close_stream(process, stream);
+        }
+        pthread_cond_destroy(&process->exited_cond);
+        pthread_mutex_destroy(&process->lock);
+        free(process->encoding);
+        free(process);
+    }
+}
+
+static descriptor_t reader(process_t *process, int stream) {
+    if (!process->readers[stream] && process->fds[stream] != -1) {
+        process->readers[stream] = ufile_open_fd(process->fds[stream], process->encoding);
+        if (!process->readers[stream]) {
+            process->fds[stream] = -1;
+        }
+    }
+    return process->readers[stream];
+}
+
+// Lines read by the background thread, waiting for the eval lock
+typedef struct pending {
+    JSStringRef *lines;
+    size_t count;
+    size_t capacity;
+} pending_t;
+
+static void push_line(pending_t *pending, JSStringRef line) {
+    if (pending->count == pending->capacity) {
+        size_t capacity = pending->capacity ? 2 * pending->capacity : 64;
+        JSStringRef *lines = realloc(pending->lines, capacity * sizeof(JSStringRef));
+        if (!lines) {
+            JSStringRelease(line);
+            return;
+        }
+        pending->lines = lines;
+        pending->capacity = capacity;
+    }
+    pending->lines[pending->count++] = line;
+}
+
+// Calls the callbacks with the pending lines. Must be called with the eval lock held.
+static void deliver_lines(process_t *process, pending_t *pending) {
+    int stream;
+    for (stream = PROCESS_STDOUT; stream <= PROCESS_STDERR; stream++) {
+        size_t count = pending[stream].count;
+        if (count == 0) {
+            continue;
+        }
+
+        JSValueRef *items = malloc(count * sizeof(JSValueRef));
+        if (!items) {
+            continue;
+        }
+        size_t i;
+        for (i = 0; i < count; i++) {
+            items[i] = JSValueMakeString(ctx, pending[stream].lines[i]);
+            JSValueProtect(ctx, items[i]);
+            JSStringRelease(pending[stream].lines[i]);
+        }
+        pending[stream].count = 0;
+
+        JSValueRef args[1];
+        args[0] = JSObjectMakeArray(ctx, count, items, NULL);
+
+        for (i = 0; i < count; i++) {
+            JSValueUnprotect(ctx, items[i]);
+        }
+        free(items);
+
+        JSObjectCallAsFunction(ctx, process->fns[stream], NULL, 1, args, NULL);
+    }
+}
+
+// Reads lines from the streams with callbacks as they arrive. Lines are held while the eval lock
+// is busy, rather than waiting for it, so that the process isn't stalled by a full pipe while
+// JavaScript waits for it.
+static void *callback_thread(void *arg) {
+    process_t *process = arg;
+    pending_t pending[3];
+    memset(pending, 0, sizeof(pending));
+
+    for (;;) {
+        struct pollfd fds[2];
+        nfds_t fd_count = 0;
+        int streams[2];
+        int stream;
+        for (stream = PROCESS_STDOUT; stream <= PROCESS_STDERR; stream++) {
+            if (process->fns[stream] && process->readers[stream]) {
+                fds[fd_count].fd = process->fds[stream];
+                fds[fd_count].events = POLLIN;
+                streams[fd_count++] = stream;
+            }
+        }
+        if (fd_count == 0) {
+            break;
+        }
+
+        bool held = pending[PROCESS_STDOUT].count > 0 || pending[PROCESS_STDERR].count > 0;
+        int rv = poll(fds, fd_count, held ? 10 : -1);
+        if (rv == -1 && errno != EINTR) {
+            engine_perror("planck.shell poll on process stdout/stderr");
+            break;
+        }
+
+        nfds_t i;
+        for (i = 0; rv > 0 && i < fd_count; i++) {
+            if (!fds[i].revents) {
+                continue;
+            }
+            stream = streams[i];
+            descriptor_t descriptor = process->readers[stream];
+            bool eof = !ufile_read_available(descriptor);
+
+            JSStringRef line;
+            while ((line = ufile_read_buffered_line(descriptor)) != NULL) {
+                push_line(&pending[stream], line);
+            }
+            if (eof) {
+                // An unterminated last line
+                if ((line = ufile_read(descriptor)) != NULL) {
+                    push_line(&pending[stream], line);
+                }
+                close_stream(process, stream);
+            }
+        }
+
+        if ((pending[PROCESS_STDOUT].count > 0 || pending[PROCESS_STDERR].count > 0) && try_acquire_eval_lock()) {
+            deliver_lines(process, pending);
+            release_eval_lock();
+        }
+    }
+
+    int exit_code = process_wait(process);
+
+    acquire_eval_lock();
+    deliver_lines(process, pending);
+    if (process->exit_fn) {
+        JSValueRef args[1];
+        args[0] = JSValueMakeNumber(ctx, exit_code);
+        JSObjectCallAsFunction(ctx, process->exit_fn, NULL, 1, args, NULL);
+        JSValueUnprotect(ctx, process->exit_fn);
+    }
+    int stream;
+    for (stream = PROCESS_STDOUT; stream <= PROCESS_STDERR; stream++) {
+        if (process->fns[stream]) {
+            JSValueUnprotect(ctx, process->fns[stream]);
+        }
+        free(pending[stream].lines);
+    }
+    release_eval_lock();
+
+    // Streams whose reading failed are closed along with the process
+    unref(process);
+
+    int err = signal_task_complete();
+    if (err) {
+        engine_print_err_message("process signal_task_complete", err);
+    }
+
+    return NULL;
+}
+
+process_t *process_start(char **cmd, char **env, const char *dir, const char *encoding,
+                         JSObjectRef out_fn, JSObjectRef err_fn, JSObjectRef exit_fn) {
+    process_t *process = calloc(1, sizeof(process_t));
+    if (!process) {
+        return NULL;
+    }
+
+    int in[2] = {-1, -1};
+    int out[2] = {-1, -1};
+    int err[2] = {-1, -1};
+    if (process_pipe(in) == -1 || process_pipe(out) == -1 || process_pipe(err) == -1) {
+        goto out_error;
+    }
+
+    process->in = fdopen(in[1], "w");
+    if (!process->in) {
+        goto out_error;
+    }
+    in[1] = -1;
+    process->fds[PROCESS_STDIN] = -1;
+    process->fds[PROCESS_STDOUT] = out[0];
+    process->fds[PROCESS_STDERR] = err[0];
+    process->encoding = strdup(encoding);
+
+    process->pid = process_spawn(cmd, env, dir, in[0], out[1], err[1]);
+    if (process->pid == -1) {
+        goto out_error;
+    }
+    close(in[0]);
+    close(out[1]);
+    close(err[1]);
+
+    pthread_mutex_init(&process->lock, NULL);
+    pthread_cond_init(&process->exited_cond, NULL);
+    process->refs = 1;
+
+    process->fns[PROCESS_STDOUT] = out_fn;
+    process->fns[PROCESS_STDERR] = err_fn;
+    process->exit_fn = exit_fn;
+    if (out_fn || err_fn || exit_fn) {
+        int stream;
+        for (stream = PROCESS_STDOUT; stream <= PROCESS_STDERR; stream++) {
+            if (process->fns[stream]) {
+                JSValueProtect(ctx, process->fns[stream]);
+                reader(process, stream);
+            }
+        }
+        if (exit_fn) {
+            JSValueProtect(ctx, exit_fn);
+        }
+
+        process->refs++;
+        int rv = signal_task_started();
+        if (rv) {
+            engine_print_err_message("process signal_task_started", rv);
+        }
+
+        pthread_t thread;
+        rv = pthread_create(&thread, NULL, callback_thread, process);
+        if (rv) {
+            // Without the thread the callbacks would never be called, so don't leave the
+            // command running
+            kill(process->pid, SIGKILL);
+            int stream;
+            for (stream = PROCESS_STDOUT; stream <= PROCESS_STDERR; stream++) {
+                if (process->fns[stream]) {
+                    JSValueUnprotect(ctx, process->fns[stream]);
+                }
+            }
+            if (exit_fn) {
+                JSValueUnprotect(ctx, exit_fn);
+            }
+            signal_task_complete();
+            reap(process, true);
+            process->refs--;
+            unref(process);
+            errno = rv;
+            return NULL;
+        }
+        pthread_detach(thread);
+    }
+
+    return process;
+
+    out_error:;
+    int saved_errno = errno;
+    if (process->in) {
+        fclose(process->in);
+    }
+    int i;
+    for (i = 0; i < 2; i++) {
+        if (in[i] != -1) close(in[i]);
+        if (out[i] != -1) close(out[i]);
+        if (err[i] != -1) close(err[i]);
+    }
+    free(process->encoding);
+    free(process);
+    errno = saved_errno;
+    return NULL;
+}
+
+ssize_t process_read_bytes(process_t *process, int stream, uint8_t *buf, size_t size) {
+    if (stream == PROCESS_STDIN || process->fns[stream] || process->readers[stream] ||
+        process->fds[stream] == -1) {
+        errno = EBADF;
+        return -1;
+    }
+
+    ssize_t n;
+    do {
+        n = read(process->fds[stream], buf, size);
+    } while (n == -1 && errno == EINTR);
+    return n;
+}
+
+bool process_read_text(process_t *process, int stream, bool line, JSStringRef *text) {
+    descriptor_t descriptor = 0;
+    if (stream != PROCESS_STDIN && !process->fns[stream] && process->fds[stream] != -1) {
+        descriptor = reader(process, stream);
+    } else {
+        errno = EBADF;
+    }
+    if (!descriptor) {
+        return false;
+    }
+
+    *text = line ? ufile_read_line(descriptor) : ufile_read(descriptor);
+    return true;
+}
+
+bool process_write(process_t *process, const uint8_t *bytes, size_t length) {
+    if (!process->in) {
+        errno = EBADF;
+        return false;
+    }
+    return fwrite(bytes, 1, length, process->in) == length;
+}
+
+bool process_write_string(process_t *process, JSStringRef text) {
+    if (!process->in) {
+        errno = EBADF;
+        return false;
+    }
+    file_write_string(process->in, text);
+    return !ferror(process->in);
+}
+
+bool process_flush(process_t *process) {
+    if (!process->in) {
+        errno = EBADF;
+        return false;
+    }
+    return fflush(process->in) == 0;
+}
+
+void process_close_stream(process_t *process, int stream) {
+    if (stream == PROCESS_STDIN || !process->fns[stream]) {
+        close_stream(process, stream);
+    }
+}
+
+int process_wait(process_t *process) {
+    reap(process, true);
+    return process->exit_code;
+}
+
+bool process_poll(process_t *process, int *exit_code) {
+    if (!reap(process, false)) {
+        return false;
+    }
+    *exit_code = process->exit_code;
+    return true;
+}
+
+int process_kill(process_t *process, int sig) {
+    pthread_mutex_lock(&process->lock);
+    int rv = 0;
+    if (!process->exited) {
+        rv = kill(process->pid, sig);
+    }
+    pthread_mutex_unlock(&process->lock);
+    return rv;
+}
+
+void process_release(process_t *process) {
+    process_close_stream(process, PROCESS_STDIN);
+    process_close_stream(process, PROCESS_STDOUT);
+    process_close_stream(process, PROCESS_STDERR);
+    unref(process);
+}
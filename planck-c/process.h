@@ -0,0 +1,83 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <JavaScriptCore/JavaScript.h>
+
+#define PROCESS_STDIN 0
+#define PROCESS_STDOUT 1
+#define PROCESS_STDERR 2
+
+typedef struct process process_t;
+
+// Launches cmd with its standard streams connected to in_fd, out_fd, and err_fd, using
+// posix_spawn where possible rather than fork, whose cost grows with the size of the heap. The
+// child exits with 126 if cmd can't be executed, 127 if it can't be found, and 1 if it can't
+// change to dir. Returns the pid of the child, or -1 with errno set.
+pid_t process_spawn(char **cmd, char **env, const char *dir, int in_fd, int out_fd, int err_fd);
+
+typedef struct process_stage {
+    char **cmd;
+    char **env;
+    char *dir;
+} process_stage_t;
+
+// Launches the stages of a pipeline, connecting the stdout of each to the stdin of the next, and
+// setting pids to their pids. fds is set to the ends of pipes to the stdin of the first stage,
+// the stdout of the last, and the stderr of all of them. If in_fd isn't -1, the first stage reads
+// from it directly instead, and fds[PROCESS_STDIN] is set to -1; in_fd is closed either way.
+// Returns -1 with errno set on failure, having reaped any stages that were launched.
+int process_spawn_pipeline(process_stage_t *stages, size_t num_stages, int in_fd, pid_t *pids, int fds[3]);
+
+// Converts a status returned by waitpid to an exit code, which is 128 plus the signal number for
+// children killed by a signal.
+int process_exit_code(int status);
+
+// Creates a pipe whose ends are closed on exec, so that they only reach the children they are
+// handed to. Returns -1 with errno set on failure.
+int process_pipe(int fds[2]);
+
+// Launches cmd with pipes to its standard streams. Text read from stdout and stderr is decoded
+// with encoding. If out_fn or err_fn are supplied, the lines of the corresponding stream are
+// read on a background thread and passed to them in arrays, as soon as the eval lock can be
+// had, and exit_fn, if supplied, is called with the exit code after both streams have closed.
+// The background thread counts as an outstanding task until then.
+//
+// Returns NULL with errno set on failure.
+process_t *process_start(char **cmd, char **env, const char *dir, const char *encoding,
+                         JSObjectRef out_fn, JSObjectRef err_fn, JSObjectRef exit_fn);
+
+// Reads whatever bytes of stdout or stderr are available, up to size, waiting for some if there
+// are none. Returns 0 at end of file, or -1 with errno set on failure, which is EBADF if the
+// stream is closed, consumed by a callback, or has been read as text.
+ssize_t process_read_bytes(process_t *process, int stream, uint8_t *buf, size_t size);
+
+// Reads whatever text of stdout or stderr is available, or the next line without its terminating
+// newline if line is set, into text, which is set to NULL at end of file. Returns false with
+// errno set on failure.
+bool process_read_text(process_t *process, int stream, bool line, JSStringRef *text);
+
+// Writes to the buffered stdin of the process, returning false with errno set on failure.
+bool process_write(process_t *process, const uint8_t *bytes, size_t length);
+
+bool process_write_string(process_t *process, JSStringRef text);
+
+bool process_flush(process_t *process);
+
+// Closes one of the streams of the process, unless it is consumed by a callback. Closing stdin
+// signals end of file to the process.
+void process_close_stream(process_t *process, int stream);
+
+// Waits for the process to exit, returning its exit code.
+int process_wait(process_t *process);
+
+// Returns whether the process has exited, setting exit_code if it has, without waiting.
+bool process_poll(process_t *process, int *exit_code);
+
+// Sends sig to the process, unless it has exited. Returns -1 with errno set on failure.
+int process_kill(process_t *process, int sig);
+
+// Closes the streams of the process that aren't consumed by callbacks and releases it, once
+// its background thread, if any, has finished.
+void process_release(process_t *process);
@@ -4,6 +4,7 @@
 #endif
 
 #include <assert.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <string.h>
 #include <stdio.h>
@@ -12,13 +13,22 @@
 #include <limits.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#endif
 #include <JavaScriptCore/JavaScript.h>
 #include <poll.h>
 #include <sysexits.h>
+#include "clock.h"
+#include "dir_cache.h"
 #include "engine.h"
+#include "file.h"
+#include "functions.h"
 #include "jsc_utils.h"
 #include "tasks.h"
 #include "io.h"
+#include "process.h"
 
 static char **cmd(JSContextRef ctx, const JSObjectRef array) {
     int argc = array_get_count(ctx, array);
@@ -66,15 +76,16 @@ static char **env(JSContextRef ctx, const JSObjectRef map) {
     return result;
 }
 
-static void preopen(int old, int new) {
-    dup2(old, new);
-    close(old);
-}
-
 struct SystemResult {
     int status;
     char *stdout;
     char *stderr;
+    // The exit codes of each stage of a pipeline, or NULL for a single command
+    int *exits;
+    size_t num_exits;
+    // The temporary file stdout was written to, or NULL if it was kept in memory
+    char *stdout_path;
+    bool truncated;
 };
 
 static JSObjectRef create_shell_result(JSContextRef ctx, int status, char *out, char *err) {
@@ -97,60 +108,231 @@ static JSObjectRef result_to_object_ref(JSContextRef ctx, struct SystemResult *r
     free(x);
     free(y);
 
+    if (result->exits) {
+        JSValueRef *exits = malloc(result->num_exits * sizeof(JSValueRef));
+        size_t i;
+        for (i = 0; i < result->num_exits; i++) {
+            exits[i] = JSValueMakeNumber(ctx, result->exits[i]);
+        }
+        JSObjectSetPropertyAtIndex(ctx, rv, 3, JSObjectMakeArray(ctx, result->num_exits, exits, NULL), NULL);
+        free(exits);
+        free(result->exits);
+    }
+
+    if (result->stdout_path) {
+        JSObjectSetPropertyAtIndex(ctx, rv, 4, c_string_to_value(ctx, result->stdout_path), NULL);
+        free(result->stdout_path);
+    }
+    if (result->truncated) {
+        JSObjectSetPropertyAtIndex(ctx, rv, 5, JSValueMakeBoolean(ctx, true), NULL);
+    }
+
     return rv;
 }
 
-struct ThreadParams {
-    struct SystemResult res;
-    int errpipe;
-    int outpipe;
-    int inpipe;
-    char* in_str;
-    pid_t pid;
-    int cb_idx;
-};
+// Input for the stdin of a command: either bytes, which are freed if owned, or a file that the
+// command reads from directly.
+typedef struct input {
+    uint8_t *bytes;
+    size_t length;
+    size_t written;
+    bool owned;
+    int fd;
+} input_t;
+
+static void free_input(input_t *input) {
+    if (input->owned) {
+        free(input->bytes);
+    }
+    input->bytes = NULL;
+    if (input->fd != -1) {
+        close(input->fd);
+        input->fd = -1;
+    }
+}
+
+// Writes as much of input to the nonblocking pipe as it will take, returning true if there is
+// more to write once it has drained, and false once all of it has been written or the command
+// has stopped reading.
+static bool write_input(int pipe, input_t *input) {
+    while (input->written < input->length) {
+        ssize_t n = write(pipe, input->bytes + input->written, input->length - input->written);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN;
+        }
+        input->written += n;
+    }
+    return false;
+}
+
+#define OUTPUT_INITIAL_SIZE 4096
+#define OUTPUT_READ_SIZE (64 * 1024)
+
+// Output captured from the stdout or stderr of a command, in a buffer that doubles as it fills.
+// Output beyond max bytes is read and discarded, so that the command isn't blocked. Once more
+// than spill bytes have been read, the output is written to a temporary file instead.
+typedef struct output {
+    char *buf;
+    size_t length;
+    size_t capacity;
+    size_t total;
+    size_t max;
+    size_t spill;
+    int spill_fd;
+    char *spill_path;
+    bool truncated;
+} output_t;
+
+static void init_output(output_t *output, size_t max, size_t spill) {
+    memset(output, 0, sizeof(output_t));
+    output->max = max;
+    output->spill = spill;
+    output->spill_fd = -1;
+}
 
-int read_child_pipe(int pipe, char **buf_p, size_t *total_p) {
+static bool write_all(int fd, const char *bytes, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, bytes, length);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += n;
+        length -= n;
+    }
+    return true;
+}
 
-    const size_t BLOCK_SIZE = 4096;
+// Moves the output read so far to a temporary file, which further output is written to.
+static void spill_output(output_t *output) {
+    const char *tmpdir = getenv("TMPDIR");
+    if (!tmpdir || !*tmpdir) {
+        tmpdir = "/tmp";
+    }
+    size_t size = strlen(tmpdir) + 32;
+    char *path = malloc(size);
+    snprintf(path, size, "%s/planck-sh-XXXXXX", tmpdir);
 
-    if (!*buf_p) {
-        *buf_p = malloc(BLOCK_SIZE);
-        *total_p = 0;
+    int fd = mkstemp(path);
+    if (fd == -1 || !write_all(fd, output->buf, output->length)) {
+        engine_perror("planck.shell spilling output");
+        if (fd != -1) {
+            close(fd);
+            unlink(path);
+        }
+        free(path);
+        // Keep the output in memory instead
+        output->spill = SIZE_MAX;
+        return;
     }
 
-    size_t num_to_read = BLOCK_SIZE - *total_p % BLOCK_SIZE;
-    ssize_t num_read = 0;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    output->spill_fd = fd;
+    output->spill_path = path;
+    free(output->buf);
+    output->buf = NULL;
+    output->length = 0;
+    output->capacity = 0;
+}
 
-    if ((num_read = read(pipe, *buf_p + *total_p, num_to_read)) > 0) {
-        *total_p += num_read;
-        if (num_read == num_to_read) {
-            *buf_p = realloc(*buf_p, *total_p + BLOCK_SIZE);
+// Reads from the pipe into output, returning 1 if there may be more to read, 0 at end of file, and
+// -1 on failure.
+static int read_output(int pipe, output_t *output) {
+    char scratch[OUTPUT_READ_SIZE];
+    char *dest = scratch;
+    size_t room = sizeof(scratch);
+    bool buffered = output->spill_fd == -1 && output->total < output->max;
+    if (buffered) {
+        if (output->capacity - output->length < OUTPUT_INITIAL_SIZE + 1) {
+            size_t capacity = output->capacity ? 2 * output->capacity : OUTPUT_INITIAL_SIZE;
+            char *buf = realloc(output->buf, capacity);
+            if (!buf) {
+                return -1;
+            }
+            output->buf = buf;
+            output->capacity = capacity;
         }
-        return 1;
+        dest = output->buf + output->length;
+        room = output->capacity - output->length - 1;
+    }
+
+    ssize_t num_read = read(pipe, dest, room);
+    if (num_read == -1) {
+        return errno == EINTR || errno == EAGAIN ? 1 : -1;
     } else if (num_read == 0) {
-        (*buf_p)[*total_p] = 0;
         return 0;
+    }
+
+    size_t kept = (size_t) num_read;
+    if (output->max - output->total < kept) {
+        kept = output->max - output->total;
+        output->truncated = true;
+    }
+    output->total += kept;
+
+    if (output->spill_fd != -1) {
+        if (!write_all(output->spill_fd, dest, kept)) {
+            engine_perror("planck.shell writing spilled output");
+            output->max = output->total;
+            output->truncated = true;
+        }
+    } else if (buffered) {
+        output->length += kept;
+        if (output->length > output->spill) {
+            spill_output(output);
+        }
+    }
+    return 1;
+}
+
+// Finishes reading output, moving its NUL-terminated contents, and the path of the file it was
+// spilled to, if any, into the result.
+static void finish_output(output_t *output, char **contents, char **path, bool *truncated) {
+    if (output->spill_fd != -1) {
+        close(output->spill_fd);
+        output->spill_fd = -1;
+    }
+    if (!output->buf) {
+        output->buf = malloc(1);
+    }
+    output->buf[output->length] = 0;
+    *contents = output->buf;
+    output->buf = NULL;
+    output->length = 0;
+    output->capacity = 0;
+    if (path) {
+        *path = output->spill_path;
     } else {
-        // TODO. num_read negative?
-        engine_println("error reading");
-        return -1;
+        free(output->spill_path);
+    }
+    output->spill_path = NULL;
+    if (truncated) {
+        *truncated = output->truncated;
     }
 }
 
-void process_child_pipes(struct ThreadParams *params) {
+struct ThreadParams {
+    struct SystemResult res;
+    int errpipe;
+    int outpipe;
+    int inpipe;
+    input_t *in;
+    output_t out;
+    output_t err;
+    pid_t *pids;
+    size_t num_pids;
+};
 
-    char *out_buf = NULL;
-    char *err_buf = NULL;
-    size_t out_total = 0;
-    size_t err_total = 0;
+void process_child_pipes(struct ThreadParams *params) {
 
     bool out_eof = false;
     bool err_eof = false;
 
-    char *to_write = params->in_str;
-    size_t remaining_to_write = to_write ? strlen(to_write) : 0;
-    
     while (!out_eof || !err_eof) {
 
         struct pollfd fds[3];
@@ -161,7 +343,7 @@ void process_child_pipes(struct ThreadParams *params) {
         fds[0].events = POLLIN | POLLHUP;
         fds[1].fd = err_eof ? -1 : params->errpipe;
         fds[1].events = POLLIN | POLLHUP;
-        fds[2].fd = to_write ? params->inpipe : -1;
+        fds[2].fd = params->inpipe;
         fds[2].events = POLLOUT;
 
         int rv = poll(fds, fd_count, 10000);
@@ -178,39 +360,29 @@ void process_child_pipes(struct ThreadParams *params) {
             continue;
         } else {
             if (fds[0].revents & (POLLIN | POLLHUP)) {
-                int res = read_child_pipe(params->outpipe, &out_buf, &out_total);
-                if (res == 0) {
+                if (read_output(params->outpipe, &params->out) != 1) {
                     out_eof = true;
                 }
             }
 
             if (fds[1].revents & (POLLIN | POLLHUP)) {
-                int res = read_child_pipe(params->errpipe, &err_buf, &err_total);
-                if (res == 0) {
+                if (read_output(params->errpipe, &params->err) != 1) {
                     err_eof = true;
                 }
             }
 
-            if (fds[2].revents & POLLOUT) {
-                size_t amount_to_write = remaining_to_write > 4096 ? (size_t)4096 : remaining_to_write;
-                ssize_t result = write(params->inpipe, to_write, amount_to_write);
-                if (result == -1) {
-                    engine_perror("planck.shell write in");
-                } else if (result != remaining_to_write) {
-                    to_write += result;
-                    remaining_to_write -= result;
-                } else {
-                    to_write = NULL;
-                    free(params->in_str);
+            if (fds[2].revents & (POLLOUT | POLLERR | POLLHUP)) {
+                if (!write_input(params->inpipe, params->in)) {
                     close(params->inpipe);
+                    params->inpipe = -1;
                 }
             }
         }
     }
 
     done:
-    params->res.stdout = out_buf ? out_buf : strdup("");
-    params->res.stderr = err_buf ? err_buf : strdup("");
+    finish_output(&params->out, &params->res.stdout, &params->res.stdout_path, &params->res.truncated);
+    finish_output(&params->err, &params->res.stderr, NULL, NULL);
 }
 
 static struct SystemResult *wait_for_child(struct ThreadParams *params) {
@@ -221,273 +393,1165 @@ static struct SystemResult *wait_for_child(struct ThreadParams *params) {
 
     close(params->errpipe);
     close(params->outpipe);
-    close(params->inpipe);
+    if (params->inpipe != -1) {
+        close(params->inpipe);
+    }
 
-    if (params->res.status != -1) {
-        if (waitpid(params->pid, &params->res.status, 0) != params->pid) {
-            params->res.status = -1;
+    // A pipeline's status is that of its last stage, as in the shell
+    bool failed = params->res.status == -1;
+    size_t i;
+    for (i = 0; i < params->num_pids; i++) {
+        int status;
+        if (waitpid(params->pids[i], &status, 0) == params->pids[i]) {
+            status = process_exit_code(status);
         } else {
-            if (WIFEXITED(params->res.status)) {
-                params->res.status = WEXITSTATUS(params->res.status);
-            } else if (WIFSIGNALED(params->res.status)) {
-                params->res.status = 128 + WTERMSIG(params->res.status);
-            } else {
-                params->res.status = -1;
-            }
+            status = -1;
+        }
+        if (params->res.exits) {
+            params->res.exits[i] = status;
+        }
+        if (!failed) {
+            params->res.status = status;
         }
     }
 
-    if (params->cb_idx == -1) {
-        return &params->res;
-    } else {
-        JSValueRef args[1];
-        args[0] = result_to_object_ref(ctx, &params->res);
-        static JSObjectRef translate_async_result_fn = NULL;
-        if (!translate_async_result_fn) {
-            translate_async_result_fn = get_function("global", "translate_async_result");
-            JSValueProtect(ctx, translate_async_result_fn);
-        }
-        JSObjectRef result = (JSObjectRef) JSObjectCallAsFunction(ctx, translate_async_result_fn, NULL,
-                                                                  1, args, NULL);
+    // The child may have changed the classpath
+    dir_cache_invalidate();
+
+    return &params->res;
+}
 
-        args[0] = JSValueMakeNumber(ctx, params->cb_idx);
-        static JSObjectRef do_async_sh_callback_fn = NULL;
-        if (!do_async_sh_callback_fn) {
-            do_async_sh_callback_fn = get_function("global", "do_async_sh_callback");
-            JSValueProtect(ctx, do_async_sh_callback_fn);
+static void free_strings(char **strings) {
+    if (strings) {
+        int i;
+        for (i = 0; strings[i] != NULL; i++) {
+            free(strings[i]);
         }
-        JSObjectCallAsFunction(ctx, do_async_sh_callback_fn, result, 1, args, NULL);
+        free(strings);
+    }
+}
 
-        free(params);
+static void free_stages(process_stage_t *stages, size_t num_stages) {
+    size_t i;
+    for (i = 0; i < num_stages; i++) {
+        free_strings(stages[i].cmd);
+        free_strings(stages[i].env);
+        free(stages[i].dir);
+    }
+    free(stages);
+}
 
-        int err = signal_task_complete();
-        if (err) {
-            engine_print_err_message("shell signal_task_complete", err);
-        }
+// Commands run with sh-async are handled by a single thread, which launches them, multiplexes
+// their pipes, reaps them, and calls back with their results. At most async_limit of them run
+// at once, and the rest are queued. Pipes are watched with epoll on Linux, where children are
+// also reaped as they exit via pidfds, and with poll elsewhere. Batches run with sh-all are
+// handled the same way, but on the calling thread.
 
-        return NULL;
+#define ASYNC_DEFAULT_LIMIT 64
+#define ASYNC_MAX_EVENTS 64
+// How often to check on children that can't be watched, and to retry for the eval lock
+#define ASYNC_RETRY_MS 10
+
+typedef enum {
+    SOURCE_IN,
+    SOURCE_OUT,
+    SOURCE_ERR,
+    SOURCE_PID
+} source_kind_t;
+
+struct async_job;
+
+typedef struct source {
+    struct async_job *job;
+    source_kind_t kind;
+    size_t index;
+    int fd;
+} source_t;
+
+typedef struct async_job {
+    process_stage_t *stages;
+    size_t num_stages;
+    bool pipeline;
+    input_t input;
+    int cb_idx;
+    // The position of the job in a batch
+    size_t index;
+    // How long the job may run for in nanoseconds, if it isn't 0, and the system_time after which
+    // it is killed once launched
+    uint64_t timeout;
+    uint64_t deadline;
+    bool timed_out;
+    bool cancelled;
+    int epoll_fd;
+
+    pid_t *pids;
+    source_t *pid_sources;
+    int *exits;
+    size_t num_pids;
+    size_t num_reaped;
+    int status;
+
+    source_t in;
+    source_t out;
+    source_t err;
+    output_t out_output;
+    output_t err_output;
+
+    struct async_job *next;
+} async_job_t;
+
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool async_started = false;
+static int async_wake_fds[2] = {-1, -1};
+static async_job_t *async_queue_head = NULL;
+static async_job_t *async_queue_tail = NULL;
+static size_t async_running = 0;
+static size_t async_limit = ASYNC_DEFAULT_LIMIT;
+
+#ifdef __linux__
+static int async_epoll_fd = -1;
+#endif
+
+static void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+static void watch_source(source_t *source, async_job_t *job, source_kind_t kind, size_t index, int fd) {
+    source->job = job;
+    source->kind = kind;
+    source->index = index;
+    source->fd = fd;
+#ifdef __linux__
+    if (fd != -1) {
+        struct epoll_event event;
+        event.events = kind == SOURCE_IN ? EPOLLOUT : EPOLLIN;
+        event.data.ptr = source;
+        epoll_ctl(job->epoll_fd, EPOLL_CTL_ADD, fd, &event);
     }
+#endif
 }
 
-static void *thread_proc(void *params) {
-    return (void *) wait_for_child((struct ThreadParams *) params);
+static void close_source(source_t *source) {
+    if (source->fd != -1) {
+#ifdef __linux__
+        epoll_ctl(source->job->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+#endif
+        close(source->fd);
+        source->fd = -1;
+    }
+}
+
+static int open_pidfd(pid_t pid) {
+#if defined(__linux__) && defined(SYS_pidfd_open)
+    return (int) syscall(SYS_pidfd_open, pid, 0);
+#else
+    return -1;
+#endif
+}
+
+static void launch_job(async_job_t *job) {
+    job->pids = malloc(job->num_stages * sizeof(pid_t));
+    job->pid_sources = calloc(job->num_stages, sizeof(source_t));
+    job->exits = malloc(job->num_stages * sizeof(int));
+
+    int fds[3];
+    int rv = process_spawn_pipeline(job->stages, job->num_stages, job->input.fd, job->pids, fds);
+    job->input.fd = -1;
+    free_stages(job->stages, job->num_stages);
+    job->stages = NULL;
+
+    if (rv == -1) {
+        engine_perror("planck.shell launching subprocess");
+        job->status = EX_OSERR;
+        job->in.fd = job->out.fd = job->err.fd = -1;
+        free_input(&job->input);
+        return;
+    }
+
+    job->num_pids = job->num_stages;
+    size_t i;
+    for (i = 0; i < job->num_pids; i++) {
+        watch_source(&job->pid_sources[i], job, SOURCE_PID, i, open_pidfd(job->pids[i]));
+    }
+
+    if (fds[PROCESS_STDIN] != -1) {
+        set_nonblocking(fds[PROCESS_STDIN]);
+    }
+    watch_source(&job->in, job, SOURCE_IN, 0, fds[PROCESS_STDIN]);
+    watch_source(&job->out, job, SOURCE_OUT, 0, fds[PROCESS_STDOUT]);
+    watch_source(&job->err, job, SOURCE_ERR, 0, fds[PROCESS_STDERR]);
+    if (!job->input.bytes) {
+        close_source(&job->in);
+    }
 }
 
-#ifdef __APPLE__
+static void reap_stage(async_job_t *job, size_t index) {
+    if (job->pids[index] == -1) {
+        return;
+    }
 
-static const char *get_path(void) {
-    const char *s = getenv("PATH");
-    return (s != NULL) ? s : ":/bin:/usr/bin";
+    int status;
+    pid_t rv = waitpid(job->pids[index], &status, WNOHANG);
+    if (rv == 0 || (rv == -1 && errno == EINTR)) {
+        return;
+    }
+    job->exits[index] = rv == -1 ? -1 : process_exit_code(status);
+    job->pids[index] = -1;
+    job->num_reaped++;
+    close_source(&job->pid_sources[index]);
 }
 
-static size_t count_occurrences(const char *s, char c) {
-    size_t count;
-    for (count = 0; *s != '\0'; s++)
-        count += (*s == c);
-    return count;
+static void handle_source(source_t *source) {
+    async_job_t *job = source->job;
+    switch (source->kind) {
+        case SOURCE_IN:
+            if (!write_input(source->fd, &job->input)) {
+                free_input(&job->input);
+                close_source(source);
+            }
+            break;
+        case SOURCE_OUT:
+        case SOURCE_ERR: {
+            output_t *output = source->kind == SOURCE_OUT ? &job->out_output : &job->err_output;
+            if (read_output(source->fd, output) != 1) {
+                close_source(source);
+            }
+            break;
+        }
+        case SOURCE_PID:
+            reap_stage(job, source->index);
+            break;
+    }
 }
 
-static const char *const *split_path(const char *path) {
-    const char *p, *q;
-    char **pathv;
-    int i;
-    size_t count = count_occurrences(path, ':') + 1;
+static async_job_t *make_job(process_stage_t *stages, size_t num_stages, bool pipeline, input_t input,
+                             size_t max_out, size_t spill_out) {
+    async_job_t *job = calloc(1, sizeof(async_job_t));
+    job->stages = stages;
+    job->num_stages = num_stages;
+    job->pipeline = pipeline;
+    job->input = input;
+    init_output(&job->out_output, max_out, spill_out);
+    init_output(&job->err_output, SIZE_MAX, SIZE_MAX);
+    job->cb_idx = -1;
+    job->epoll_fd = -1;
+    return job;
+}
 
-    pathv = malloc((count + 1)*(sizeof(char*)));
-    pathv[count] = NULL;
-    for (p = path, i = 0; i < count; i++, p = q + 1) {
-        for (q = p; (*q != ':') && (*q != '\0'); q++);
-        if (q == p)
-            pathv[i] = "./";
-        else {
-            int add_slash = ((*(q - 1)) != '/');
-            pathv[i] = malloc(q - p + add_slash + 1);
-            memcpy(pathv[i], p, q - p);
-            if (add_slash)
-                pathv[i][q - p] = '/';
-            pathv[i][q - p + add_slash] = '\0';
+static void free_job(async_job_t *job) {
+    if (job->stages) {
+        free_stages(job->stages, job->num_stages);
+    }
+    free_input(&job->input);
+    char *contents;
+    finish_output(&job->out_output, &contents, NULL, NULL);
+    free(contents);
+    finish_output(&job->err_output, &contents, NULL, NULL);
+    free(contents);
+    free(job->exits);
+    free(job->pids);
+    free(job->pid_sources);
+    free(job);
+}
+
+// Moves the result of a completed job into res.
+static void take_job_result(async_job_t *job, struct SystemResult *res) {
+    res->status = job->num_pids ? job->exits[job->num_pids - 1] : job->status;
+    finish_output(&job->out_output, &res->stdout, &res->stdout_path, &res->truncated);
+    finish_output(&job->err_output, &res->stderr, NULL, NULL);
+    res->exits = NULL;
+    res->num_exits = job->num_pids;
+    if (job->pipeline && job->num_pids) {
+        res->exits = job->exits;
+        job->exits = NULL;
+    }
+}
+
+// Kills the stages of a job that haven't exited, and stops feeding and reading it, as its
+// stages may have left children holding its pipes.
+static void abort_job(async_job_t *job) {
+    size_t i;
+    for (i = 0; i < job->num_pids; i++) {
+        if (job->pids[i] != -1) {
+            kill(job->pids[i], SIGKILL);
         }
     }
-    return (const char *const *) pathv;
+    close_source(&job->in);
+    close_source(&job->out);
+    close_source(&job->err);
 }
 
-static void planck_execvpe(const char *file, char * const *argv, char * const * envp) {
-    if (strchr(file, '/') != NULL) {
-        execve(file, argv, envp);
-    } else {
-        char expanded_file[PATH_MAX];
-        size_t filelen = strlen(file);
-        int sticky_errno = 0;
-        const char *const *dirs = split_path(get_path());
-        for (; *dirs; dirs++) {
-            const char *dir = *dirs;
-            size_t dirlen = strlen(dir);
-            if (filelen + dirlen + 1 >= PATH_MAX) {
-                errno = ENAMETOOLONG;
-                continue;
+static void deliver_async_result(async_job_t *job) {
+    struct SystemResult res;
+    take_job_result(job, &res);
+
+    JSValueRef args[1];
+    args[0] = result_to_object_ref(ctx, &res);
+    static JSObjectRef translate_async_result_fn = NULL;
+    if (!translate_async_result_fn) {
+        translate_async_result_fn = get_function("global", "translate_async_result");
+        JSValueProtect(ctx, translate_async_result_fn);
+    }
+    JSObjectRef result = (JSObjectRef) JSObjectCallAsFunction(ctx, translate_async_result_fn, NULL,
+                                                              1, args, NULL);
+
+    args[0] = JSValueMakeNumber(ctx, job->cb_idx);
+    static JSObjectRef do_async_sh_callback_fn = NULL;
+    if (!do_async_sh_callback_fn) {
+        do_async_sh_callback_fn = get_function("global", "do_async_sh_callback");
+        JSValueProtect(ctx, do_async_sh_callback_fn);
+    }
+    JSObjectCallAsFunction(ctx, do_async_sh_callback_fn, result, 1, args, NULL);
+
+    free_job(job);
+
+    int err = signal_task_complete();
+    if (err) {
+        engine_print_err_message("shell signal_task_complete", err);
+    }
+}
+
+// Reaps the stages of jobs whose output has closed but which can't be watched, and moves jobs
+// that are complete from running to the end of done, counting them in num_done. Returns whether
+// any stages remain to be checked on.
+static bool sweep_jobs(async_job_t **running, async_job_t **done, size_t *num_done) {
+    *num_done = 0;
+    bool unwatched = false;
+    async_job_t **link = running;
+    while (*link) {
+        async_job_t *job = *link;
+        if (job->out.fd == -1 && job->err.fd == -1) {
+            size_t i;
+            for (i = 0; i < job->num_pids; i++) {
+                if (job->pid_sources[i].fd == -1) {
+                    reap_stage(job, i);
+                }
             }
-            memcpy(expanded_file, dir, dirlen);
-            memcpy(expanded_file + dirlen, file, filelen);
-            expanded_file[dirlen + filelen] = '\0';
-            execve(expanded_file, argv, envp);
-            switch (errno) {
-                case EACCES:
-                    sticky_errno = errno;
-                case ENOENT:
-                case ENOTDIR:
-                    break;
-                default:
-                    return;
+        }
+
+        if (job->out.fd == -1 && job->err.fd == -1 && job->num_reaped == job->num_pids) {
+            close_source(&job->in);
+            free_input(&job->input);
+            *link = job->next;
+            job->next = NULL;
+            while (*done) {
+                done = &(*done)->next;
+            }
+            *done = job;
+
+            (*num_done)++;
+
+            // The child may have changed the classpath
+            dir_cache_invalidate();
+        } else {
+            if (job->out.fd == -1 && job->err.fd == -1) {
+                unwatched = true;
             }
+            link = &job->next;
         }
-        if (sticky_errno != 0)
-            errno = sticky_errno;
     }
+    return unwatched;
 }
-#endif
 
-static JSValueRef system_call(JSContextRef ctx, char **cmd, char *in_str, char **env, char *dir, int cb_idx) {
-    struct SystemResult result = {0, NULL, NULL};
-    struct SystemResult *res = &result;
+#ifndef __linux__
 
-    int err_rv;
-    int in[2];
-    err_rv = pipe(in);
-    if (err_rv) {
-        engine_perror("planck.shell setting up in pipe");
-        return create_shell_result(ctx, EX_OSERR, "", "");
+typedef struct poll_set {
+    struct pollfd *fds;
+    source_t **sources;
+    size_t capacity;
+} poll_set_t;
+
+// Waits for events on the sources of the running jobs, and on wake_fd if it isn't -1, returning
+// the sources that are ready, with NULL standing for wake_fd.
+static size_t poll_sources(poll_set_t *set, async_job_t *running, int wake_fd, int timeout, source_t **ready) {
+    size_t count = 1;
+    async_job_t *job;
+    for (job = running; job; job = job->next) {
+        count += 3 + job->num_pids;
     }
-    int out[2];
-    err_rv = pipe(out);
-    if (err_rv) {
-        engine_perror("planck.shell setting up out pipe");
-        return create_shell_result(ctx, EX_OSERR, "", "");
+    if (count > set->capacity) {
+        set->capacity = 2 * count;
+        set->fds = realloc(set->fds, set->capacity * sizeof(struct pollfd));
+        set->sources = realloc(set->sources, set->capacity * sizeof(source_t *));
     }
-    int err[2];
-    err_rv = pipe(err);
-    if (err_rv) {
-        engine_perror("planck.shell setting up err pipe");
-        return create_shell_result(ctx, EX_OSERR, "", "");
+    struct pollfd *fds = set->fds;
+    source_t **sources = set->sources;
+
+    nfds_t num_fds = 0;
+    if (wake_fd != -1) {
+        fds[num_fds].fd = wake_fd;
+        fds[num_fds].events = POLLIN;
+        sources[num_fds++] = NULL;
+    }
+    for (job = running; job; job = job->next) {
+        source_t *job_sources[3] = {&job->in, &job->out, &job->err};
+        int i;
+        for (i = 0; i < 3; i++) {
+            if (job_sources[i]->fd != -1) {
+                fds[num_fds].fd = job_sources[i]->fd;
+                fds[num_fds].events = job_sources[i]->kind == SOURCE_IN ? POLLOUT : POLLIN;
+                sources[num_fds++] = job_sources[i];
+            }
+        }
     }
 
-    pid_t pid;
-    pid = fork();
-    if (pid == -1) {
-        engine_perror("planck.shell forking subprocess");
-        return create_shell_result(ctx, EX_OSERR, "", "");
-    } else if (pid == 0) {
-        if (dir) {
-            if (chdir(dir) == -1) {
-                exit(1);
-            }
-        }
-        preopen(out[0], STDIN_FILENO);
-        preopen(err[1], STDERR_FILENO);
-        preopen(in[1], STDOUT_FILENO);
-        close(out[1]);
-        close(err[0]);
-        close(in[0]);
-        if (env) {
-#ifdef __APPLE__
-            planck_execvpe(cmd[0], cmd, env);
+    size_t num_ready = 0;
+    if (poll(fds, num_fds, timeout) > 0) {
+        nfds_t i;
+        for (i = 0; i < num_fds && num_ready < ASYNC_MAX_EVENTS; i++) {
+            if (fds[i].revents) {
+                ready[num_ready++] = sources[i];
+            }
+        }
+    }
+    return num_ready;
+}
+
+#endif
+
+static void *async_loop(void *data) {
+    async_job_t *running = NULL;
+    async_job_t *done = NULL;
+#ifndef __linux__
+    poll_set_t set = {NULL, NULL, 0};
+#endif
+
+    for (;;) {
+        // Launch queued jobs while there is room
+        pthread_mutex_lock(&async_lock);
+        while (async_queue_head && async_running < async_limit) {
+            async_job_t *job = async_queue_head;
+            async_queue_head = job->next;
+            if (!async_queue_head) {
+                async_queue_tail = NULL;
+            }
+            async_running++;
+            pthread_mutex_unlock(&async_lock);
+
+#ifdef __linux__
+            job->epoll_fd = async_epoll_fd;
+#endif
+            launch_job(job);
+            job->next = running;
+            running = job;
+
+            pthread_mutex_lock(&async_lock);
+        }
+        pthread_mutex_unlock(&async_lock);
+
+        size_t num_done;
+        bool unwatched = sweep_jobs(&running, &done, &num_done);
+        if (num_done) {
+            pthread_mutex_lock(&async_lock);
+            async_running -= num_done;
+            pthread_mutex_unlock(&async_lock);
+        }
+
+        // Deliver results without waiting for the eval lock, so that the pipes of other jobs are
+        // kept drained while JavaScript is busy
+        if (done && try_acquire_eval_lock()) {
+            while (done) {
+                async_job_t *job = done;
+                done = job->next;
+                deliver_async_result(job);
+            }
+            release_eval_lock();
+        }
+
+        int timeout = done || unwatched ? ASYNC_RETRY_MS : -1;
+        source_t *ready[ASYNC_MAX_EVENTS];
+        size_t num_ready = 0;
+#ifdef __linux__
+        struct epoll_event events[ASYNC_MAX_EVENTS];
+        int rv = epoll_wait(async_epoll_fd, events, ASYNC_MAX_EVENTS, timeout);
+        int j;
+        for (j = 0; j < rv; j++) {
+            ready[num_ready++] = events[j].data.ptr;
+        }
 #else
-            execvpe(cmd[0], cmd, env);
+        num_ready = poll_sources(&set, running, async_wake_fds[0], timeout, ready);
 #endif
-        } else {
-            execvp(cmd[0], cmd);
+
+        size_t i;
+        for (i = 0; i < num_ready; i++) {
+            if (!ready[i]) {
+                char buf[64];
+                while (read(async_wake_fds[0], buf, sizeof(buf)) > 0);
+            } else if (ready[i]->fd != -1) {
+                handle_source(ready[i]);
+            }
         }
-        if (errno == EACCES || errno == EPERM) {
-            exit(126);
-        } else if (errno == ENOENT) {
-            exit(127);
-        } else {
-            exit(1);
+    }
+    return NULL;
+}
+
+static bool start_async_loop() {
+    if (process_pipe(async_wake_fds) == -1) {
+        return false;
+    }
+    set_nonblocking(async_wake_fds[0]);
+    set_nonblocking(async_wake_fds[1]);
+#ifdef __linux__
+    async_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (async_epoll_fd == -1) {
+        return false;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    epoll_ctl(async_epoll_fd, EPOLL_CTL_ADD, async_wake_fds[0], &event);
+#endif
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, async_loop, NULL) != 0) {
+        return false;
+    }
+    pthread_detach(thread);
+    return true;
+}
+
+static void wake_async_loop() {
+    if (async_started) {
+        char c = 0;
+        write(async_wake_fds[1], &c, 1);
+    }
+}
+
+static void submit_async_job(process_stage_t *stages, size_t num_stages, bool pipeline, input_t input,
+                             size_t max_out, size_t spill_out, int cb_idx) {
+    async_job_t *job = make_job(stages, num_stages, pipeline, input, max_out, spill_out);
+    job->cb_idx = cb_idx;
+
+    int err = signal_task_started();
+    if (err) {
+        engine_print_err_message("shell signal_task_started", err);
+    }
+
+    pthread_mutex_lock(&async_lock);
+    if (!async_started) {
+        async_started = start_async_loop();
+        if (!async_started) {
+            engine_perror("planck.shell starting async thread");
         }
+    }
+    if (async_queue_tail) {
+        async_queue_tail->next = job;
     } else {
-        struct ThreadParams *params = NULL;
-        if (pid < 0) {
-            res->status = -1;
-        } else {
-            close(out[0]);
-            close(err[1]);
-            close(in[1]);
-
-            params = malloc(sizeof(struct ThreadParams));
-            params->res = result;
-            params->errpipe = err[0];
-            params->outpipe = in[0];
-            params->inpipe = out[1];
-            params->in_str = in_str;
-
-            params->pid = pid;
-            params->cb_idx = cb_idx;
-            if (cb_idx == -1) {
-                res = wait_for_child(params);
-            } else {
-                int err = signal_task_started();
-                if (err) {
-                    engine_print_err_message("shell signal_task_started", err);
-                }
+        async_queue_head = job;
+    }
+    async_queue_tail = job;
+    pthread_mutex_unlock(&async_lock);
+
+    wake_async_loop();
+}
 
-                pthread_t thrd;
-                pthread_create(&thrd, NULL, thread_proc, params);
+// Returns the number of milliseconds until the earliest deadline of the running jobs, or -1 if
+// none of them have one.
+static int time_to_deadline(async_job_t *running) {
+    uint64_t now = system_time();
+    int timeout = -1;
+    async_job_t *job;
+    for (job = running; job; job = job->next) {
+        if (job->deadline && !job->timed_out) {
+            uint64_t remaining = job->deadline > now ? job->deadline - now : 0;
+            int ms = (int) ((remaining + 999999) / 1000000);
+            if (timeout == -1 || ms < timeout) {
+                timeout = ms;
             }
         }
+    }
+    return timeout;
+}
 
-        int i;
-        for (i = 0; cmd[i] != NULL; i++) {
-            free(cmd[i]);
+// Runs jobs on the calling thread, at most parallelism at a time, returning an array of their
+// results in the order they complete, each with the index of its job. Jobs are killed once their
+// deadlines pass. If fail_fast is set, the first job that fails, by exiting with a non-zero
+// code or timing out, stops further jobs from being launched and has those running killed.
+static JSValueRef run_batch(JSContextRef ctx, async_job_t **jobs, size_t num_jobs, size_t parallelism,
+                            bool fail_fast, JSValueRef *exception) {
+#ifdef __linux__
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        *exception = make_error_with_errno(ctx);
+        size_t i;
+        for (i = 0; i < num_jobs; i++) {
+            free_job(jobs[i]);
         }
-        free(cmd);
-        if (env) {
-            int i;
-            for (i = 0; env[i] != NULL; i++) {
-                free(env[i]);
+        return JSValueMakeNull(ctx);
+    }
+#else
+    poll_set_t set = {NULL, NULL, 0};
+#endif
+
+    JSValueRef *results = malloc(num_jobs * sizeof(JSValueRef));
+    size_t num_results = 0;
+    async_job_t *running = NULL;
+    async_job_t *done = NULL;
+    size_t num_running = 0;
+    size_t next = 0;
+    bool failed = false;
+
+    for (;;) {
+        while (!failed && next < num_jobs && num_running < parallelism) {
+            async_job_t *job = jobs[next++];
+#ifdef __linux__
+            job->epoll_fd = epoll_fd;
+#endif
+            launch_job(job);
+            if (job->timeout) {
+                job->deadline = system_time() + job->timeout;
             }
-            free(env);
+            job->next = running;
+            running = job;
+            num_running++;
         }
-        free(dir);
 
-        if (cb_idx != -1) {
-            return JSValueMakeNull(ctx);
+        size_t num_done;
+        bool unwatched = sweep_jobs(&running, &done, &num_done);
+        num_running -= num_done;
+        while (done) {
+            async_job_t *job = done;
+            done = job->next;
+
+            struct SystemResult res;
+            take_job_result(job, &res);
+            if (fail_fast && !failed && (res.status != 0 || job->timed_out)) {
+                failed = true;
+                async_job_t *other;
+                for (other = running; other; other = other->next) {
+                    other->cancelled = true;
+                    abort_job(other);
+                    unwatched = true;
+                }
+            }
+
+            JSObjectRef result = result_to_object_ref(ctx, &res);
+            JSObjectSetPropertyAtIndex(ctx, result, 6, JSValueMakeNumber(ctx, job->index), NULL);
+            JSObjectSetPropertyAtIndex(ctx, result, 7, JSValueMakeBoolean(ctx, job->timed_out), NULL);
+            JSObjectSetPropertyAtIndex(ctx, result, 8, JSValueMakeBoolean(ctx, job->cancelled), NULL);
+            results[num_results++] = result;
+            free_job(job);
+        }
+
+        if (!running && (failed || next == num_jobs)) {
+            break;
+        }
+
+        int timeout = time_to_deadline(running);
+        if (unwatched && (timeout == -1 || timeout > ASYNC_RETRY_MS)) {
+            timeout = ASYNC_RETRY_MS;
+        }
+        source_t *ready[ASYNC_MAX_EVENTS];
+        size_t num_ready = 0;
+#ifdef __linux__
+        struct epoll_event events[ASYNC_MAX_EVENTS];
+        int rv = epoll_wait(epoll_fd, events, ASYNC_MAX_EVENTS, timeout);
+        int j;
+        for (j = 0; j < rv; j++) {
+            ready[num_ready++] = events[j].data.ptr;
+        }
+#else
+        num_ready = poll_sources(&set, running, -1, timeout, ready);
+#endif
+
+        size_t i;
+        for (i = 0; i < num_ready; i++) {
+            if (ready[i]->fd != -1) {
+                handle_source(ready[i]);
+            }
+        }
+
+        uint64_t now = system_time();
+        async_job_t *job;
+        for (job = running; job; job = job->next) {
+            if (job->deadline && !job->timed_out && now >= job->deadline) {
+                job->timed_out = true;
+                abort_job(job);
+            }
+        }
+    }
+
+    // Jobs that weren't launched after a failure
+    for (; next < num_jobs; next++) {
+        free_job(jobs[next]);
+    }
+
+#ifdef __linux__
+    close(epoll_fd);
+#else
+    free(set.fds);
+    free(set.sources);
+#endif
+
+    JSValueRef rv = JSObjectMakeArray(ctx, num_results, results, NULL);
+    free(results);
+    return rv;
+}
+
+// Runs the stages, connecting the stdout of each to the stdin of the next, so that data passes
+// between them without being read here. The stderr of all stages is collected together. At most
+// max_out bytes of stdout are kept, and it is spilled to a temporary file beyond spill_out bytes.
+static JSValueRef system_call(JSContextRef ctx, process_stage_t *stages, size_t num_stages, bool pipeline,
+                              input_t input, size_t max_out, size_t spill_out, int cb_idx) {
+    if (cb_idx != -1) {
+        submit_async_job(stages, num_stages, pipeline, input, max_out, spill_out, cb_idx);
+        return JSValueMakeNull(ctx);
+    }
+
+    pid_t *pids = malloc(num_stages * sizeof(pid_t));
+    int fds[3];
+    int rv = process_spawn_pipeline(stages, num_stages, input.fd, pids, fds);
+    input.fd = -1;
+    free_stages(stages, num_stages);
+    if (rv == -1) {
+        engine_perror("planck.shell launching subprocess");
+        free(pids);
+        free_input(&input);
+        return create_shell_result(ctx, EX_OSERR, "", "");
+    }
+
+    struct ThreadParams params;
+    memset(&params, 0, sizeof(params));
+    params.errpipe = fds[PROCESS_STDERR];
+    params.outpipe = fds[PROCESS_STDOUT];
+    params.inpipe = fds[PROCESS_STDIN];
+    params.in = &input;
+    init_output(&params.out, max_out, spill_out);
+    init_output(&params.err, SIZE_MAX, SIZE_MAX);
+    params.pids = pids;
+    params.num_pids = num_stages;
+    if (pipeline) {
+        params.res.exits = malloc(num_stages * sizeof(int));
+        params.res.num_exits = num_stages;
+    }
+
+    // Without input, the child sees end of file rather than waiting for it
+    if (params.inpipe != -1) {
+        if (input.bytes) {
+            set_nonblocking(params.inpipe);
         } else {
-            JSValueRef rv = (JSValueRef) result_to_object_ref(ctx, res);
-            free(params);
-            return rv;
+            close(params.inpipe);
+            params.inpipe = -1;
+        }
+    }
+
+    JSValueRef rv_value = (JSValueRef) result_to_object_ref(ctx, wait_for_child(&params));
+    free_input(&input);
+    free(pids);
+    return rv_value;
+}
+
+// Gets the input for a command from in, which may be a string, encoded with encoding, or a typed
+// array, or from the file at path, which the command is handed to read from itself. The bytes of
+// a typed array are used in place unless they must outlive the call. Returns false, setting
+// exception, if the file can't be opened.
+static bool get_input(JSContextRef ctx, JSValueRef in, JSValueRef encoding, JSValueRef path, bool copy,
+                      input_t *input, JSValueRef *exception) {
+    memset(input, 0, sizeof(input_t));
+    input->fd = -1;
+
+    if (JSValueGetType(ctx, path) == kJSTypeString) {
+        char *file = value_to_c_string(ctx, path);
+        input->fd = open(file, O_RDONLY | O_CLOEXEC);
+        free(file);
+        if (input->fd == -1) {
+            *exception = make_error_with_errno(ctx);
+            return false;
+        }
+    } else if (JSValueGetType(ctx, in) == kJSTypeString) {
+        char *enc = JSValueGetType(ctx, encoding) == kJSTypeString ? value_to_c_string(ctx, encoding) : NULL;
+        JSStringRef text = JSValueToStringCopy(ctx, in, NULL);
+        input->bytes = file_encode_text(text, enc ? enc : "UTF-8", &input->length);
+        input->owned = true;
+        JSStringRelease(text);
+        free(enc);
+        if (!input->bytes) {
+            *exception = make_error_with_errno(ctx);
+            return false;
         }
+    } else if (get_bytes(ctx, in, &input->bytes, &input->length) && copy) {
+        uint8_t *bytes = malloc(input->length ? input->length : 1);
+        if (!bytes) {
+            *exception = make_error_with_errno(ctx);
+            return false;
+        }
+        memcpy(bytes, input->bytes, input->length);
+        input->bytes = bytes;
+        input->owned = true;
+    }
+    return true;
+}
+
+// Gets a limit on the size of output in bytes, which is unlimited unless val is a number.
+static size_t get_limit(JSContextRef ctx, JSValueRef val) {
+    if (JSValueGetType(ctx, val) != kJSTypeNumber) {
+        return SIZE_MAX;
     }
+    double limit = JSValueToNumber(ctx, val, NULL);
+    return limit < 0 ? 0 : limit >= (double) SIZE_MAX ? SIZE_MAX : (size_t) limit;
 }
 
 JSValueRef function_shellexec(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
                               size_t argc, const JSValueRef args[], JSValueRef *exception) {
-    if (argc == 6) {
+    if (argc == 10) {
+        int callback_idx = -1;
+        if (!JSValueIsNull(ctx, args[9]) && JSValueIsNumber(ctx, args[9])) {
+            callback_idx = (int) JSValueToNumber(ctx, args[9], NULL);
+        }
+        input_t input;
+        if (!get_input(ctx, args[1], args[2], args[3], callback_idx != -1, &input, exception)) {
+            return JSValueMakeNull(ctx);
+        }
         char **command = cmd(ctx, (JSObjectRef) args[0]);
         if (command) {
-            char *in_str = NULL;
-            if (!JSValueIsNull(ctx, args[1])) {
-                unsigned int count = (unsigned int) array_get_count(ctx, (JSObjectRef) args[1]);
-                in_str = malloc(sizeof(char *) * (count + 1));
-                in_str[count] = 0;
-                unsigned int i;
-                for (i = 0; i < count; i++) {
-                    JSValueRef v = array_get_value_at_index(ctx, (JSObjectRef) args[1], i);
-                    double n = JSValueToNumber(ctx, v, NULL);
-                    in_str[i] = (unsigned char) n;
+            process_stage_t *stage = calloc(1, sizeof(process_stage_t));
+            stage->cmd = command;
+            if (!JSValueIsNull(ctx, args[7])) {
+                stage->env = env(ctx, (JSObjectRef) args[7]);
+            }
+            if (!JSValueIsNull(ctx, args[8])) {
+                stage->dir = value_to_c_string(ctx, args[8]);
+            }
+            return system_call(ctx, stage, 1, false, input, get_limit(ctx, args[5]), get_limit(ctx, args[6]),
+                               callback_idx);
+        }
+        free_input(&input);
+    }
+    return JSValueMakeNull(ctx);
+}
+
+JSValueRef function_shell_pipeline(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                   size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 8
+        && JSValueGetType(ctx, args[0]) == kJSTypeObject
+        && JSValueGetType(ctx, args[6]) == kJSTypeObject
+        && JSValueGetType(ctx, args[7]) == kJSTypeObject) {
+
+        size_t num_stages = (size_t) array_get_count(ctx, (JSObjectRef) args[0]);
+        if (num_stages == 0) {
+            return JSValueMakeNull(ctx);
+        }
+
+        input_t input;
+        if (!get_input(ctx, args[1], args[2], args[3], false, &input, exception)) {
+            return JSValueMakeNull(ctx);
+        }
+
+        process_stage_t *stages = calloc(num_stages, sizeof(process_stage_t));
+        size_t i;
+        for (i = 0; i < num_stages; i++) {
+            JSValueRef command = array_get_value_at_index(ctx, (JSObjectRef) args[0], i);
+            JSValueRef environment = array_get_value_at_index(ctx, (JSObjectRef) args[6], i);
+            JSValueRef dir = array_get_value_at_index(ctx, (JSObjectRef) args[7], i);
+            if (JSValueGetType(ctx, command) != kJSTypeObject
+                || !(stages[i].cmd = cmd(ctx, (JSObjectRef) command))) {
+                free_stages(stages, num_stages);
+                free_input(&input);
+                return JSValueMakeNull(ctx);
+            }
+            if (JSValueGetType(ctx, environment) == kJSTypeObject) {
+                stages[i].env = env(ctx, (JSObjectRef) environment);
+            }
+            if (JSValueGetType(ctx, dir) == kJSTypeString) {
+                stages[i].dir = value_to_c_string(ctx, dir);
+            }
+        }
+
+        return system_call(ctx, stages, num_stages, true, input, get_limit(ctx, args[4]), get_limit(ctx, args[5]),
+                           -1);
+    }
+    return JSValueMakeNull(ctx);
+}
+
+JSValueRef function_shell_all(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                              size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 11
+        && JSValueGetType(ctx, args[0]) == kJSTypeObject
+        && JSValueGetType(ctx, args[1]) == kJSTypeObject
+        && JSValueGetType(ctx, args[2]) == kJSTypeObject
+        && JSValueGetType(ctx, args[3]) == kJSTypeObject
+        && JSValueGetType(ctx, args[4]) == kJSTypeObject
+        && JSValueGetType(ctx, args[5]) == kJSTypeObject
+        && JSValueGetType(ctx, args[6]) == kJSTypeObject
+        && JSValueGetType(ctx, args[7]) == kJSTypeNumber) {
+
+        size_t num_jobs = (size_t) array_get_count(ctx, (JSObjectRef) args[0]);
+        size_t parallelism = (size_t) JSValueToNumber(ctx, args[7], NULL);
+        if (parallelism == 0) {
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            parallelism = cpus > 0 ? (size_t) cpus : 1;
+        }
+        bool fail_fast = JSValueToBoolean(ctx, args[8]);
+        size_t max_out = get_limit(ctx, args[9]);
+        size_t spill_out = get_limit(ctx, args[10]);
+
+        async_job_t **jobs = calloc(num_jobs ? num_jobs : 1, sizeof(async_job_t *));
+        size_t i;
+        for (i = 0; i < num_jobs; i++) {
+            JSValueRef command = array_get_value_at_index(ctx, (JSObjectRef) args[0], i);
+            JSValueRef environment = array_get_value_at_index(ctx, (JSObjectRef) args[4], i);
+            JSValueRef dir = array_get_value_at_index(ctx, (JSObjectRef) args[5], i);
+            JSValueRef timeout = array_get_value_at_index(ctx, (JSObjectRef) args[6], i);
+
+            // The batch runs on this thread, so typed arrays can be fed in place
+            input_t input;
+            bool valid = get_input(ctx, array_get_value_at_index(ctx, (JSObjectRef) args[1], i),
+                                   array_get_value_at_index(ctx, (JSObjectRef) args[2], i),
+                                   array_get_value_at_index(ctx, (JSObjectRef) args[3], i), false, &input,
+                                   exception);
+            process_stage_t *stage = calloc(1, sizeof(process_stage_t));
+            if (valid && (JSValueGetType(ctx, command) != kJSTypeObject
+                          || !(stage->cmd = cmd(ctx, (JSObjectRef) command)))) {
+                free_input(&input);
+                valid = false;
+            }
+            if (!valid) {
+                free(stage);
+                size_t j;
+                for (j = 0; j < i; j++) {
+                    free_job(jobs[j]);
                 }
+                free(jobs);
+                return JSValueMakeNull(ctx);
+            }
+            if (JSValueGetType(ctx, environment) == kJSTypeObject) {
+                stage->env = env(ctx, (JSObjectRef) environment);
             }
-            char **environment = NULL;
-            if (!JSValueIsNull(ctx, args[3])) {
-                environment = env(ctx, (JSObjectRef) args[3]);
+            if (JSValueGetType(ctx, dir) == kJSTypeString) {
+                stage->dir = value_to_c_string(ctx, dir);
             }
-            char *dir = NULL;
-            if (!JSValueIsNull(ctx, args[4])) {
-                dir = value_to_c_string(ctx, args[4]);
+
+            jobs[i] = make_job(stage, 1, false, input, max_out, spill_out);
+            jobs[i]->index = i;
+            if (JSValueGetType(ctx, timeout) == kJSTypeNumber) {
+                double seconds = JSValueToNumber(ctx, timeout, NULL);
+                jobs[i]->timeout = seconds > 0 ? (uint64_t) (seconds * 1e9) : 1;
+            }
+        }
+
+        JSValueRef rv = run_batch(ctx, jobs, num_jobs, parallelism, fail_fast, exception);
+        free(jobs);
+        return rv;
+    }
+    return JSValueMakeNull(ctx);
+}
+
+JSValueRef function_shell_set_async_limit(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                          size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 1 && JSValueGetType(ctx, args[0]) == kJSTypeNumber) {
+        double limit = JSValueToNumber(ctx, args[0], NULL);
+
+        pthread_mutex_lock(&async_lock);
+        async_limit = limit < 1 ? 1 : (size_t) limit;
+        pthread_mutex_unlock(&async_lock);
+
+        // Launch any queued commands that now fit
+        wake_async_loop();
+    }
+    return JSValueMakeNull(ctx);
+}
+
+#define PROCESS_READ_SIZE (64 * 1024)
+
+static void finalize_process(JSObjectRef object) {
+    process_t *process = JSObjectGetPrivate(object);
+    if (process) {
+        process_release(process);
+    }
+}
+
+static process_t *get_process(JSContextRef ctx, JSValueRef value) {
+    if (JSValueGetType(ctx, value) != kJSTypeObject) {
+        return NULL;
+    }
+    return JSObjectGetPrivate(JSValueToObject(ctx, value, NULL));
+}
+
+static JSObjectRef get_callback(JSContextRef ctx, JSValueRef value) {
+    if (JSValueGetType(ctx, value) != kJSTypeObject) {
+        return NULL;
+    }
+    JSObjectRef object = JSValueToObject(ctx, value, NULL);
+    return JSObjectIsFunction(ctx, object) ? object : NULL;
+}
+
+JSValueRef function_process_start(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                  size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 7
+        && JSValueGetType(ctx, args[0]) == kJSTypeObject
+        && JSValueGetType(ctx, args[3]) == kJSTypeString) {
+
+        char **command = cmd(ctx, (JSObjectRef) args[0]);
+        if (!command) {
+            return JSValueMakeNull(ctx);
+        }
+        char **environment = NULL;
+        if (!JSValueIsNull(ctx, args[1])) {
+            environment = env(ctx, (JSObjectRef) args[1]);
+        }
+        char *dir = NULL;
+        if (!JSValueIsNull(ctx, args[2])) {
+            dir = value_to_c_string(ctx, args[2]);
+        }
+        char *encoding = value_to_c_string(ctx, args[3]);
+
+        process_t *process = process_start(command, environment, dir, encoding,
+                                           get_callback(ctx, args[4]),
+                                           get_callback(ctx, args[5]),
+                                           get_callback(ctx, args[6]));
+        int saved_errno = errno;
+
+        free_strings(command);
+        free_strings(environment);
+        free(dir);
+        free(encoding);
+
+        if (!process) {
+            errno = saved_errno;
+            *exception = make_error_with_errno(ctx);
+            return JSValueMakeNull(ctx);
+        }
+
+        // Streams left open by JavaScript are closed when the object is collected
+        static JSClassRef process_class = NULL;
+        if (!process_class) {
+            JSClassDefinition definition = kJSClassDefinitionEmpty;
+            definition.className = "Process";
+            definition.finalize = finalize_process;
+            process_class = JSClassCreate(&definition);
+        }
+
+        return JSObjectMake(ctx, process_class, process);
+    }
+    return JSValueMakeNull(ctx);
+}
+
+JSValueRef function_process_read(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                 size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    process_t *process;
+    if (argc == 3
+        && (process = get_process(ctx, args[0])) != NULL
+        && JSValueGetType(ctx, args[1]) == kJSTypeNumber
+        && JSValueGetType(ctx, args[2]) == kJSTypeString) {
+
+        int stream = (int) JSValueToNumber(ctx, args[1], NULL);
+        char *mode = value_to_c_string(ctx, args[2]);
+        bool bytes = strcmp(mode, "bytes") == 0;
+        bool line = strcmp(mode, "line") == 0;
+        free(mode);
+
+        if (bytes) {
+            uint8_t *buf = malloc(PROCESS_READ_SIZE);
+            if (!buf) {
+                *exception = make_error_with_errno(ctx);
+                return JSValueMakeNull(ctx);
             }
-            int callback_idx = -1;
-            if (!JSValueIsNull(ctx, args[5]) && JSValueIsNumber(ctx, args[5])) {
-                callback_idx = (int) JSValueToNumber(ctx, args[5], NULL);
+            ssize_t n = process_read_bytes(process, stream, buf, PROCESS_READ_SIZE);
+            if (n <= 0) {
+                if (n == -1) {
+                    *exception = make_error_with_errno(ctx);
+                }
+                free(buf);
+                return JSValueMakeNull(ctx);
             }
-            return system_call(ctx, command, in_str, environment, dir, callback_idx);
+            uint8_t *bytes_read = realloc(buf, (size_t) n);
+            return make_uint8_array(ctx, bytes_read ? bytes_read : buf, (size_t) n);
+        }
+
+        JSStringRef text;
+        if (!process_read_text(process, stream, line, &text)) {
+            *exception = make_error_with_errno(ctx);
+            return JSValueMakeNull(ctx);
+        }
+        if (!text) {
+            return JSValueMakeNull(ctx);
+        }
+        JSValueRef rv = JSValueMakeString(ctx, text);
+        JSStringRelease(text);
+        return rv;
+    }
+    return JSValueMakeNull(ctx);
+}
+
+JSValueRef function_process_write(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                  size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    process_t *process;
+    if (argc == 2
+        && (process = get_process(ctx, args[0])) != NULL) {
+
+        bool written;
+        uint8_t *bytes;
+        size_t length;
+        if (JSValueGetType(ctx, args[1]) == kJSTypeString) {
+            JSStringRef text = JSValueToStringCopy(ctx, args[1], NULL);
+            written = process_write_string(process, text);
+            JSStringRelease(text);
+        } else if (get_bytes(ctx, args[1], &bytes, &length)) {
+            written = process_write(process, bytes, length);
+        } else {
+            return JSValueMakeNull(ctx);
+        }
+
+        if (!written) {
+            *exception = make_error_with_errno(ctx);
+        }
+    }
+    return JSValueMakeNull(ctx);
+}
+
+JSValueRef function_process_flush(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                  size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    process_t *process;
+    if (argc == 1
+        && (process = get_process(ctx, args[0])) != NULL) {
+        if (!process_flush(process)) {
+            *exception = make_error_with_errno(ctx);
+        }
+    }
+    return JSValueMakeNull(ctx);
+}
+
+JSValueRef function_process_close(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                  size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    process_t *process;
+    if (argc == 2
+        && (process = get_process(ctx, args[0])) != NULL
+        && JSValueGetType(ctx, args[1]) == kJSTypeNumber) {
+        process_close_stream(process, (int) JSValueToNumber(ctx, args[1], NULL));
+    }
+    return JSValueMakeNull(ctx);
+}
+
+JSValueRef function_process_wait(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                 size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    process_t *process;
+    if (argc == 1
+        && (process = get_process(ctx, args[0])) != NULL) {
+        return JSValueMakeNumber(ctx, process_wait(process));
+    }
+    return JSValueMakeNull(ctx);
+}
+
+JSValueRef function_process_exit_code(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                      size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    process_t *process;
+    int exit_code;
+    if (argc == 1
+        && (process = get_process(ctx, args[0])) != NULL
+        && process_poll(process, &exit_code)) {
+        return JSValueMakeNumber(ctx, exit_code);
+    }
+    return JSValueMakeNull(ctx);
+}
+
+JSValueRef function_process_kill(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                 size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    process_t *process;
+    if (argc == 2
+        && (process = get_process(ctx, args[0])) != NULL
+        && JSValueGetType(ctx, args[1]) == kJSTypeNumber) {
+        if (process_kill(process, (int) JSValueToNumber(ctx, args[1], NULL)) == -1) {
+            *exception = make_error_with_errno(ctx);
         }
     }
     return JSValueMakeNull(ctx);
@@ -2,3 +2,36 @@
 
 JSValueRef function_shellexec(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
                               size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_shell_pipeline(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                   size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_shell_all(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                              size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_shell_set_async_limit(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                          size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_process_start(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                  size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_process_read(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                 size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_process_write(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                  size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_process_flush(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                  size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_process_close(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                  size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_process_wait(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                 size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_process_exit_code(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                      size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_process_kill(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                 size_t argc, const JSValueRef args[], JSValueRef *exception);
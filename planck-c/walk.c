@@ -0,0 +1,239 @@
+#include <dirent.h>
+#include <fnmatch.h>
+#include <regex.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "walk.h"
+
+typedef struct frame {
+    DIR *dir;
+    size_t path_len;
+    dev_t dev;
+    ino_t ino;
+} frame_t;
+
+struct walk {
+    char *path;
+    size_t path_capacity;
+    size_t root_len;
+    frame_t *frames;
+    size_t num_frames;
+    size_t frames_capacity;
+    bool started;
+
+    int max_depth;
+    bool follow_links;
+    char *glob;
+    bool glob_path;
+    bool has_regex;
+    regex_t regex;
+    bool attributes;
+
+    struct stat file_stat;
+};
+
+walk_t *walk_open(const char *root, const walk_options_t *options, char **error_msg) {
+    walk_t *walk = calloc(1, sizeof(walk_t));
+    if (!walk) {
+        return NULL;
+    }
+
+    if (options->regex) {
+        int err = regcomp(&walk->regex, options->regex, REG_EXTENDED | REG_NOSUB);
+        if (err) {
+            char msg[256];
+            regerror(err, &walk->regex, msg, sizeof(msg));
+            *error_msg = strdup(msg);
+            free(walk);
+            return NULL;
+        }
+        walk->has_regex = true;
+    }
+
+    walk->root_len = strlen(root);
+    walk->path_capacity = walk->root_len + 256;
+    walk->path = malloc(walk->path_capacity);
+    memcpy(walk->path, root, walk->root_len + 1);
+
+    walk->max_depth = options->max_depth;
+    walk->follow_links = options->follow_links;
+    walk->attributes = options->attributes;
+    if (options->glob) {
+        walk->glob = strdup(options->glob);
+        walk->glob_path = strchr(options->glob, '/') != NULL;
+    }
+
+    return walk;
+}
+
+void walk_close(walk_t *walk) {
+    size_t i;
+    for (i = 0; i < walk->num_frames; i++) {
+        closedir(walk->frames[i].dir);
+    }
+    free(walk->frames);
+    free(walk->path);
+    free(walk->glob);
+    if (walk->has_regex) {
+        regfree(&walk->regex);
+    }
+    free(walk);
+}
+
+// Determines whether the entry at walk->path is a directory, only stat'ing it if its attributes
+// are wanted or d_type doesn't tell. Returns whether walk->file_stat holds its attributes.
+static bool classify(walk_t *walk, unsigned char d_type, bool follow, bool *is_dir) {
+    bool has_stat = walk->attributes && lstat(walk->path, &walk->file_stat) == 0;
+
+    switch (d_type) {
+        case DT_DIR:
+            *is_dir = true;
+            return has_stat;
+        case DT_LNK:
+            if (!follow) {
+                *is_dir = false;
+                return has_stat;
+            }
+            break;
+        case DT_UNKNOWN:
+            break;
+        default:
+            *is_dir = false;
+            return has_stat;
+    }
+
+    if (has_stat && !S_ISLNK(walk->file_stat.st_mode)) {
+        *is_dir = S_ISDIR(walk->file_stat.st_mode);
+        return has_stat;
+    }
+
+    struct stat file_stat;
+    *is_dir = (follow ? stat(walk->path, &file_stat) : lstat(walk->path, &file_stat)) == 0 &&
+              S_ISDIR(file_stat.st_mode);
+    return has_stat;
+}
+
+// Opens the directory at walk->path so that its contents are visited next.
+static void push(walk_t *walk, size_t path_len) {
+    DIR *dir = opendir(walk->path);
+    if (!dir) {
+        return;
+    }
+
+    struct stat file_stat;
+    if (walk->follow_links && fstat(dirfd(dir), &file_stat) == 0) {
+        // Don't follow a link back into a directory being walked
+        size_t i;
+        for (i = 0; i < walk->num_frames; i++) {
+            if (walk->frames[i].dev == file_stat.st_dev && walk->frames[i].ino == file_stat.st_ino) {
+                closedir(dir);
+                return;
+            }
+        }
+    }
+
+    if (walk->num_frames == walk->frames_capacity) {
+        size_t capacity = walk->frames_capacity ? 2 * walk->frames_capacity : 16;
+        frame_t *frames = realloc(walk->frames, capacity * sizeof(frame_t));
+        if (!frames) {
+            closedir(dir);
+            return;
+        }
+        walk->frames = frames;
+        walk->frames_capacity = capacity;
+    }
+
+    frame_t *frame = &walk->frames[walk->num_frames++];
+    frame->dir = dir;
+    frame->path_len = path_len;
+    frame->dev = walk->follow_links ? file_stat.st_dev : 0;
+    frame->ino = walk->follow_links ? file_stat.st_ino : 0;
+}
+
+static bool matches(walk_t *walk, size_t path_len) {
+    if (walk->glob) {
+        const char *subject;
+        if (walk->glob_path) {
+            subject = path_len > walk->root_len ? walk->path + walk->root_len : "";
+            while (*subject == '/') {
+                subject++;
+            }
+        } else {
+            subject = strrchr(walk->path, '/');
+            subject = subject ? subject + 1 : walk->path;
+        }
+        if (fnmatch(walk->glob, subject, walk->glob_path ? FNM_PATHNAME : 0) != 0) {
+            return false;
+        }
+    }
+
+    return !walk->has_regex || regexec(&walk->regex, walk->path, 0, NULL, 0) == 0;
+}
+
+const char *walk_next(walk_t *walk, struct stat **file_stat) {
+    for (;;) {
+        bool is_dir;
+        bool has_stat;
+        size_t depth;
+        size_t path_len;
+
+        if (!walk->started) {
+            walk->started = true;
+            depth = 0;
+            path_len = walk->root_len;
+            has_stat = classify(walk, DT_UNKNOWN, true, &is_dir);
+        } else {
+            if (walk->num_frames == 0) {
+                return NULL;
+            }
+
+            frame_t *frame = &walk->frames[walk->num_frames - 1];
+            struct dirent *entry = readdir(frame->dir);
+            if (!entry) {
+                closedir(frame->dir);
+                walk->num_frames--;
+                continue;
+            }
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+
+            size_t name_len = strlen(entry->d_name);
+            path_len = frame->path_len + 1 + name_len;
+            if (path_len + 1 > walk->path_capacity) {
+                size_t capacity = 2 * (path_len + 1);
+                char *path = realloc(walk->path, capacity);
+                if (!path) {
+                    continue;
+                }
+                walk->path = path;
+                walk->path_capacity = capacity;
+            }
+            walk->path[frame->path_len] = '/';
+            memcpy(walk->path + frame->path_len + 1, entry->d_name, name_len + 1);
+
+            depth = walk->num_frames;
+            has_stat = classify(walk, entry->d_type, walk->follow_links, &is_dir);
+        }
+
+        if (is_dir && (walk->max_depth < 0 || depth < (size_t) walk->max_depth)) {
+            // Children are joined to the path with a single slash
+            size_t prefix_len = path_len;
+            if (depth == 0 && prefix_len > 0 && walk->path[prefix_len - 1] == '/') {
+                prefix_len--;
+            }
+            push(walk, prefix_len);
+        }
+
+        if (matches(walk, path_len)) {
+            if (file_stat) {
+                *file_stat = has_stat ? &walk->file_stat : NULL;
+            }
+            return walk->path;
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#include <stdbool.h>
+#include <sys/stat.h>
+
+// Walks a directory tree depth first, visiting each directory before its contents and the
+// contents of each directory in the order readdir returns them (the order of file-seq).
+// Entry types come from readdir where possible, so that files are only stat'ed when their
+// attributes are wanted.
+
+typedef struct walk walk_t;
+
+typedef struct walk_options {
+    // Entries deeper than this below the root are skipped; negative for no limit.
+    int max_depth;
+    // Whether to descend into symbolic links to directories; the root is always followed.
+    bool follow_links;
+    // Only entries whose names match this fnmatch pattern are returned, or, if the pattern
+    // contains a slash, whose paths relative to the root match it.
+    const char *glob;
+    // Only entries whose paths match this POSIX extended regular expression are returned.
+    const char *regex;
+    // Whether to lstat each entry returned.
+    bool attributes;
+} walk_options_t;
+
+// Starts a walk of the tree at root, returning NULL and setting *error_msg if the options are
+// invalid.
+walk_t *walk_open(const char *root, const walk_options_t *options, char **error_msg);
+
+// Returns the path of the next entry, which is valid until the next call, or NULL when the walk
+// is complete. If attributes were requested, *file_stat is set to the entry's attributes, or to
+// NULL if they couldn't be read.
+const char *walk_next(walk_t *walk, struct stat **file_stat);
+
+void walk_close(walk_t *walk);
@@ -0,0 +1,461 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "watch.h"
+
+#ifdef __linux__
+
+#include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "clock.h"
+#include "engine.h"
+#include "jsc_utils.h"
+#include "process.h"
+#include "tasks.h"
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO \
+                    | IN_DELETE_SELF)
+
+// Changes are delivered regardless of debouncing once this many distinct paths are pending
+#define WATCH_MAX_PENDING 10000
+
+typedef struct watched {
+    int wd;
+    char *path;
+} watched_t;
+
+typedef struct change {
+    char *path;
+    const char *kind;
+} change_t;
+
+typedef struct watch {
+    int id;
+    bool stopped;
+    int inotify_fd;
+    int wake_fds[2];
+    bool recursive;
+    int debounce_ms;
+    JSObjectRef callback;
+
+    watched_t *watched;
+    size_t num_watched;
+    size_t watched_capacity;
+
+    change_t *changes;
+    size_t num_changes;
+    size_t changes_capacity;
+    uint64_t last_change_time;
+
+    struct watch *next;
+} watch_t;
+
+static pthread_mutex_t watches_lock = PTHREAD_MUTEX_INITIALIZER;
+static watch_t *watches = NULL;
+static int next_id = 1;
+
+static void record_change(watch_t *watch, const char *path, const char *kind) {
+    size_t i;
+    for (i = 0; i < watch->num_changes; i++) {
+        change_t *change = &watch->changes[i];
+        if (strcmp(change->path, path) == 0) {
+            if (strcmp(change->kind, "create") == 0) {
+                if (strcmp(kind, "delete") == 0) {
+                    // Created and deleted again before anyone saw it
+                    free(change->path);
+                    watch->changes[i] = watch->changes[--watch->num_changes];
+                }
+            } else {
+                change->kind = kind;
+            }
+            return;
+        }
+    }
+
+    if (watch->num_changes == watch->changes_capacity) {
+        size_t capacity = watch->changes_capacity ? 2 * watch->changes_capacity : 16;
+        change_t *changes = realloc(watch->changes, capacity * sizeof(change_t));
+        if (!changes) {
+            return;
+        }
+        watch->changes = changes;
+        watch->changes_capacity = capacity;
+    }
+
+    watch->changes[watch->num_changes].path = strdup(path);
+    watch->changes[watch->num_changes].kind = kind;
+    watch->num_changes++;
+}
+
+static const char *watched_path(watch_t *watch, int wd) {
+    size_t i;
+    for (i = 0; i < watch->num_watched; i++) {
+        if (watch->watched[i].wd == wd) {
+            return watch->watched[i].path;
+        }
+    }
+    return NULL;
+}
+
+static void forget_watched(watch_t *watch, int wd) {
+    size_t i;
+    for (i = 0; i < watch->num_watched; i++) {
+        if (watch->watched[i].wd == wd) {
+            free(watch->watched[i].path);
+            watch->watched[i] = watch->watched[--watch->num_watched];
+            return;
+        }
+    }
+}
+
+static int add_watch(watch_t *watch, const char *path) {
+    int wd = inotify_add_watch(watch->inotify_fd, path, WATCH_MASK);
+    if (wd == -1) {
+        return -1;
+    }
+
+    if (watched_path(watch, wd)) {
+        // Already watched, for example through another of the requested paths
+        return 0;
+    }
+
+    if (watch->num_watched == watch->watched_capacity) {
+        size_t capacity = watch->watched_capacity ? 2 * watch->watched_capacity : 16;
+        watched_t *watched = realloc(watch->watched, capacity * sizeof(watched_t));
+        if (!watched) {
+            inotify_rm_watch(watch->inotify_fd, wd);
+            return -1;
+        }
+        watch->watched = watched;
+        watch->watched_capacity = capacity;
+    }
+
+    watch->watched[watch->num_watched].wd = wd;
+    watch->watched[watch->num_watched].path = strdup(path);
+    watch->num_watched++;
+    return 0;
+}
+
+// Watches the directories beneath path. If report is set, the files and directories found are
+// recorded as created, as they may have appeared before the watch was in place.
+static void add_subdirectories(watch_t *watch, const char *path, bool report) {
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        size_t len = strlen(path) + strlen(entry->d_name) + 2;
+        char *child = malloc(len);
+        snprintf(child, len, "%s/%s", path, entry->d_name);
+
+        if (report) {
+            record_change(watch, child, "create");
+        }
+
+        bool is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat file_stat;
+            is_dir = lstat(child, &file_stat) == 0 && S_ISDIR(file_stat.st_mode);
+        }
+
+        if (is_dir && add_watch(watch, child) == 0) {
+            add_subdirectories(watch, child, report);
+        }
+
+        free(child);
+    }
+
+    closedir(dir);
+}
+
+static void handle_event(watch_t *watch, struct inotify_event *event) {
+    if (event->mask & IN_IGNORED) {
+        forget_watched(watch, event->wd);
+        return;
+    }
+
+    const char *dir_path = watched_path(watch, event->wd);
+    if (!dir_path) {
+        return;
+    }
+
+    char *path;
+    if (event->len) {
+        size_t len = strlen(dir_path) + strlen(event->name) + 2;
+        path = malloc(len);
+        snprintf(path, len, "%s/%s", dir_path, event->name);
+    } else {
+        path = strdup(dir_path);
+    }
+
+    const char *kind = "modify";
+    if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+        kind = "create";
+    } else if (event->mask & (IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF)) {
+        kind = "delete";
+    }
+
+    record_change(watch, path, kind);
+
+    if (watch->recursive && (event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+        if (add_watch(watch, path) == 0) {
+            add_subdirectories(watch, path, true);
+        }
+    }
+
+    free(path);
+}
+
+static void deliver_changes(watch_t *watch) {
+    acquire_eval_lock();
+
+    pthread_mutex_lock(&watches_lock);
+    bool stopped = watch->stopped;
+    pthread_mutex_unlock(&watches_lock);
+
+    if (!stopped) {
+        JSValueRef *items = malloc(watch->num_changes * sizeof(JSValueRef));
+        size_t i;
+        for (i = 0; i < watch->num_changes; i++) {
+            JSValueRef pair[2];
+            pair[0] = c_string_to_value(ctx, watch->changes[i].path);
+            pair[1] = c_string_to_value(ctx, watch->changes[i].kind);
+            items[i] = JSObjectMakeArray(ctx, 2, pair, NULL);
+            JSValueProtect(ctx, items[i]);
+        }
+
+        JSValueRef args[1];
+        args[0] = JSObjectMakeArray(ctx, watch->num_changes, items, NULL);
+
+        for (i = 0; i < watch->num_changes; i++) {
+            JSValueUnprotect(ctx, items[i]);
+        }
+        free(items);
+
+        JSObjectCallAsFunction(ctx, watch->callback, NULL, 1, args, NULL);
+    }
+
+    release_eval_lock();
+
+    size_t i;
+    for (i = 0; i < watch->num_changes; i++) {
+        free(watch->changes[i].path);
+    }
+    watch->num_changes = 0;
+}
+
+// Removes the watch with the given id from the list of watches, returning it, or NULL if there's
+// no such watch. Must be called with watches_lock held.
+static watch_t *unlink_watch(int id) {
+    watch_t **link = &watches;
+    while (*link && (*link)->id != id) {
+        link = &(*link)->next;
+    }
+    watch_t *watch = *link;
+    if (watch) {
+        *link = watch->next;
+        watch->stopped = true;
+    }
+    return watch;
+}
+
+static void free_watch(watch_t *watch) {
+    size_t i;
+    for (i = 0; i < watch->num_watched; i++) {
+        free(watch->watched[i].path);
+    }
+    free(watch->watched);
+    for (i = 0; i < watch->num_changes; i++) {
+        free(watch->changes[i].path);
+    }
+    free(watch->changes);
+    close(watch->inotify_fd);
+    close(watch->wake_fds[0]);
+    close(watch->wake_fds[1]);
+    free(watch);
+}
+
+static void *watch_thread(void *data) {
+    watch_t *watch = data;
+
+    // Large enough for many events, and aligned for struct inotify_event
+    char buf[64 * 1024] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    for (;;) {
+        int timeout = -1;
+        if (watch->num_changes) {
+            uint64_t elapsed_ms = (system_time() - watch->last_change_time) / 1000000;
+            timeout = elapsed_ms >= (uint64_t) watch->debounce_ms ? 0 : watch->debounce_ms - (int) elapsed_ms;
+        }
+
+        struct pollfd fds[2];
+        fds[0].fd = watch->inotify_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = watch->wake_fds[0];
+        fds[1].events = POLLIN;
+
+        int n = poll(fds, 2, timeout);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if (fds[1].revents) {
+            break;
+        }
+
+        if (n == 0) {
+            deliver_changes(watch);
+            continue;
+        }
+
+        ssize_t len = read(watch->inotify_fd, buf, sizeof(buf));
+        if (len <= 0) {
+            if (len == -1 && (errno == EINTR || errno == EAGAIN)) {
+                continue;
+            }
+            break;
+        }
+
+        char *p;
+        for (p = buf; p < buf + len;) {
+            struct inotify_event *event = (struct inotify_event *) p;
+            handle_event(watch, event);
+            p += sizeof(struct inotify_event) + event->len;
+        }
+        watch->last_change_time = system_time();
+
+        if (watch->num_changes >= WATCH_MAX_PENDING) {
+            deliver_changes(watch);
+        }
+    }
+
+    pthread_mutex_lock(&watches_lock);
+    unlink_watch(watch->id);
+    pthread_mutex_unlock(&watches_lock);
+
+    acquire_eval_lock();
+    JSValueUnprotect(ctx, watch->callback);
+    release_eval_lock();
+
+    free_watch(watch);
+
+    int err = signal_task_complete();
+    if (err) {
+        engine_print_err_message("watch signal_task_complete", err);
+    }
+
+    return NULL;
+}
+
+int watch_start(char **paths, size_t num_paths, bool recursive, int debounce_ms, JSObjectRef callback) {
+    watch_t *watch = calloc(1, sizeof(watch_t));
+    if (!watch) {
+        return -1;
+    }
+    watch->recursive = recursive;
+    watch->debounce_ms = debounce_ms < 0 ? 0 : debounce_ms;
+    watch->wake_fds[0] = watch->wake_fds[1] = -1;
+
+    watch->inotify_fd = inotify_init1(IN_CLOEXEC);
+    // The wake pipe is close-on-exec, so that it isn't inherited by launched processes
+    if (watch->inotify_fd == -1 || process_pipe(watch->wake_fds) == -1) {
+        goto out_error;
+    }
+
+    size_t i;
+    for (i = 0; i < num_paths; i++) {
+        // Paths are reported relative to the watched paths, so avoid doubled slashes
+        size_t len = strlen(paths[i]);
+        while (len > 1 && paths[i][len - 1] == '/') {
+            paths[i][--len] = '\0';
+        }
+        if (add_watch(watch, paths[i]) == -1) {
+            goto out_error;
+        }
+        if (recursive) {
+            add_subdirectories(watch, paths[i], false);
+        }
+    }
+
+    watch->callback = callback;
+    JSValueProtect(ctx, callback);
+
+    pthread_mutex_lock(&watches_lock);
+    watch->id = next_id++;
+    watch->next = watches;
+    watches = watch;
+    pthread_mutex_unlock(&watches_lock);
+
+    int err = signal_task_started();
+    if (err) {
+        engine_print_err_message("watch signal_task_started", err);
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    err = pthread_create(&thread, &attr, watch_thread, watch);
+    pthread_attr_destroy(&attr);
+    if (err) {
+        watch_stop(watch->id);
+        JSValueUnprotect(ctx, callback);
+        free_watch(watch);
+        signal_task_complete();
+        errno = err;
+        return -1;
+    }
+
+    return watch->id;
+
+    out_error:
+    {
+        int saved_errno = errno;
+        free_watch(watch);
+        errno = saved_errno;
+    }
+    return -1;
+}
+
+int watch_stop(int id) {
+    pthread_mutex_lock(&watches_lock);
+    watch_t *watch = unlink_watch(id);
+    if (watch) {
+        // Wake the watch thread, which cleans up
+        ssize_t written = write(watch->wake_fds[1], "x", 1);
+        (void) written;
+    }
+    pthread_mutex_unlock(&watches_lock);
+
+    return watch ? 0 : -1;
+}
+
+#else
+
+int watch_start(char **paths, size_t num_paths, bool recursive, int debounce_ms, JSObjectRef callback) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int watch_stop(int id) {
+    return -1;
+}
+
+#endif
@@ -0,0 +1,17 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <JavaScriptCore/JavaScript.h>
+
+// Watches files and directories for changes, calling callback with an array of [path, kind]
+// pairs, where kind is "create", "modify", or "delete", once no further changes have been seen
+// for debounce_ms. Directories are watched recursively if requested, including those created
+// later. Trailing slashes are stripped from paths in place, and changes are reported with paths
+// beginning with the watched path. Each watch counts as an outstanding task until it is stopped.
+//
+// Returns the id of the watch, or -1 with errno set on failure, which is ENOSYS on platforms
+// without inotify.
+int watch_start(char **paths, size_t num_paths, bool recursive, int debounce_ms, JSObjectRef callback);
+
+// Stops the watch with the given id, returning -1 if there is no such watch.
+int watch_stop(int id);